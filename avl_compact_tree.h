@@ -0,0 +1,1059 @@
+#ifndef __AVL_COMPACT_TREE_H__
+#define __AVL_COMPACT_TREE_H__
+
+#include "avl_tree.h"
+
+#include <stdint.h>  // for uint32_t
+#include <stdexcept> // for std::length_error
+
+namespace avl
+{
+  /**
+   * an AVL tree with a compact node layout, for big trees of small data.
+   * the nodes live in 1 contiguous array and refer to their children by 32 bit indices,
+   * the balance factor is packed into the 2 top bits of the left index and there is no parent index,
+   * so a node is the data plus 8 bytes (avl::tree<int> nodes are 40 bytes, avl::compact_tree<int> nodes are 12).
+   * insert and remove keep the path from the root on a small stack instead, so do the iterators.
+   *
+   * holds up to 2^30 - 2 data. freed slots are reused before the array grows.
+   * iterators are invalidated by insert and remove (not by the array growing, they hold indices).
+   */
+  template <typename Data_t, typename less = def_less<Data_t>, typename Alloc = std::allocator<Data_t>>
+  class compact_tree : private _compare_holder<less>
+  {
+  public:
+    typedef Data_t value_type;
+    typedef less key_compare;
+    typedef Alloc allocator_type;
+    class const_iterator;
+    typedef const_iterator iterator; // the data can't be changed in place, it would break the order
+
+  private:
+    enum : uint32_t
+    {
+      __index_bits = 30,
+      __index_mask = (uint32_t(1) << __index_bits) - 1,
+      __nil = __index_mask,               // no node
+      __max_size = __index_mask - 1,      // the largest index is __nil - 1
+      __free_slot = ~uint32_t(0),         // the left index of a free slot, its right index is the next free slot
+      __max_height = 48                   // an AVL tree with less than 2^30 nodes is at most 44 high
+    };
+
+    struct _Node
+    {
+      typename std::aligned_storage<sizeof(Data_t), alignof(Data_t)>::type __storage;
+      uint32_t __left;  // the 2 top bits hold the balance factor + 1 (height(left) - height(right) + 1)
+      uint32_t __right;
+    };
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<_Node> _node_allocator;
+    typedef std::allocator_traits<_node_allocator> _node_traits;
+
+    _Node *__nodes;
+    uint32_t __capacity;
+    uint32_t __used; // slots [0, __used) were handed out at least once
+    uint32_t __free; // the head of the free slots list
+    uint32_t __root;
+    size_t __size;
+    _node_allocator __allocator;
+
+  public:
+    compact_tree();                                                                                   // c'tor
+    explicit compact_tree(const allocator_type &alloc);                                               // allocator c'tor
+    explicit compact_tree(const less &comp, const allocator_type &alloc = allocator_type());         // comparator c'tor
+    compact_tree(std::initializer_list<Data_t> list, const allocator_type &alloc = allocator_type()); // list c'tor
+    template <typename InputIt, typename = typename std::enable_if<!std::is_integral<InputIt>::value>::type>
+    compact_tree(InputIt first, InputIt last, const allocator_type &alloc = allocator_type()); // range c'tor
+    template <typename InputIt, typename = typename std::enable_if<!std::is_integral<InputIt>::value>::type>
+    compact_tree(InputIt first, InputIt last, const less &comp, const allocator_type &alloc = allocator_type()); // range c'tor, ordered by comp
+    compact_tree(const compact_tree &other);                                                  // copy c'tor
+    compact_tree(compact_tree &&other);                                                       // move c'tor
+    compact_tree &operator=(const compact_tree &other);                                       // copy assignment operator
+    compact_tree &operator=(compact_tree &&other);                                            // move assignment operator
+    ~compact_tree();                                                                          // d'tor
+
+    // returns a copy of the allocator the nodes are allocated with
+    allocator_type get_allocator() const { return allocator_type(__allocator); }
+    // returns the comparator the data is ordered by, copies keep it
+    inline const less &key_comp() const { return this->_get_comp(); }
+
+    // makes room for capacity data, so the next inserts don't move the array
+    void reserve(size_t capacity);
+    // the amount of data the array has room for
+    inline size_t capacity() const { return __capacity; }
+
+    // empty out the tree, the array is kept for reuse
+    void clear();
+    // returns the size of the tree
+    inline size_t size() const { return __size; }
+    // return true if the tree doesn't have any elements
+    inline bool empty() const { return __size == 0; }
+    // return the tree's height
+    ssize_t height() const;
+
+    // returns a const reference to the data, throws data_not_found in case data not found
+    inline const Data_t &search(const Data_t &data) const;
+    // returns true if the data is in the tree
+    inline bool contains(const Data_t &data) const;
+    // non throwing lookup, returns an iterator to the data or end() in case data not found
+    inline const_iterator find(const Data_t &data) const;
+    // returns an iterator to the first data not less than data, end() if there is none
+    inline const_iterator lower_bound(const Data_t &data) const;
+
+    // heterogeneous lookup, only available when less::is_transparent is defined
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline const Data_t &search(const Key &key) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline bool contains(const Key &key) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline const_iterator find(const Key &key) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline const_iterator lower_bound(const Key &key) const;
+
+    // returns the smallest (largest) data in O(log n), throws data_not_found in case the tree is empty
+    inline const Data_t &min() const;
+    inline const Data_t &max() const;
+
+    // inserts the data, throws data_already_exists in case data is already in
+    inline void insert(const Data_t &data);
+    inline void insert(Data_t &&data);
+    // non throwing insert, returns an iterator to the data in the tree and true if it was inserted,
+    // or an iterator to the equal data already in the tree and false.
+    // use as: tree.insert(data, std::nothrow)
+    inline std::pair<const_iterator, bool> insert(const Data_t &data, const std::nothrow_t &);
+    inline std::pair<const_iterator, bool> insert(Data_t &&data, const std::nothrow_t &);
+    // removes the data, throws data_not_found in case data not found
+    inline void remove(const Data_t &data);
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline void remove(const Key &key);
+    // non throwing remove, returns the amount of data removed (0 or 1)
+    inline size_t erase(const Data_t &data);
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline size_t erase(const Key &key);
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+  private:
+    // * helper methods
+
+    // -*- node access helper methods -*- //
+
+    inline Data_t &_data(uint32_t index) { return *reinterpret_cast<Data_t *>(&__nodes[index].__storage); }
+    inline const Data_t &_data(uint32_t index) const { return *reinterpret_cast<const Data_t *>(&__nodes[index].__storage); }
+    inline uint32_t _left(uint32_t index) const { return __nodes[index].__left & __index_mask; }
+    inline uint32_t _right(uint32_t index) const { return __nodes[index].__right; }
+    inline int _balance_factor(uint32_t index) const { return static_cast<int>(__nodes[index].__left >> __index_bits) - 1; }
+    inline void _set_left(uint32_t index, uint32_t left) { __nodes[index].__left = (__nodes[index].__left & ~uint32_t(__index_mask)) | left; }
+    inline void _set_right(uint32_t index, uint32_t right) { __nodes[index].__right = right; }
+    inline void _set_balance_factor(uint32_t index, int bf) { __nodes[index].__left = (static_cast<uint32_t>(bf + 1) << __index_bits) | _left(index); }
+    inline void _set_child(uint32_t index, bool left, uint32_t child) { left ? _set_left(index, child) : _set_right(index, child); }
+
+    // -*- slot allocation helper methods -*- //
+
+    // returns a slot with the data constructed in it, a leaf with no children
+    template <typename... Args>
+    uint32_t _create_node(Args &&...args);
+    void _destroy_node(uint32_t index);
+    // moves the array to a bigger one
+    void _grow(uint32_t capacity);
+    // copies the array of other (which has to be empty)
+    void _copy_nodes(const compact_tree &other);
+    // destroys every data and frees the array
+    void _free_nodes();
+
+    // -*- general tree helper methods -*- //
+
+    template <typename Key>
+    uint32_t _search_aux(const Key &key) const;
+    template <typename Key>
+    const_iterator _lower_bound_aux(const Key &key) const;
+    template <typename T>
+    std::pair<const_iterator, bool> _insert_aux(T &&data);
+    template <typename Key>
+    bool _remove_aux(const Key &key);
+
+    // -*- AVL specific - helper methods -*- //
+
+    // rotates the sub tree of index whose balance factor became bf (+2 or -2), returns the new root of the sub tree.
+    // shrank tells if the sub tree is now lower than before the rotation
+    uint32_t _rebalance(uint32_t index, int bf, bool &shrank);
+    // links child in place of the node at depth in the path (depth 0 is the root)
+    inline void _link_child(const uint32_t *path, const bool *went_left, size_t depth, uint32_t child);
+
+#ifdef AVL_TREE_TEST
+  public:
+    bool _validate() const;
+
+  private:
+    // returns the height
+    ssize_t _validate_aux(uint32_t index, const Data_t *lo, const Data_t *hi, size_t &count) const;
+#endif // AVL_TREE_TEST
+  };
+
+  /**
+   * in-order iterator, keeps the nodes from the root to the current node whose left sub tree was taken
+   */
+  template <typename Data_t, typename less, typename Alloc>
+  class compact_tree<Data_t, less, Alloc>::const_iterator
+  {
+  private:
+    friend class compact_tree; // so avl::compact_tree can access the private members of const_iterator
+
+    const compact_tree *__tree;
+    uint32_t __path[__max_height]; // the last one is the current node
+    size_t __depth;                // 0 for end()
+
+    inline explicit const_iterator(const compact_tree *tree) : __tree(tree), __depth(0) {}
+
+    inline void _push_left_most(uint32_t index)
+    {
+      while (index != __nil)
+      {
+        __path[__depth++] = index;
+        index = __tree->_left(index);
+      }
+    }
+
+    inline uint32_t _current() const { return __depth ? __path[__depth - 1] : uint32_t(__nil); }
+
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Data_t value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const Data_t *pointer;
+    typedef const Data_t &reference;
+
+    inline const_iterator() : __tree(nullptr), __depth(0) {}
+
+    inline const Data_t &operator*() const { return __tree->_data(_current()); }
+
+    inline const Data_t *operator->() const { return &(__tree->_data(_current())); }
+
+    inline const_iterator &operator++()
+    {
+      uint32_t index = _current();
+      --__depth;
+      _push_left_most(__tree->_right(index));
+      return *this;
+    }
+
+    inline const_iterator operator++(int)
+    {
+      const_iterator it = *this;
+      ++(*this);
+      return it;
+    }
+
+    inline bool operator!=(const const_iterator &other) const { return _current() != other._current(); }
+    inline bool operator==(const const_iterator &other) const { return !(*this != other); }
+  };
+
+  template <typename Data_t, typename less, typename Alloc>
+  compact_tree<Data_t, less, Alloc>::compact_tree()
+      : __nodes(nullptr),
+        __capacity(0),
+        __used(0),
+        __free(__nil),
+        __root(__nil),
+        __size(0),
+        __allocator()
+  {
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  compact_tree<Data_t, less, Alloc>::compact_tree(const allocator_type &alloc)
+      : __nodes(nullptr),
+        __capacity(0),
+        __used(0),
+        __free(__nil),
+        __root(__nil),
+        __size(0),
+        __allocator(alloc)
+  {
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  compact_tree<Data_t, less, Alloc>::compact_tree(const less &comp, const allocator_type &alloc)
+      : _compare_holder<less>(comp),
+        __nodes(nullptr),
+        __capacity(0),
+        __used(0),
+        __free(__nil),
+        __root(__nil),
+        __size(0),
+        __allocator(alloc)
+  {
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  compact_tree<Data_t, less, Alloc>::compact_tree(std::initializer_list<Data_t> list, const allocator_type &alloc)
+      : compact_tree(list.begin(), list.end(), alloc)
+  {
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename InputIt, typename>
+  compact_tree<Data_t, less, Alloc>::compact_tree(InputIt first, InputIt last, const allocator_type &alloc)
+      : compact_tree(first, last, less(), alloc)
+  {
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename InputIt, typename>
+  compact_tree<Data_t, less, Alloc>::compact_tree(InputIt first, InputIt last, const less &comp, const allocator_type &alloc)
+      : compact_tree(comp, alloc)
+  {
+    for (; first != last; ++first)
+    {
+      if (_insert_aux(*first).second == false) // problem in inserting
+      {
+        this->clear(); // clear the tree
+        throw bad_input("inserting failed.");
+      }
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  compact_tree<Data_t, less, Alloc>::compact_tree(const compact_tree &other)
+      : _compare_holder<less>(other.key_comp()),
+        __nodes(nullptr),
+        __capacity(0),
+        __used(0),
+        __free(__nil),
+        __root(__nil),
+        __size(0),
+        __allocator(_node_traits::select_on_container_copy_construction(other.__allocator))
+  {
+    _copy_nodes(other);
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  compact_tree<Data_t, less, Alloc>::compact_tree(compact_tree &&other)
+      : _compare_holder<less>(other.key_comp()),
+        __nodes(other.__nodes),
+        __capacity(other.__capacity),
+        __used(other.__used),
+        __free(other.__free),
+        __root(other.__root),
+        __size(other.__size),
+        __allocator(std::move(other.__allocator))
+  {
+    other.__nodes = nullptr;
+    other.__capacity = 0;
+    other.__used = 0;
+    other.__free = __nil;
+    other.__root = __nil;
+    other.__size = 0;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  compact_tree<Data_t, less, Alloc> &compact_tree<Data_t, less, Alloc>::operator=(const compact_tree &other)
+  {
+    if (this != &other)
+    {
+      compact_tree copy(other);
+      *this = std::move(copy);
+    }
+    return *this;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  compact_tree<Data_t, less, Alloc> &compact_tree<Data_t, less, Alloc>::operator=(compact_tree &&other)
+  {
+    if (this != &other)
+    {
+      _free_nodes();
+      std::swap(__nodes, other.__nodes);
+      std::swap(__capacity, other.__capacity);
+      std::swap(__used, other.__used);
+      std::swap(__free, other.__free);
+      std::swap(__root, other.__root);
+      std::swap(__size, other.__size);
+      std::swap(__allocator, other.__allocator);
+      this->_set_comp(other.key_comp());
+    }
+    return *this;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  compact_tree<Data_t, less, Alloc>::~compact_tree()
+  {
+    _free_nodes();
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void compact_tree<Data_t, less, Alloc>::reserve(size_t capacity)
+  {
+    if (capacity > __max_size)
+    {
+      throw std::length_error("avl::compact_tree::reserve");
+    }
+    if (capacity > __capacity)
+    {
+      _grow(static_cast<uint32_t>(capacity));
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void compact_tree<Data_t, less, Alloc>::clear()
+  {
+    if (!std::is_trivially_destructible<Data_t>::value)
+    {
+      for (uint32_t index = 0; index < __used; ++index)
+      {
+        if (__nodes[index].__left != __free_slot)
+        {
+          _data(index).~Data_t();
+        }
+      }
+    }
+    __used = 0;
+    __free = __nil;
+    __root = __nil;
+    __size = 0;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  ssize_t compact_tree<Data_t, less, Alloc>::height() const
+  {
+    // walk down the higher side, the balance factors tell which one it is
+    ssize_t height = -1;
+    uint32_t index = __root;
+    while (index != __nil)
+    {
+      ++height;
+      index = (_balance_factor(index) >= 0) ? _left(index) : _right(index);
+    }
+    return height;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  const Data_t &compact_tree<Data_t, less, Alloc>::search(const Data_t &data) const
+  {
+    uint32_t index = _search_aux(data);
+    if (index == __nil)
+    {
+      throw data_not_found();
+    }
+    return _data(index);
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  bool compact_tree<Data_t, less, Alloc>::contains(const Data_t &data) const
+  {
+    return _search_aux(data) != __nil;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  typename compact_tree<Data_t, less, Alloc>::const_iterator compact_tree<Data_t, less, Alloc>::find(const Data_t &data) const
+  {
+    const_iterator it = _lower_bound_aux(data);
+    if (it == end() || key_comp()(data, *it))
+    {
+      return end();
+    }
+    return it;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  typename compact_tree<Data_t, less, Alloc>::const_iterator compact_tree<Data_t, less, Alloc>::lower_bound(const Data_t &data) const
+  {
+    return _lower_bound_aux(data);
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key, typename>
+  const Data_t &compact_tree<Data_t, less, Alloc>::search(const Key &key) const
+  {
+    uint32_t index = _search_aux(key);
+    if (index == __nil)
+    {
+      throw data_not_found();
+    }
+    return _data(index);
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key, typename>
+  bool compact_tree<Data_t, less, Alloc>::contains(const Key &key) const
+  {
+    return _search_aux(key) != __nil;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key, typename>
+  typename compact_tree<Data_t, less, Alloc>::const_iterator compact_tree<Data_t, less, Alloc>::find(const Key &key) const
+  {
+    const_iterator it = _lower_bound_aux(key);
+    if (it == end() || key_comp()(key, *it))
+    {
+      return end();
+    }
+    return it;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key, typename>
+  typename compact_tree<Data_t, less, Alloc>::const_iterator compact_tree<Data_t, less, Alloc>::lower_bound(const Key &key) const
+  {
+    return _lower_bound_aux(key);
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  const Data_t &compact_tree<Data_t, less, Alloc>::min() const
+  {
+    if (__root == __nil)
+    {
+      throw data_not_found();
+    }
+    uint32_t index = __root;
+    while (_left(index) != __nil)
+    {
+      index = _left(index);
+    }
+    return _data(index);
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  const Data_t &compact_tree<Data_t, less, Alloc>::max() const
+  {
+    if (__root == __nil)
+    {
+      throw data_not_found();
+    }
+    uint32_t index = __root;
+    while (_right(index) != __nil)
+    {
+      index = _right(index);
+    }
+    return _data(index);
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void compact_tree<Data_t, less, Alloc>::insert(const Data_t &data)
+  {
+    if (_insert_aux(data).second == false)
+    {
+      throw data_already_exists();
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void compact_tree<Data_t, less, Alloc>::insert(Data_t &&data)
+  {
+    if (_insert_aux(std::move(data)).second == false)
+    {
+      throw data_already_exists();
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  std::pair<typename compact_tree<Data_t, less, Alloc>::const_iterator, bool> compact_tree<Data_t, less, Alloc>::insert(const Data_t &data, const std::nothrow_t &)
+  {
+    return _insert_aux(data);
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  std::pair<typename compact_tree<Data_t, less, Alloc>::const_iterator, bool> compact_tree<Data_t, less, Alloc>::insert(Data_t &&data, const std::nothrow_t &)
+  {
+    return _insert_aux(std::move(data));
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void compact_tree<Data_t, less, Alloc>::remove(const Data_t &data)
+  {
+    if (!_remove_aux(data))
+    {
+      throw data_not_found();
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key, typename>
+  void compact_tree<Data_t, less, Alloc>::remove(const Key &key)
+  {
+    if (!_remove_aux(key))
+    {
+      throw data_not_found();
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  size_t compact_tree<Data_t, less, Alloc>::erase(const Data_t &data)
+  {
+    return _remove_aux(data) ? 1 : 0;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key, typename>
+  size_t compact_tree<Data_t, less, Alloc>::erase(const Key &key)
+  {
+    return _remove_aux(key) ? 1 : 0;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  typename compact_tree<Data_t, less, Alloc>::const_iterator compact_tree<Data_t, less, Alloc>::begin() const
+  {
+    const_iterator it(this);
+    it._push_left_most(__root);
+    return it;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  typename compact_tree<Data_t, less, Alloc>::const_iterator compact_tree<Data_t, less, Alloc>::end() const
+  {
+    return const_iterator(this);
+  }
+
+  // * helper methods
+
+  // -*- slot allocation helper methods -*- //
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename... Args>
+  uint32_t compact_tree<Data_t, less, Alloc>::_create_node(Args &&...args)
+  {
+    uint32_t index;
+    if (__free != __nil)
+    {
+      index = __free;
+      ::new (static_cast<void *>(&__nodes[index].__storage)) Data_t(std::forward<Args>(args)...);
+      __free = __nodes[index].__right;
+    }
+    else
+    {
+      if (__used == __capacity)
+      {
+        if (__capacity >= __max_size)
+        {
+          throw std::length_error("avl::compact_tree is full");
+        }
+        _grow(static_cast<uint32_t>(std::min<size_t>(std::max<size_t>(16, size_t(__capacity) * 2), __max_size)));
+      }
+      index = __used;
+      ::new (static_cast<void *>(&__nodes[index].__storage)) Data_t(std::forward<Args>(args)...);
+      ++__used;
+    }
+    __nodes[index].__left = (uint32_t(1) << __index_bits) | __nil; // balance factor 0
+    __nodes[index].__right = __nil;
+    return index;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void compact_tree<Data_t, less, Alloc>::_destroy_node(uint32_t index)
+  {
+    _data(index).~Data_t();
+    __nodes[index].__left = __free_slot;
+    __nodes[index].__right = __free;
+    __free = index;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void compact_tree<Data_t, less, Alloc>::_grow(uint32_t capacity)
+  {
+    _Node *nodes = _node_traits::allocate(__allocator, capacity);
+    uint32_t index = 0;
+    try
+    {
+      // the data is moved when that can't throw, copied otherwise (so a throw leaves the old array untouched)
+      for (; index < __used; ++index)
+      {
+        if (__nodes[index].__left != __free_slot)
+        {
+          ::new (static_cast<void *>(&nodes[index].__storage)) Data_t(std::move_if_noexcept(_data(index)));
+        }
+        nodes[index].__left = __nodes[index].__left;
+        nodes[index].__right = __nodes[index].__right;
+      }
+    }
+    catch (...)
+    {
+      while (index-- > 0)
+      {
+        if (nodes[index].__left != __free_slot)
+        {
+          reinterpret_cast<Data_t *>(&nodes[index].__storage)->~Data_t();
+        }
+      }
+      _node_traits::deallocate(__allocator, nodes, capacity);
+      throw;
+    }
+
+    uint32_t used = __used;
+    uint32_t free = __free;
+    uint32_t root = __root;
+    size_t size = __size;
+    _free_nodes();
+    __nodes = nodes;
+    __capacity = capacity;
+    __used = used;
+    __free = free;
+    __root = root;
+    __size = size;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void compact_tree<Data_t, less, Alloc>::_copy_nodes(const compact_tree &other)
+  {
+    if (other.__used == 0)
+    {
+      return;
+    }
+
+    // the copy keeps the same indices, free slots included
+    _Node *nodes = _node_traits::allocate(__allocator, other.__used);
+    uint32_t index = 0;
+    try
+    {
+      for (; index < other.__used; ++index)
+      {
+        if (other.__nodes[index].__left != __free_slot)
+        {
+          ::new (static_cast<void *>(&nodes[index].__storage)) Data_t(other._data(index));
+        }
+        nodes[index].__left = other.__nodes[index].__left;
+        nodes[index].__right = other.__nodes[index].__right;
+      }
+    }
+    catch (...)
+    {
+      while (index-- > 0)
+      {
+        if (nodes[index].__left != __free_slot)
+        {
+          reinterpret_cast<Data_t *>(&nodes[index].__storage)->~Data_t();
+        }
+      }
+      _node_traits::deallocate(__allocator, nodes, other.__used);
+      throw;
+    }
+
+    __nodes = nodes;
+    __capacity = other.__used;
+    __used = other.__used;
+    __free = other.__free;
+    __root = other.__root;
+    __size = other.__size;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void compact_tree<Data_t, less, Alloc>::_free_nodes()
+  {
+    clear();
+    if (__nodes)
+    {
+      _node_traits::deallocate(__allocator, __nodes, __capacity);
+    }
+    __nodes = nullptr;
+    __capacity = 0;
+  }
+
+  // -*- general tree helper methods -*- //
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key>
+  uint32_t compact_tree<Data_t, less, Alloc>::_search_aux(const Key &key) const
+  {
+    uint32_t index = __root;
+    while (index != __nil)
+    {
+      const Data_t &data = _data(index);
+      if (key_comp()(key, data))
+      {
+        index = _left(index);
+      }
+      else if (key_comp()(data, key))
+      {
+        index = _right(index);
+      }
+      else
+      {
+        return index;
+      }
+    }
+    return __nil;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key>
+  typename compact_tree<Data_t, less, Alloc>::const_iterator compact_tree<Data_t, less, Alloc>::_lower_bound_aux(const Key &key) const
+  {
+    // the path keeps only the nodes the in-order walk still has to visit (the ones whose left sub tree was taken)
+    const_iterator it(this);
+    uint32_t index = __root;
+    while (index != __nil)
+    {
+      if (key_comp()(_data(index), key))
+      {
+        index = _right(index);
+      }
+      else
+      {
+        it.__path[it.__depth++] = index;
+        index = _left(index);
+      }
+    }
+    return it;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename T>
+  std::pair<typename compact_tree<Data_t, less, Alloc>::const_iterator, bool> compact_tree<Data_t, less, Alloc>::_insert_aux(T &&data)
+  {
+    uint32_t path[__max_height];
+    bool went_left[__max_height];
+    size_t depth = 0;
+
+    uint32_t index = __root;
+    while (index != __nil)
+    {
+      const Data_t &curr = _data(index);
+      path[depth] = index;
+      if (key_comp()(data, curr))
+      {
+        went_left[depth++] = true;
+        index = _left(index);
+      }
+      else if (key_comp()(curr, data))
+      {
+        went_left[depth++] = false;
+        index = _right(index);
+      }
+      else
+      {
+        return std::pair<const_iterator, bool>(_lower_bound_aux(curr), false);
+      }
+    }
+
+    uint32_t node = _create_node(std::forward<T>(data));
+    _link_child(path, went_left, depth, node);
+    __size++;
+
+    // the sub trees on the path grew by 1, until one of them doesn't
+    while (depth-- > 0)
+    {
+      uint32_t parent = path[depth];
+      int bf = _balance_factor(parent) + (went_left[depth] ? 1 : -1);
+      if (bf == 0)
+      {
+        _set_balance_factor(parent, 0);
+        break;
+      }
+      if (bf == 1 || bf == -1)
+      {
+        _set_balance_factor(parent, bf);
+        continue;
+      }
+      // after an insert, the rotation brings the sub tree back to its old height
+      bool shrank;
+      _link_child(path, went_left, depth, _rebalance(parent, bf, shrank));
+      break;
+    }
+
+    return std::pair<const_iterator, bool>(_lower_bound_aux(_data(node)), true);
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key>
+  bool compact_tree<Data_t, less, Alloc>::_remove_aux(const Key &key)
+  {
+    uint32_t path[__max_height];
+    bool went_left[__max_height];
+    size_t depth = 0;
+
+    uint32_t index = __root;
+    while (index != __nil)
+    {
+      const Data_t &curr = _data(index);
+      if (key_comp()(key, curr))
+      {
+        path[depth] = index;
+        went_left[depth++] = true;
+        index = _left(index);
+      }
+      else if (key_comp()(curr, key))
+      {
+        path[depth] = index;
+        went_left[depth++] = false;
+        index = _right(index);
+      }
+      else
+      {
+        break;
+      }
+    }
+    if (index == __nil)
+    {
+      return false;
+    }
+
+    if (_left(index) == __nil || _right(index) == __nil)
+    {
+      uint32_t child = (_left(index) != __nil) ? _left(index) : _right(index);
+      _link_child(path, went_left, depth, child);
+    }
+    else
+    {
+      // the successor takes the place of the node (relinked, no data is moved)
+      size_t node_depth = depth;
+      path[depth] = index;
+      went_left[depth++] = false;
+      uint32_t successor = _right(index);
+      while (_left(successor) != __nil)
+      {
+        path[depth] = successor;
+        went_left[depth++] = true;
+        successor = _left(successor);
+      }
+
+      // unlink the successor, then put it where the node was
+      _link_child(path, went_left, depth, _right(successor));
+      _set_left(successor, _left(index));
+      _set_right(successor, _right(index));
+      _set_balance_factor(successor, _balance_factor(index));
+      _link_child(path, went_left, node_depth, successor);
+      path[node_depth] = successor;
+    }
+    _destroy_node(index);
+    __size--;
+
+    // the sub trees on the path shrank by 1, until one of them doesn't
+    while (depth-- > 0)
+    {
+      uint32_t parent = path[depth];
+      int bf = _balance_factor(parent) + (went_left[depth] ? -1 : 1);
+      if (bf == 1 || bf == -1)
+      {
+        _set_balance_factor(parent, bf);
+        break;
+      }
+      if (bf == 0)
+      {
+        _set_balance_factor(parent, 0);
+        continue;
+      }
+      bool shrank;
+      _link_child(path, went_left, depth, _rebalance(parent, bf, shrank));
+      if (!shrank)
+      {
+        break;
+      }
+    }
+    return true;
+  }
+
+  // -*- AVL specific - helper methods -*- //
+
+  template <typename Data_t, typename less, typename Alloc>
+  uint32_t compact_tree<Data_t, less, Alloc>::_rebalance(uint32_t A, int bf, bool &shrank)
+  {
+    if (bf == 2)
+    {
+      uint32_t B = _left(A);
+      int B_bf = _balance_factor(B);
+      if (B_bf >= 0) // LL
+      {
+        _set_left(A, _right(B));
+        _set_right(B, A);
+        _set_balance_factor(A, B_bf == 1 ? 0 : 1);
+        _set_balance_factor(B, B_bf == 1 ? 0 : -1);
+        shrank = (B_bf == 1);
+        return B;
+      }
+      // LR
+      uint32_t C = _right(B);
+      int C_bf = _balance_factor(C);
+      _set_right(B, _left(C));
+      _set_left(A, _right(C));
+      _set_left(C, B);
+      _set_right(C, A);
+      _set_balance_factor(B, C_bf == -1 ? 1 : 0);
+      _set_balance_factor(A, C_bf == 1 ? -1 : 0);
+      _set_balance_factor(C, 0);
+      shrank = true;
+      return C;
+    }
+
+    // bf == -2
+    uint32_t B = _right(A);
+    int B_bf = _balance_factor(B);
+    if (B_bf <= 0) // RR
+    {
+      _set_right(A, _left(B));
+      _set_left(B, A);
+      _set_balance_factor(A, B_bf == -1 ? 0 : -1);
+      _set_balance_factor(B, B_bf == -1 ? 0 : 1);
+      shrank = (B_bf == -1);
+      return B;
+    }
+    // RL
+    uint32_t C = _left(B);
+    int C_bf = _balance_factor(C);
+    _set_left(B, _right(C));
+    _set_right(A, _left(C));
+    _set_right(C, B);
+    _set_left(C, A);
+    _set_balance_factor(B, C_bf == 1 ? -1 : 0);
+    _set_balance_factor(A, C_bf == -1 ? 1 : 0);
+    _set_balance_factor(C, 0);
+    shrank = true;
+    return C;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void compact_tree<Data_t, less, Alloc>::_link_child(const uint32_t *path, const bool *went_left, size_t depth, uint32_t child)
+  {
+    if (depth == 0)
+    {
+      __root = child;
+    }
+    else
+    {
+      _set_child(path[depth - 1], went_left[depth - 1], child);
+    }
+  }
+
+#ifdef AVL_TREE_TEST
+
+  template <typename Data_t, typename less, typename Alloc>
+  bool compact_tree<Data_t, less, Alloc>::_validate() const
+  {
+    size_t count = 0;
+    ssize_t tree_height = _validate_aux(__root, nullptr, nullptr, count);
+    assert(count == __size);
+    assert(tree_height == height());
+    // every slot is either in the tree or in the free list
+    size_t free_slots = 0;
+    for (uint32_t index = __free; index != __nil; index = __nodes[index].__right)
+    {
+      assert(__nodes[index].__left == __free_slot);
+      ++free_slots;
+    }
+    assert(free_slots + __size == __used);
+    (void)tree_height;
+    return true;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  ssize_t compact_tree<Data_t, less, Alloc>::_validate_aux(uint32_t index, const Data_t *lo, const Data_t *hi, size_t &count) const
+  {
+    if (index == __nil)
+    {
+      return -1;
+    }
+    assert(index < __used);
+    assert(__nodes[index].__left != __free_slot);
+    assert(!lo || key_comp()(*lo, _data(index)));
+    assert(!hi || key_comp()(_data(index), *hi));
+    ++count;
+    ssize_t left_height = _validate_aux(_left(index), lo, &_data(index), count);
+    ssize_t right_height = _validate_aux(_right(index), &_data(index), hi, count);
+    assert(_balance_factor(index) == left_height - right_height);
+    return 1 + std::max(left_height, right_height);
+  }
+
+#endif // AVL_TREE_TEST
+
+} // namespace avl
+
+#endif // __AVL_COMPACT_TREE_H__
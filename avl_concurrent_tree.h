@@ -0,0 +1,584 @@
+#ifndef __AVL_CONCURRENT_TREE_H__
+#define __AVL_CONCURRENT_TREE_H__
+
+#include "avl_tree.h"
+
+#include <atomic>             // for std::atomic
+#include <mutex>              // for std::mutex, std::lock_guard, std::unique_lock
+#include <condition_variable> // for std::condition_variable
+#include <thread>             // for std::this_thread::yield
+#include <memory>             // for std::unique_ptr
+#include <type_traits>        // for std::is_void
+#if __cplusplus >= 201402L
+#include <shared_mutex> // for std::shared_mutex, std::shared_timed_mutex
+#endif
+
+namespace avl
+{
+  /**
+   * a reader-writer lock for C++11, where the standard doesn't have one yet.
+   * waiting writers stop new readers from coming in, so a writer can't be starved by a stream of readers
+   */
+  class _shared_mutex
+  {
+  public:
+    _shared_mutex() : __readers(0), __waiting_writers(0), __writer(false) {}
+    _shared_mutex(const _shared_mutex &) = delete;
+    _shared_mutex &operator=(const _shared_mutex &) = delete;
+
+    void lock()
+    {
+      std::unique_lock<std::mutex> lock(__mutex);
+      ++__waiting_writers;
+      __condition.wait(lock, [this]()
+                       { return !__writer && __readers == 0; });
+      --__waiting_writers;
+      __writer = true;
+    }
+
+    void unlock()
+    {
+      {
+        std::lock_guard<std::mutex> lock(__mutex);
+        __writer = false;
+      }
+      __condition.notify_all();
+    }
+
+    void lock_shared()
+    {
+      std::unique_lock<std::mutex> lock(__mutex);
+      __condition.wait(lock, [this]()
+                       { return !__writer && __waiting_writers == 0; });
+      ++__readers;
+    }
+
+    void unlock_shared()
+    {
+      bool last;
+      {
+        std::lock_guard<std::mutex> lock(__mutex);
+        last = (--__readers == 0);
+      }
+      if (last)
+      {
+        __condition.notify_all();
+      }
+    }
+
+  private:
+    std::mutex __mutex;
+    std::condition_variable __condition;
+    size_t __readers;
+    size_t __waiting_writers;
+    bool __writer;
+  };
+
+#if __cplusplus >= 201703L
+  typedef std::shared_mutex _default_shared_mutex;
+#elif __cplusplus >= 201402L
+  typedef std::shared_timed_mutex _default_shared_mutex;
+#else
+  typedef _shared_mutex _default_shared_mutex;
+#endif
+
+  /**
+   * the modes of avl::concurrent_tree
+   *
+   * shared_mutex_mode - readers share a reader-writer lock (Mutex needs lock, unlock, lock_shared and unlock_shared),
+   * writers update the tree in place under the exclusive lock.
+   *
+   * snapshot_mode - readers never lock, they read an immutable version of the tree published through an atomic pointer.
+   * a writer copies the current version, updates the copy and publishes it, the old version is deleted once
+   * every reader that could still see it has left (epoch based reclamation).
+   * every write copies the tree, which costs O(1) for avl::persistent_tree (avl_persistent_tree.h)
+   * and O(n) for avl::tree, batch avl::tree writes with write().
+   */
+  template <typename Mutex = _default_shared_mutex>
+  struct shared_mutex_mode
+  {
+  };
+
+  struct snapshot_mode
+  {
+  };
+
+  /**
+   * counts the readers inside a read section, so a writer can wait for all the readers that may still hold an old version.
+   * readers go in with the parity of the current epoch, a writer flips the epoch twice and waits for each parity to drain.
+   * the counters are striped (by thread) so the readers don't all fight over the same cache line
+   */
+  class _reader_epochs
+  {
+  public:
+    _reader_epochs() : __epoch(0)
+    {
+      for (size_t parity = 0; parity < 2; ++parity)
+      {
+        for (size_t stripe = 0; stripe < __stripes; ++stripe)
+        {
+          __readers[parity][stripe].value.store(0);
+        }
+      }
+    }
+    _reader_epochs(const _reader_epochs &) = delete;
+    _reader_epochs &operator=(const _reader_epochs &) = delete;
+
+    // returns the ticket leave() needs
+    size_t enter()
+    {
+      size_t ticket = (static_cast<size_t>(__epoch.load() & 1) * __stripes) + _get_stripe();
+      __readers[ticket / __stripes][ticket % __stripes].value.fetch_add(1);
+      return ticket;
+    }
+
+    void leave(size_t ticket)
+    {
+      __readers[ticket / __stripes][ticket % __stripes].value.fetch_sub(1);
+    }
+
+    // returns once every reader that entered before the call has left
+    void synchronize()
+    {
+      for (size_t flip = 0; flip < 2; ++flip)
+      {
+        size_t parity = __epoch.fetch_add(1) & 1;
+        while (_get_readers(parity) != 0)
+        {
+          std::this_thread::yield();
+        }
+      }
+    }
+
+  private:
+    enum : size_t
+    {
+      __stripes = 16
+    };
+
+    struct alignas(64) _counter
+    {
+      std::atomic<size_t> value;
+    };
+
+    std::atomic<unsigned> __epoch;
+    _counter __readers[2][__stripes];
+
+    size_t _get_readers(size_t parity) const
+    {
+      size_t readers = 0;
+      for (size_t stripe = 0; stripe < __stripes; ++stripe)
+      {
+        readers += __readers[parity][stripe].value.load();
+      }
+      return readers;
+    }
+
+    static size_t _get_stripe()
+    {
+      static std::atomic<size_t> next_stripe(0);
+      thread_local size_t stripe = next_stripe.fetch_add(1) % __stripes;
+      return stripe;
+    }
+  };
+
+  /**
+   * a thread safe wrapper around a tree (avl::tree or anything with the same interface).
+   * the data is handed out by copy, iterators never leave the wrapper.
+   * read(f) and write(f) run f on the tree (const for read) while it is safe to, for anything the wrapper doesn't cover
+   */
+  template <typename Tree, typename Mode = shared_mutex_mode<>>
+  class concurrent_tree;
+
+  template <typename Tree, typename Mutex>
+  class concurrent_tree<Tree, shared_mutex_mode<Mutex>>
+  {
+  public:
+    typedef Tree tree_type;
+    typedef typename Tree::value_type value_type;
+
+    concurrent_tree() : __tree() {}
+    explicit concurrent_tree(const Tree &tree) : __tree(tree) {}
+    explicit concurrent_tree(Tree &&tree) : __tree(std::move(tree)) {}
+    concurrent_tree(const concurrent_tree &) = delete;
+    concurrent_tree &operator=(const concurrent_tree &) = delete;
+
+    // -*- reading, many threads at a time -*- //
+
+    inline size_t size() const;
+    inline bool empty() const;
+    template <typename Key>
+    inline bool contains(const Key &key) const;
+    // copies the data equal to key into out, returns false (out untouched) in case it's not in the tree
+    template <typename Key>
+    inline bool find(const Key &key, value_type &out) const;
+    // returns f(tree), the tree is const and locked for reading while f runs
+    template <typename F>
+    inline auto read(F f) const -> decltype(f(std::declval<const Tree &>()));
+    // returns a copy of the tree
+    inline Tree snapshot() const;
+
+    // -*- writing, 1 thread at a time -*- //
+
+    // returns true if the data was inserted (false if an equal data is already in)
+    inline bool insert(const value_type &data);
+    inline bool insert(value_type &&data);
+    template <typename... Args>
+    inline bool emplace(Args &&...args);
+    // returns the amount of data removed (0 or 1)
+    template <typename Key>
+    inline size_t erase(const Key &key);
+    inline void clear();
+    // returns f(tree), the tree is locked for writing while f runs
+    template <typename F>
+    inline auto write(F f) -> decltype(f(std::declval<Tree &>()));
+
+  private:
+    // lock_shared() for the life time of the guard (std::shared_lock is C++14)
+    class _shared_lock
+    {
+    public:
+      explicit _shared_lock(Mutex &mutex) : __mutex(mutex) { __mutex.lock_shared(); }
+      ~_shared_lock() { __mutex.unlock_shared(); }
+      _shared_lock(const _shared_lock &) = delete;
+      _shared_lock &operator=(const _shared_lock &) = delete;
+
+    private:
+      Mutex &__mutex;
+    };
+
+    mutable Mutex __mutex;
+    Tree __tree;
+  };
+
+  template <typename Tree>
+  class concurrent_tree<Tree, snapshot_mode>
+  {
+  public:
+    typedef Tree tree_type;
+    typedef typename Tree::value_type value_type;
+
+    concurrent_tree() : __current(new Tree()) {}
+    explicit concurrent_tree(const Tree &tree) : __current(new Tree(tree)) {}
+    explicit concurrent_tree(Tree &&tree) : __current(new Tree(std::move(tree))) {}
+    concurrent_tree(const concurrent_tree &) = delete;
+    concurrent_tree &operator=(const concurrent_tree &) = delete;
+    ~concurrent_tree();
+
+    // -*- reading, lock free, many threads at a time -*- //
+
+    inline size_t size() const;
+    inline bool empty() const;
+    template <typename Key>
+    inline bool contains(const Key &key) const;
+    // copies the data equal to key into out, returns false (out untouched) in case it's not in the tree
+    template <typename Key>
+    inline bool find(const Key &key, value_type &out) const;
+    // returns f(tree), the tree is an immutable version that stays alive while f runs.
+    // keep f short, a writer waits for it before deleting the version
+    template <typename F>
+    inline auto read(F f) const -> decltype(f(std::declval<const Tree &>()));
+    // returns a copy of the current version
+    inline Tree snapshot() const;
+
+    // -*- writing, 1 thread at a time, every write publishes a new version -*- //
+
+    // returns true if the data was inserted (false if an equal data is already in)
+    inline bool insert(const value_type &data);
+    inline bool insert(value_type &&data);
+    template <typename... Args>
+    inline bool emplace(Args &&...args);
+    // returns the amount of data removed (0 or 1)
+    template <typename Key>
+    inline size_t erase(const Key &key);
+    inline void clear();
+    // returns f(tree), f updates a copy of the current version which is published once f returns.
+    // in case f throws nothing is published
+    template <typename F>
+    inline auto write(F f) -> decltype(f(std::declval<Tree &>()));
+
+  private:
+    // enter() and leave() for the life time of the guard
+    class _read_guard
+    {
+    public:
+      explicit _read_guard(_reader_epochs &epochs) : __epochs(epochs), __ticket(epochs.enter()) {}
+      ~_read_guard() { __epochs.leave(__ticket); }
+      _read_guard(const _read_guard &) = delete;
+      _read_guard &operator=(const _read_guard &) = delete;
+
+    private:
+      _reader_epochs &__epochs;
+      size_t __ticket;
+    };
+
+    std::atomic<const Tree *> __current;
+    mutable _reader_epochs __epochs;
+    std::mutex __writer_mutex;
+
+    template <typename F>
+    auto _write_aux(F &f, std::false_type) -> decltype(f(std::declval<Tree &>()));
+    template <typename F>
+    void _write_aux(F &f, std::true_type);
+    // replaces the current version, deletes the old one once no reader can see it
+    void _publish(Tree *next);
+  };
+
+  // -*- shared_mutex_mode -*- //
+
+  template <typename Tree, typename Mutex>
+  size_t concurrent_tree<Tree, shared_mutex_mode<Mutex>>::size() const
+  {
+    _shared_lock lock(__mutex);
+    return __tree.size();
+  }
+
+  template <typename Tree, typename Mutex>
+  bool concurrent_tree<Tree, shared_mutex_mode<Mutex>>::empty() const
+  {
+    _shared_lock lock(__mutex);
+    return __tree.empty();
+  }
+
+  template <typename Tree, typename Mutex>
+  template <typename Key>
+  bool concurrent_tree<Tree, shared_mutex_mode<Mutex>>::contains(const Key &key) const
+  {
+    _shared_lock lock(__mutex);
+    return __tree.contains(key);
+  }
+
+  template <typename Tree, typename Mutex>
+  template <typename Key>
+  bool concurrent_tree<Tree, shared_mutex_mode<Mutex>>::find(const Key &key, value_type &out) const
+  {
+    _shared_lock lock(__mutex);
+    auto it = __tree.find(key);
+    if (it == __tree.end())
+    {
+      return false;
+    }
+    out = *it;
+    return true;
+  }
+
+  template <typename Tree, typename Mutex>
+  template <typename F>
+  auto concurrent_tree<Tree, shared_mutex_mode<Mutex>>::read(F f) const -> decltype(f(std::declval<const Tree &>()))
+  {
+    _shared_lock lock(__mutex);
+    return f(static_cast<const Tree &>(__tree));
+  }
+
+  template <typename Tree, typename Mutex>
+  Tree concurrent_tree<Tree, shared_mutex_mode<Mutex>>::snapshot() const
+  {
+    _shared_lock lock(__mutex);
+    return __tree;
+  }
+
+  template <typename Tree, typename Mutex>
+  bool concurrent_tree<Tree, shared_mutex_mode<Mutex>>::insert(const value_type &data)
+  {
+    std::lock_guard<Mutex> lock(__mutex);
+    return __tree.insert(data, std::nothrow).second;
+  }
+
+  template <typename Tree, typename Mutex>
+  bool concurrent_tree<Tree, shared_mutex_mode<Mutex>>::insert(value_type &&data)
+  {
+    std::lock_guard<Mutex> lock(__mutex);
+    return __tree.insert(std::move(data), std::nothrow).second;
+  }
+
+  template <typename Tree, typename Mutex>
+  template <typename... Args>
+  bool concurrent_tree<Tree, shared_mutex_mode<Mutex>>::emplace(Args &&...args)
+  {
+    // the data is built before taking the lock
+    value_type data(std::forward<Args>(args)...);
+    return insert(std::move(data));
+  }
+
+  template <typename Tree, typename Mutex>
+  template <typename Key>
+  size_t concurrent_tree<Tree, shared_mutex_mode<Mutex>>::erase(const Key &key)
+  {
+    std::lock_guard<Mutex> lock(__mutex);
+    return __tree.erase(key);
+  }
+
+  template <typename Tree, typename Mutex>
+  void concurrent_tree<Tree, shared_mutex_mode<Mutex>>::clear()
+  {
+    std::lock_guard<Mutex> lock(__mutex);
+    __tree.clear();
+  }
+
+  template <typename Tree, typename Mutex>
+  template <typename F>
+  auto concurrent_tree<Tree, shared_mutex_mode<Mutex>>::write(F f) -> decltype(f(std::declval<Tree &>()))
+  {
+    std::lock_guard<Mutex> lock(__mutex);
+    return f(__tree);
+  }
+
+  // -*- snapshot_mode -*- //
+
+  template <typename Tree>
+  concurrent_tree<Tree, snapshot_mode>::~concurrent_tree()
+  {
+    delete __current.load();
+  }
+
+  template <typename Tree>
+  size_t concurrent_tree<Tree, snapshot_mode>::size() const
+  {
+    _read_guard guard(__epochs);
+    return __current.load()->size();
+  }
+
+  template <typename Tree>
+  bool concurrent_tree<Tree, snapshot_mode>::empty() const
+  {
+    _read_guard guard(__epochs);
+    return __current.load()->empty();
+  }
+
+  template <typename Tree>
+  template <typename Key>
+  bool concurrent_tree<Tree, snapshot_mode>::contains(const Key &key) const
+  {
+    _read_guard guard(__epochs);
+    return __current.load()->contains(key);
+  }
+
+  template <typename Tree>
+  template <typename Key>
+  bool concurrent_tree<Tree, snapshot_mode>::find(const Key &key, value_type &out) const
+  {
+    _read_guard guard(__epochs);
+    const Tree *current = __current.load();
+    auto it = current->find(key);
+    if (it == current->end())
+    {
+      return false;
+    }
+    out = *it;
+    return true;
+  }
+
+  template <typename Tree>
+  template <typename F>
+  auto concurrent_tree<Tree, snapshot_mode>::read(F f) const -> decltype(f(std::declval<const Tree &>()))
+  {
+    _read_guard guard(__epochs);
+    return f(*__current.load());
+  }
+
+  template <typename Tree>
+  Tree concurrent_tree<Tree, snapshot_mode>::snapshot() const
+  {
+    _read_guard guard(__epochs);
+    return *__current.load();
+  }
+
+  template <typename Tree>
+  bool concurrent_tree<Tree, snapshot_mode>::insert(const value_type &data)
+  {
+    std::lock_guard<std::mutex> lock(__writer_mutex);
+    // only the writer replaces versions, so the current one can be read without a guard here
+    if (__current.load()->contains(data))
+    {
+      return false;
+    }
+    std::unique_ptr<Tree> next(new Tree(*__current.load()));
+    next->insert(data, std::nothrow);
+    _publish(next.release());
+    return true;
+  }
+
+  template <typename Tree>
+  bool concurrent_tree<Tree, snapshot_mode>::insert(value_type &&data)
+  {
+    std::lock_guard<std::mutex> lock(__writer_mutex);
+    if (__current.load()->contains(data))
+    {
+      return false;
+    }
+    std::unique_ptr<Tree> next(new Tree(*__current.load()));
+    next->insert(std::move(data), std::nothrow);
+    _publish(next.release());
+    return true;
+  }
+
+  template <typename Tree>
+  template <typename... Args>
+  bool concurrent_tree<Tree, snapshot_mode>::emplace(Args &&...args)
+  {
+    value_type data(std::forward<Args>(args)...);
+    return insert(std::move(data));
+  }
+
+  template <typename Tree>
+  template <typename Key>
+  size_t concurrent_tree<Tree, snapshot_mode>::erase(const Key &key)
+  {
+    std::lock_guard<std::mutex> lock(__writer_mutex);
+    if (!__current.load()->contains(key))
+    {
+      return 0;
+    }
+    std::unique_ptr<Tree> next(new Tree(*__current.load()));
+    size_t removed = next->erase(key);
+    _publish(next.release());
+    return removed;
+  }
+
+  template <typename Tree>
+  void concurrent_tree<Tree, snapshot_mode>::clear()
+  {
+    std::lock_guard<std::mutex> lock(__writer_mutex);
+    // the empty version keeps the comparator, a stateful one would be lost by a default c'tor
+    const Tree *current = __current.load();
+    _publish(new Tree(current->key_comp(), current->get_allocator()));
+  }
+
+  template <typename Tree>
+  template <typename F>
+  auto concurrent_tree<Tree, snapshot_mode>::write(F f) -> decltype(f(std::declval<Tree &>()))
+  {
+    std::lock_guard<std::mutex> lock(__writer_mutex);
+    return _write_aux(f, std::is_void<decltype(f(std::declval<Tree &>()))>());
+  }
+
+  template <typename Tree>
+  template <typename F>
+  auto concurrent_tree<Tree, snapshot_mode>::_write_aux(F &f, std::false_type) -> decltype(f(std::declval<Tree &>()))
+  {
+    std::unique_ptr<Tree> next(new Tree(*__current.load()));
+    auto result = f(*next);
+    _publish(next.release());
+    return result;
+  }
+
+  template <typename Tree>
+  template <typename F>
+  void concurrent_tree<Tree, snapshot_mode>::_write_aux(F &f, std::true_type)
+  {
+    std::unique_ptr<Tree> next(new Tree(*__current.load()));
+    f(*next);
+    _publish(next.release());
+  }
+
+  template <typename Tree>
+  void concurrent_tree<Tree, snapshot_mode>::_publish(Tree *next)
+  {
+    const Tree *old = __current.exchange(next);
+    __epochs.synchronize();
+    delete old;
+  }
+
+} // namespace avl
+
+#endif // __AVL_CONCURRENT_TREE_H__
@@ -0,0 +1,307 @@
+#ifndef __AVL_LAZY_TREE_H__
+#define __AVL_LAZY_TREE_H__
+
+#include "avl_tree.h"
+
+namespace avl
+{
+  /**
+   * an AVL tree with lazy deletion, for churn heavy workloads:
+   * remove only marks the node as removed (a tombstone) with 1 descent, no unlinking and no rotations.
+   * lookups and iteration skip the tombstones, inserting data that has a tombstone revives the node in place.
+   * once the tombstones pass max_removed (a fraction of the nodes) the tree is compacted with tree::erase_if,
+   * which drops them and relinks the rest into an almost full tree in 1 linear pass,
+   * so a remove costs O(log n) amortized and the tree stays balanced.
+   */
+  template <typename Data_t, typename less = def_less<Data_t>, typename Alloc = std::allocator<Data_t>>
+  class lazy_tree
+  {
+  public:
+    typedef Data_t value_type;
+    typedef less key_compare;
+    typedef Alloc allocator_type;
+    class const_iterator;
+    typedef const_iterator iterator; // the data can't be changed, it would break the order
+
+  private:
+    struct _entry
+    {
+      Data_t data;
+      mutable bool removed; // not part of the order, so it can change in place
+
+      explicit _entry(const Data_t &data) : data(data), removed(false) {}
+      explicit _entry(Data_t &&data) : data(std::move(data)), removed(false) {}
+    };
+
+    // orders the entries by their data, transparent so data is compared against the entries as it is
+    class _entry_less : private _compare_holder<less>
+    {
+    public:
+      typedef void is_transparent;
+
+      _entry_less() {}
+      explicit _entry_less(const less &comp) : _compare_holder<less>(comp) {}
+
+      inline const less &key_comp() const { return this->_get_comp(); }
+      inline bool operator()(const _entry &lhs, const _entry &rhs) const { return key_comp()(lhs.data, rhs.data); }
+      inline bool operator()(const Data_t &lhs, const _entry &rhs) const { return key_comp()(lhs, rhs.data); }
+      inline bool operator()(const _entry &lhs, const Data_t &rhs) const { return key_comp()(lhs.data, rhs); }
+    };
+    typedef tree<_entry, _entry_less, typename std::allocator_traits<Alloc>::template rebind_alloc<_entry>> _tree_type;
+
+    _tree_type __tree;
+    size_t __removed;    // the tombstones
+    double __max_removed; // compact once there are more tombstones than this fraction of the nodes
+
+  public:
+    explicit lazy_tree(double max_removed = 0.25, const less &comp = less(), const allocator_type &alloc = allocator_type()); // c'tor
+    lazy_tree(const lazy_tree &other) = default;
+    lazy_tree(lazy_tree &&other);
+    lazy_tree &operator=(const lazy_tree &other) = default;
+    lazy_tree &operator=(lazy_tree &&other);
+
+    allocator_type get_allocator() const { return allocator_type(__tree.get_allocator()); }
+    inline const less &key_comp() const { return __tree.key_comp().key_comp(); }
+
+    // the amount of data, tombstones not included
+    inline size_t size() const { return __tree.size() - __removed; }
+    inline bool empty() const { return size() == 0; }
+    // the amount of tombstones waiting for the next compaction
+    inline size_t removed() const { return __removed; }
+    void clear();
+
+    // returns a const reference to the data, throws data_not_found in case data not found
+    inline const Data_t &search(const Data_t &data) const;
+    inline bool contains(const Data_t &data) const { return _find_aux(data) != nullptr; }
+    // non throwing lookup, returns an iterator to the data or end() in case data not found
+    inline const_iterator find(const Data_t &data) const;
+
+    // inserts the data, throws data_already_exists in case data is already in
+    inline void insert(const Data_t &data);
+    // non throwing insert, returns true if the data was inserted
+    inline bool insert(const Data_t &data, const std::nothrow_t &);
+    // marks the data as removed, throws data_not_found in case data not found
+    inline void remove(const Data_t &data);
+    // non throwing remove, returns the amount of data removed (0 or 1)
+    inline size_t erase(const Data_t &data);
+    // drops every tombstone now, in O(n)
+    void compact();
+
+    inline const_iterator begin() const { return const_iterator(__tree.begin(), __tree.end()); }
+    inline const_iterator end() const { return const_iterator(__tree.end(), __tree.end()); }
+
+  private:
+    // the entry of data that isn't removed, nullptr otherwise
+    inline const _entry *_find_aux(const Data_t &data) const;
+
+#ifdef AVL_TREE_TEST
+  public:
+    bool _validate() const;
+#endif // AVL_TREE_TEST
+  };
+
+  /**
+   * in-order iterator, skips the tombstones
+   */
+  template <typename Data_t, typename less, typename Alloc>
+  class lazy_tree<Data_t, less, Alloc>::const_iterator
+  {
+  private:
+    friend class lazy_tree;
+    typedef typename _tree_type::const_iterator _tree_iterator;
+
+    inline const_iterator(const _tree_iterator &it, const _tree_iterator &end) : current(it), last(end) { _skip_removed(); }
+
+    inline void _skip_removed()
+    {
+      while (current != last && current->removed)
+      {
+        ++current;
+      }
+    }
+
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Data_t value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const Data_t *pointer;
+    typedef const Data_t &reference;
+
+    inline const Data_t &operator*() const { return current->data; }
+    inline const Data_t *operator->() const { return &(current->data); }
+
+    inline const_iterator &operator++()
+    {
+      ++current;
+      _skip_removed();
+      return *this;
+    }
+
+    inline const_iterator operator++(int)
+    {
+      const_iterator it = *this;
+      ++(*this);
+      return it;
+    }
+
+    inline bool operator!=(const const_iterator &other) const { return current != other.current; }
+    inline bool operator==(const const_iterator &other) const { return !(current != other.current); }
+
+  private:
+    _tree_iterator current;
+    _tree_iterator last;
+  };
+
+  template <typename Data_t, typename less, typename Alloc>
+  lazy_tree<Data_t, less, Alloc>::lazy_tree(double max_removed, const less &comp, const allocator_type &alloc)
+      : __tree(_entry_less(comp), alloc), __removed(0), __max_removed(max_removed)
+  {
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  lazy_tree<Data_t, less, Alloc>::lazy_tree(lazy_tree &&other)
+      : __tree(std::move(other.__tree)), __removed(other.__removed), __max_removed(other.__max_removed)
+  {
+    other.__removed = 0;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  lazy_tree<Data_t, less, Alloc> &lazy_tree<Data_t, less, Alloc>::operator=(lazy_tree &&other)
+  {
+    if (this != &other)
+    {
+      __tree = std::move(other.__tree);
+      __removed = other.__removed;
+      __max_removed = other.__max_removed;
+      other.__removed = 0;
+    }
+    return *this;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void lazy_tree<Data_t, less, Alloc>::clear()
+  {
+    __tree.clear();
+    __removed = 0;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  const typename lazy_tree<Data_t, less, Alloc>::_entry *lazy_tree<Data_t, less, Alloc>::_find_aux(const Data_t &data) const
+  {
+    typename _tree_type::const_iterator it = __tree.find(data);
+    if (it == __tree.end() || it->removed)
+    {
+      return nullptr;
+    }
+    return &*it;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  const Data_t &lazy_tree<Data_t, less, Alloc>::search(const Data_t &data) const
+  {
+    const _entry *entry = _find_aux(data);
+    if (entry == nullptr)
+    {
+      throw data_not_found();
+    }
+    return entry->data;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  typename lazy_tree<Data_t, less, Alloc>::const_iterator lazy_tree<Data_t, less, Alloc>::find(const Data_t &data) const
+  {
+    typename _tree_type::const_iterator it = __tree.find(data);
+    if (it != __tree.end() && it->removed)
+    {
+      return end();
+    }
+    return const_iterator(it, __tree.end());
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void lazy_tree<Data_t, less, Alloc>::insert(const Data_t &data)
+  {
+    if (!insert(data, std::nothrow))
+    {
+      throw data_already_exists();
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  bool lazy_tree<Data_t, less, Alloc>::insert(const Data_t &data, const std::nothrow_t &)
+  {
+    std::pair<typename _tree_type::iterator, bool> result = __tree.try_emplace(data, data);
+    if (result.second)
+    {
+      return true;
+    }
+    const _entry &entry = *result.first;
+    if (!entry.removed)
+    {
+      return false;
+    }
+    // revive the tombstone, the new data is equal to the old one so the order holds
+    // (the tree hands out const entries, the entry itself isn't const)
+    const_cast<_entry &>(entry).data = data;
+    entry.removed = false;
+    --__removed;
+    return true;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void lazy_tree<Data_t, less, Alloc>::remove(const Data_t &data)
+  {
+    if (erase(data) == 0)
+    {
+      throw data_not_found();
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  size_t lazy_tree<Data_t, less, Alloc>::erase(const Data_t &data)
+  {
+    const _entry *entry = _find_aux(data);
+    if (entry == nullptr)
+    {
+      return 0;
+    }
+    entry->removed = true;
+    ++__removed;
+    if (static_cast<double>(__removed) > __max_removed * static_cast<double>(__tree.size()))
+    {
+      compact();
+    }
+    return 1;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void lazy_tree<Data_t, less, Alloc>::compact()
+  {
+    if (__removed == 0)
+    {
+      return;
+    }
+    __tree.erase_if([](const _entry &entry)
+                    { return entry.removed; });
+    __removed = 0;
+  }
+
+#ifdef AVL_TREE_TEST
+
+  template <typename Data_t, typename less, typename Alloc>
+  bool lazy_tree<Data_t, less, Alloc>::_validate() const
+  {
+    __tree._validate();
+    size_t removed = 0;
+    for (typename _tree_type::const_iterator it = __tree.begin(); it != __tree.end(); ++it)
+    {
+      removed += it->removed ? 1 : 0;
+    }
+    assert(removed == __removed);
+    return true;
+  }
+
+#endif // AVL_TREE_TEST
+}
+
+#endif // __AVL_LAZY_TREE_H__
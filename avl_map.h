@@ -0,0 +1,283 @@
+#ifndef __AVL_MAP_H__
+#define __AVL_MAP_H__
+
+#include "avl_tree.h"
+
+#include <tuple> // for std::piecewise_construct, std::forward_as_tuple
+
+namespace avl
+{
+  /**
+   * a key / value map on top of avl::tree: the entries are std::pair<const Key, T> ordered by the key only,
+   * and every lookup compares the key against the stored entries directly (no entry is built to search with).
+   * the mapped values can be changed through the iterators, the keys can't.
+   */
+  template <typename Key, typename T, typename less = def_less<Key>, typename Alloc = std::allocator<std::pair<const Key, T>>>
+  class map
+  {
+  public:
+    typedef Key key_type;
+    typedef T mapped_type;
+    typedef std::pair<const Key, T> value_type;
+    typedef less key_compare;
+    typedef Alloc allocator_type;
+    class iterator;
+    class const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+  private:
+    // orders the entries by key, transparent so keys are compared against the entries as they are
+    class _entry_less : private _compare_holder<less>
+    {
+    public:
+      typedef void is_transparent;
+
+      _entry_less() {}
+      explicit _entry_less(const less &comp) : _compare_holder<less>(comp) {}
+
+      inline const less &key_comp() const { return this->_get_comp(); }
+      inline bool operator()(const value_type &lhs, const value_type &rhs) const { return key_comp()(lhs.first, rhs.first); }
+      inline bool operator()(const Key &lhs, const value_type &rhs) const { return key_comp()(lhs, rhs.first); }
+      inline bool operator()(const value_type &lhs, const Key &rhs) const { return key_comp()(lhs.first, rhs); }
+    };
+    typedef tree<value_type, _entry_less, Alloc> _tree_type;
+
+    _tree_type __tree;
+
+  public:
+    map() {}                                                                                                         // c'tor
+    explicit map(const less &comp, const allocator_type &alloc = allocator_type()) : __tree(_entry_less(comp), alloc) {} // comparator c'tor
+    // the first of equal keys wins
+    map(std::initializer_list<value_type> list, const less &comp = less(), const allocator_type &alloc = allocator_type()); // list c'tor
+
+    allocator_type get_allocator() const { return __tree.get_allocator(); }
+    inline const less &key_comp() const { return __tree.key_comp().key_comp(); }
+
+    inline size_t size() const { return __tree.size(); }
+    inline bool empty() const { return __tree.empty(); }
+    void clear() { __tree.clear(); }
+
+    // returns the value mapped to key, inserts a value initialized one in case key isn't in
+    inline T &operator[](const Key &key);
+    // returns the value mapped to key, throws data_not_found in case key isn't in
+    inline T &at(const Key &key);
+    inline const T &at(const Key &key) const;
+
+    inline bool contains(const Key &key) const { return __tree.contains(key); }
+    inline size_t count(const Key &key) const { return __tree.contains(key) ? 1 : 0; }
+    inline iterator find(const Key &key) { return iterator(__tree.find(key)); }
+    inline const_iterator find(const Key &key) const { return const_iterator(__tree.find(key)); }
+    // the first entry with a key not less than (greater than) key, end() if there is none
+    inline iterator lower_bound(const Key &key) { return iterator(__tree.lower_bound(key)); }
+    inline const_iterator lower_bound(const Key &key) const { return const_iterator(__tree.lower_bound(key)); }
+    inline iterator upper_bound(const Key &key) { return iterator(__tree.upper_bound(key)); }
+    inline const_iterator upper_bound(const Key &key) const { return const_iterator(__tree.upper_bound(key)); }
+
+    // inserts the entry in case its key isn't in, returns an iterator to the entry with the key and true if it was inserted
+    inline std::pair<iterator, bool> insert(const value_type &entry);
+    inline std::pair<iterator, bool> insert(value_type &&entry);
+    // constructs the value from args only in case key isn't in (args are left untouched otherwise), returns the same as insert
+    template <typename... Args>
+    inline std::pair<iterator, bool> try_emplace(const Key &key, Args &&...args);
+    // inserts the value or assigns it to the value already mapped to key, returns the same as insert
+    template <typename M>
+    inline std::pair<iterator, bool> insert_or_assign(const Key &key, M &&value);
+    // removes the entry with the key, returns the amount removed (0 or 1)
+    inline size_t erase(const Key &key) { return __tree.erase(key); }
+    // removes the entry pos points to without searching for it, returns an iterator to the entry after it
+    inline iterator erase(const_iterator pos) { return iterator(__tree.erase(pos.current)); }
+    inline iterator erase(iterator pos) { return iterator(__tree.erase(pos.current)); }
+
+    inline iterator begin() { return iterator(__tree.begin()); }
+    inline iterator end() { return iterator(__tree.end()); }
+    inline const_iterator begin() const { return const_iterator(__tree.begin()); }
+    inline const_iterator end() const { return const_iterator(__tree.end()); }
+    // from the largest key down
+    inline reverse_iterator rbegin() { return reverse_iterator(end()); }
+    inline reverse_iterator rend() { return reverse_iterator(begin()); }
+    inline const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    inline const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+#ifdef AVL_TREE_TEST
+  public:
+    bool _validate() const { return __tree._validate(); }
+#endif // AVL_TREE_TEST
+  };
+
+  /**
+   * bidirectional in-order iterator (--end() is the largest key), the entries of the tree only change
+   * through the mapped values (never the keys)
+   */
+  template <typename Key, typename T, typename less, typename Alloc>
+  class map<Key, T, less, Alloc>::iterator
+  {
+  private:
+    friend class map;
+    friend class const_iterator;
+    inline explicit iterator(const typename _tree_type::iterator &it) : current(it) {}
+
+  public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef typename map::value_type value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef value_type *pointer;
+    typedef value_type &reference;
+
+    inline iterator() {}
+
+    // the tree hands out const entries so their keys stay put, the entry itself isn't const
+    inline value_type &operator*() const { return const_cast<value_type &>(*current); }
+    inline value_type *operator->() const { return &**this; }
+
+    inline iterator &operator++()
+    {
+      ++current;
+      return *this;
+    }
+
+    inline iterator operator++(int)
+    {
+      iterator it = *this;
+      ++(*this);
+      return it;
+    }
+
+    inline iterator &operator--()
+    {
+      --current;
+      return *this;
+    }
+
+    inline iterator operator--(int)
+    {
+      iterator it = *this;
+      --(*this);
+      return it;
+    }
+
+    inline bool operator!=(const iterator &other) const { return current != other.current; }
+    inline bool operator==(const iterator &other) const { return !(current != other.current); }
+
+  private:
+    typename _tree_type::iterator current;
+  };
+
+  template <typename Key, typename T, typename less, typename Alloc>
+  class map<Key, T, less, Alloc>::const_iterator
+  {
+  private:
+    friend class map;
+    inline explicit const_iterator(const typename _tree_type::const_iterator &it) : current(it) {}
+
+  public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef typename map::value_type value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const value_type *pointer;
+    typedef const value_type &reference;
+
+    inline const_iterator() {}
+    inline const_iterator(const iterator &it) : current(it.current) {}
+
+    inline const value_type &operator*() const { return *current; }
+    inline const value_type *operator->() const { return &*current; }
+
+    inline const_iterator &operator++()
+    {
+      ++current;
+      return *this;
+    }
+
+    inline const_iterator operator++(int)
+    {
+      const_iterator it = *this;
+      ++(*this);
+      return it;
+    }
+
+    inline const_iterator &operator--()
+    {
+      --current;
+      return *this;
+    }
+
+    inline const_iterator operator--(int)
+    {
+      const_iterator it = *this;
+      --(*this);
+      return it;
+    }
+
+    inline bool operator!=(const const_iterator &other) const { return current != other.current; }
+    inline bool operator==(const const_iterator &other) const { return !(current != other.current); }
+
+  private:
+    typename _tree_type::const_iterator current;
+  };
+
+  template <typename Key, typename T, typename less, typename Alloc>
+  map<Key, T, less, Alloc>::map(std::initializer_list<value_type> list, const less &comp, const allocator_type &alloc)
+      : __tree(_entry_less(comp), alloc)
+  {
+    for (const value_type &entry : list)
+    {
+      __tree.insert(entry, std::nothrow);
+    }
+  }
+
+  template <typename Key, typename T, typename less, typename Alloc>
+  T &map<Key, T, less, Alloc>::operator[](const Key &key)
+  {
+    return try_emplace(key).first->second;
+  }
+
+  template <typename Key, typename T, typename less, typename Alloc>
+  T &map<Key, T, less, Alloc>::at(const Key &key)
+  {
+    return const_cast<T &>(__tree.search(key).second);
+  }
+
+  template <typename Key, typename T, typename less, typename Alloc>
+  const T &map<Key, T, less, Alloc>::at(const Key &key) const
+  {
+    return __tree.search(key).second;
+  }
+
+  template <typename Key, typename T, typename less, typename Alloc>
+  std::pair<typename map<Key, T, less, Alloc>::iterator, bool> map<Key, T, less, Alloc>::insert(const value_type &entry)
+  {
+    std::pair<typename _tree_type::iterator, bool> result = __tree.insert(entry, std::nothrow);
+    return {iterator(result.first), result.second};
+  }
+
+  template <typename Key, typename T, typename less, typename Alloc>
+  std::pair<typename map<Key, T, less, Alloc>::iterator, bool> map<Key, T, less, Alloc>::insert(value_type &&entry)
+  {
+    std::pair<typename _tree_type::iterator, bool> result = __tree.insert(std::move(entry), std::nothrow);
+    return {iterator(result.first), result.second};
+  }
+
+  template <typename Key, typename T, typename less, typename Alloc>
+  template <typename... Args>
+  std::pair<typename map<Key, T, less, Alloc>::iterator, bool> map<Key, T, less, Alloc>::try_emplace(const Key &key, Args &&...args)
+  {
+    std::pair<typename _tree_type::iterator, bool> result =
+        __tree.try_emplace(key, std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+    return {iterator(result.first), result.second};
+  }
+
+  template <typename Key, typename T, typename less, typename Alloc>
+  template <typename M>
+  std::pair<typename map<Key, T, less, Alloc>::iterator, bool> map<Key, T, less, Alloc>::insert_or_assign(const Key &key, M &&value)
+  {
+    std::pair<iterator, bool> result = try_emplace(key, std::forward<M>(value));
+    if (!result.second)
+    {
+      result.first->second = std::forward<M>(value);
+    }
+    return result;
+  }
+}
+
+#endif // __AVL_MAP_H__
@@ -0,0 +1,194 @@
+#ifndef __AVL_MAPPED_TREE_H__
+#define __AVL_MAPPED_TREE_H__
+
+#include "avl_tree.h"
+
+#include <stdint.h>   // for uint32_t, uint64_t
+#include <string.h>   // for memcpy, memcmp, memset
+#include <stdio.h>    // for rename
+#include <sys/mman.h> // for mmap, munmap (POSIX)
+#include <sys/stat.h> // for fstat
+#include <fcntl.h>    // for open
+#include <unistd.h>   // for close, ftruncate, unlink
+
+namespace avl
+{
+  /**
+   * a file image of a frozen tree (or of a tree, frozen on the way out) for trivially copyable data:
+   * a 64 byte header and then the data in Eytzinger order, exactly as frozen_tree keeps it in memory.
+   * there are no pointers in it, so open_mapped() maps the file read only and the frozen tree
+   * looks the data up in place, there is nothing to deserialize and only the touched pages are read.
+   *
+   * the file is only readable where it was written (same data size, alignment and byte order).
+   * a mapped tree is promoted back to a mutable tree with tree::from_sorted(mapped.begin(), mapped.end(), mapped.key_comp()),
+   * in O(n) with no comparisons and no rotations.
+   *
+   *      avl::save(tree, "data.avl");
+   *      avl::frozen_tree<int> mapped = avl::open_mapped<int>("data.avl");
+   */
+  struct _mapped_header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order; // _mapped_byte_order as the writer saw it
+    uint64_t data_size;  // sizeof(Data_t)
+    uint64_t data_align; // alignof(Data_t)
+    uint64_t size;       // the amount of data
+  };
+
+  static const char _mapped_magic[8] = {'A', 'V', 'L', 'T', 'R', 'E', 'E', '\0'};
+  static const uint32_t _mapped_version = 1;
+  static const uint32_t _mapped_byte_order = 0x01020304;
+  static const size_t _mapped_data_offset = 64; // mmap returns page aligned memory, so the data is 64 byte aligned
+
+  /**
+   * a mapped file region, unmapped when the last frozen tree sharing it is gone
+   */
+  class _file_mapping
+  {
+  public:
+    _file_mapping(void *address, size_t length) : __address(address), __length(length) {}
+    ~_file_mapping() { munmap(__address, __length); }
+
+    inline char *address() const { return static_cast<char *>(__address); }
+
+  private:
+    _file_mapping(const _file_mapping &);
+    _file_mapping &operator=(const _file_mapping &);
+
+    void *__address;
+    size_t __length;
+  };
+
+  template <typename Data_t, typename less, typename Alloc>
+  struct _mapped_access<frozen_tree<Data_t, less, Alloc>>
+  {
+    typedef frozen_tree<Data_t, less, Alloc> frozen;
+
+    static inline size_t first_position(size_t size) { return frozen::_first_position(size); }
+    static inline size_t next_position(size_t position, size_t size) { return frozen::_next_position(position, size); }
+
+    static frozen make(const std::shared_ptr<_file_mapping> &mapping, size_t size, const less &comp)
+    {
+      frozen mapped;
+      mapped._set_comp(comp);
+      mapped.__data = size ? reinterpret_cast<Data_t *>(mapping->address() + _mapped_data_offset) : nullptr;
+      mapped.__size = size;
+      mapped.__storage = mapping;
+      return mapped;
+    }
+  };
+
+  // writes size data from the in-order range first to path, through a temporary file so path is never half written
+  template <typename Data_t, typename ForwardIt>
+  void _save_aux(ForwardIt first, size_t size, const std::string &path)
+  {
+    static_assert(std::is_trivially_copyable<Data_t>::value, "only trivially copyable data can be mapped");
+    static_assert(alignof(Data_t) <= _mapped_data_offset, "the data is over aligned");
+    typedef _mapped_access<frozen_tree<Data_t>> access;
+
+    std::string temp_path = path + ".tmp";
+    int fd = open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+      throw bad_input("saving failed.");
+    }
+    size_t length = _mapped_data_offset + size * sizeof(Data_t);
+    void *address = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(length)) == 0)
+    {
+      address = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (address == MAP_FAILED)
+    {
+      unlink(temp_path.c_str());
+      throw bad_input("saving failed.");
+    }
+
+    _mapped_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, _mapped_magic, sizeof(header.magic));
+    header.version = _mapped_version;
+    header.byte_order = _mapped_byte_order;
+    header.data_size = sizeof(Data_t);
+    header.data_align = alignof(Data_t);
+    header.size = size;
+    char *bytes = static_cast<char *>(address);
+    memcpy(bytes, &header, sizeof(header));
+
+    // each data goes to its in-order position of the Eytzinger layout
+    char *data = bytes + _mapped_data_offset;
+    for (size_t position = access::first_position(size); position; position = access::next_position(position, size), ++first)
+    {
+      memcpy(data + (position - 1) * sizeof(Data_t), &*first, sizeof(Data_t));
+    }
+
+    bool synced = msync(address, length, MS_SYNC) == 0;
+    munmap(address, length);
+    if (!synced || rename(temp_path.c_str(), path.c_str()) != 0)
+    {
+      unlink(temp_path.c_str());
+      throw bad_input("saving failed.");
+    }
+  }
+
+  // saves the frozen tree to path, throws bad_input in case the file can't be written
+  template <typename Data_t, typename less, typename Alloc>
+  void save(const frozen_tree<Data_t, less, Alloc> &frozen, const std::string &path)
+  {
+    _save_aux<Data_t>(frozen.begin(), frozen.size(), path);
+  }
+
+  // saves the tree to path in the frozen layout (without building a frozen tree first), throws bad_input in case the file can't be written
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void save(const tree<Data_t, less, Alloc, Ranked, Augment, Stats> &t, const std::string &path)
+  {
+    _save_aux<Data_t>(t.begin(), t.size(), path);
+  }
+
+  /**
+   * maps a file written by save() read only, O(1): the pages are read the first time a lookup touches them.
+   * the data has to be ordered by comp the way it was when saved.
+   * throws bad_input in case the file can't be mapped or wasn't saved with this kind of data
+   */
+  template <typename Data_t, typename less = def_less<Data_t>>
+  frozen_tree<Data_t, less> open_mapped(const std::string &path, const less &comp = less())
+  {
+    static_assert(std::is_trivially_copyable<Data_t>::value, "only trivially copyable data can be mapped");
+    typedef _mapped_access<frozen_tree<Data_t, less>> access;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      throw bad_input("mapping failed.");
+    }
+    struct stat file_stat;
+    void *address = MAP_FAILED;
+    size_t length = 0;
+    if (fstat(fd, &file_stat) == 0 && static_cast<size_t>(file_stat.st_size) >= _mapped_data_offset)
+    {
+      length = static_cast<size_t>(file_stat.st_size);
+      address = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd); // the mapping stays valid without the descriptor
+    if (address == MAP_FAILED)
+    {
+      throw bad_input("mapping failed.");
+    }
+    std::shared_ptr<_file_mapping> mapping = std::make_shared<_file_mapping>(address, length);
+
+    _mapped_header header;
+    memcpy(&header, mapping->address(), sizeof(header));
+    if (memcmp(header.magic, _mapped_magic, sizeof(header.magic)) != 0 || header.version != _mapped_version ||
+        header.byte_order != _mapped_byte_order || header.data_size != sizeof(Data_t) || header.data_align != alignof(Data_t) ||
+        header.size > (length - _mapped_data_offset) / sizeof(Data_t) ||
+        length != _mapped_data_offset + header.size * sizeof(Data_t))
+    {
+      throw bad_input("mapping failed, the file doesn't hold this kind of data.");
+    }
+    return access::make(mapping, static_cast<size_t>(header.size), comp);
+  }
+}
+
+#endif // __AVL_MAPPED_TREE_H__
@@ -0,0 +1,316 @@
+#ifndef __AVL_MULTISET_H__
+#define __AVL_MULTISET_H__
+
+#include "avl_tree.h"
+
+namespace avl
+{
+  /**
+   * a multiset on top of avl::tree that keeps equal data as a count in 1 node:
+   * inserting data that is already in only bumps its count (no allocation, no rotation),
+   * so heavily duplicated data costs a node per distinct value.
+   * the first inserted of equal data is the one kept, iteration yields it count times.
+   */
+  template <typename Data_t, typename less = def_less<Data_t>, typename Alloc = std::allocator<Data_t>>
+  class multiset
+  {
+  public:
+    typedef Data_t value_type;
+    typedef less key_compare;
+    typedef Alloc allocator_type;
+    class const_iterator;
+    typedef const_iterator iterator; // the data can't be changed, it would break the order
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+    typedef const_reverse_iterator reverse_iterator;
+
+  private:
+    struct _entry
+    {
+      Data_t data;
+      mutable size_t count; // not part of the order, so it can change in place
+
+      explicit _entry(const Data_t &data) : data(data), count(1) {}
+      explicit _entry(Data_t &&data) : data(std::move(data)), count(1) {}
+    };
+
+    // orders the entries by their data, transparent so data is compared against the entries as it is
+    class _entry_less : private _compare_holder<less>
+    {
+    public:
+      typedef void is_transparent;
+
+      _entry_less() {}
+      explicit _entry_less(const less &comp) : _compare_holder<less>(comp) {}
+
+      inline const less &key_comp() const { return this->_get_comp(); }
+      inline bool operator()(const _entry &lhs, const _entry &rhs) const { return key_comp()(lhs.data, rhs.data); }
+      inline bool operator()(const Data_t &lhs, const _entry &rhs) const { return key_comp()(lhs, rhs.data); }
+      inline bool operator()(const _entry &lhs, const Data_t &rhs) const { return key_comp()(lhs.data, rhs); }
+    };
+    typedef tree<_entry, _entry_less, typename std::allocator_traits<Alloc>::template rebind_alloc<_entry>> _tree_type;
+
+    _tree_type __tree;
+    size_t __size; // with the duplicates
+
+  public:
+    multiset() : __tree(), __size(0) {}                                                                                         // c'tor
+    explicit multiset(const less &comp, const allocator_type &alloc = allocator_type()) : __tree(_entry_less(comp), alloc), __size(0) {} // comparator c'tor
+    multiset(std::initializer_list<Data_t> list, const less &comp = less(), const allocator_type &alloc = allocator_type());            // list c'tor
+    multiset(const multiset &other) = default;
+    multiset(multiset &&other);
+    multiset &operator=(const multiset &other) = default;
+    multiset &operator=(multiset &&other);
+
+    allocator_type get_allocator() const { return allocator_type(__tree.get_allocator()); }
+    inline const less &key_comp() const { return __tree.key_comp().key_comp(); }
+
+    // the amount of data, duplicates included
+    inline size_t size() const { return __size; }
+    // the amount of different data (nodes)
+    inline size_t distinct_size() const { return __tree.size(); }
+    inline bool empty() const { return __size == 0; }
+    void clear();
+
+    // inserts a copy of the data, returns how many equal data are in now
+    inline size_t insert(const Data_t &data);
+    inline size_t insert(Data_t &&data);
+    // inserts count copies of the data at once, returns how many equal data are in now
+    inline size_t insert(const Data_t &data, size_t count);
+    // removes 1 copy of the data, returns the amount removed (0 or 1)
+    inline size_t erase(const Data_t &data);
+    // removes every copy of the data, returns the amount removed
+    inline size_t erase_all(const Data_t &data);
+
+    // returns how many equal data are in
+    inline size_t count(const Data_t &data) const;
+    inline bool contains(const Data_t &data) const { return __tree.contains(data); }
+    // the first copy of the data, end() in case data not found
+    inline const_iterator find(const Data_t &data) const { return const_iterator(__tree.find(data)); }
+    // the first copy of the first data not less than (greater than) data, end() if there is none
+    inline const_iterator lower_bound(const Data_t &data) const { return const_iterator(__tree.lower_bound(data)); }
+    inline const_iterator upper_bound(const Data_t &data) const { return const_iterator(__tree.upper_bound(data)); }
+
+    // returns the smallest (largest) data, throws data_not_found in case the multiset is empty
+    inline const Data_t &min() const { return __tree.min().data; }
+    inline const Data_t &max() const { return __tree.max().data; }
+
+    inline const_iterator begin() const { return const_iterator(__tree.begin()); }
+    inline const_iterator end() const { return const_iterator(__tree.end()); }
+    // from the largest data down, every copy of it first
+    inline const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    inline const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+  private:
+    size_t _insert_aux(const Data_t &data, size_t count);
+
+#ifdef AVL_TREE_TEST
+  public:
+    bool _validate() const;
+#endif // AVL_TREE_TEST
+  };
+
+  /**
+   * bidirectional in-order iterator, goes over every copy of equal data (count times the same data)
+   */
+  template <typename Data_t, typename less, typename Alloc>
+  class multiset<Data_t, less, Alloc>::const_iterator
+  {
+  private:
+    friend class multiset;
+    inline explicit const_iterator(const typename _tree_type::const_iterator &it) : current(it), copy(0) {}
+
+  public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef Data_t value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const Data_t *pointer;
+    typedef const Data_t &reference;
+
+    inline const_iterator() : copy(0) {}
+
+    inline const Data_t &operator*() const { return current->data; }
+    inline const Data_t *operator->() const { return &(current->data); }
+    // how many equal data there are in the multiset
+    inline size_t count() const { return current->count; }
+
+    inline const_iterator &operator++()
+    {
+      if (++copy == current->count)
+      {
+        ++current;
+        copy = 0;
+      }
+      return *this;
+    }
+
+    inline const_iterator operator++(int)
+    {
+      const_iterator it = *this;
+      ++(*this);
+      return it;
+    }
+
+    inline const_iterator &operator--()
+    {
+      if (copy == 0)
+      {
+        --current;
+        copy = current->count;
+      }
+      --copy;
+      return *this;
+    }
+
+    inline const_iterator operator--(int)
+    {
+      const_iterator it = *this;
+      --(*this);
+      return it;
+    }
+
+    inline bool operator!=(const const_iterator &other) const { return current != other.current || copy != other.copy; }
+    inline bool operator==(const const_iterator &other) const { return !(*this != other); }
+
+  private:
+    typename _tree_type::const_iterator current;
+    size_t copy; // the copies of the data already passed
+  };
+
+  template <typename Data_t, typename less, typename Alloc>
+  multiset<Data_t, less, Alloc>::multiset(std::initializer_list<Data_t> list, const less &comp, const allocator_type &alloc)
+      : __tree(_entry_less(comp), alloc), __size(0)
+  {
+    for (const Data_t &data : list)
+    {
+      _insert_aux(data, 1);
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  multiset<Data_t, less, Alloc>::multiset(multiset &&other) : __tree(std::move(other.__tree)), __size(other.__size)
+  {
+    other.__size = 0;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  multiset<Data_t, less, Alloc> &multiset<Data_t, less, Alloc>::operator=(multiset &&other)
+  {
+    if (this != &other)
+    {
+      __tree = std::move(other.__tree);
+      __size = other.__size;
+      other.__size = 0;
+    }
+    return *this;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void multiset<Data_t, less, Alloc>::clear()
+  {
+    __tree.clear();
+    __size = 0;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  size_t multiset<Data_t, less, Alloc>::insert(const Data_t &data)
+  {
+    return _insert_aux(data, 1);
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  size_t multiset<Data_t, less, Alloc>::insert(Data_t &&data)
+  {
+    // the data is moved into an entry first, which is dropped when equal data is already in
+    std::pair<typename _tree_type::iterator, bool> result = __tree.insert(_entry(std::move(data)), std::nothrow);
+    if (!result.second)
+    {
+      ++result.first->count;
+    }
+    ++__size;
+    return result.first->count;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  size_t multiset<Data_t, less, Alloc>::insert(const Data_t &data, size_t count)
+  {
+    return count ? _insert_aux(data, count) : this->count(data);
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  size_t multiset<Data_t, less, Alloc>::_insert_aux(const Data_t &data, size_t count)
+  {
+    // 1 descent, a new node only for data that isn't in yet
+    std::pair<typename _tree_type::iterator, bool> result = __tree.try_emplace(data, data);
+    if (result.second)
+    {
+      result.first->count = count;
+    }
+    else
+    {
+      result.first->count += count;
+    }
+    __size += count;
+    return result.first->count;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  size_t multiset<Data_t, less, Alloc>::erase(const Data_t &data)
+  {
+    typename _tree_type::iterator it = __tree.find(data);
+    if (it == __tree.end())
+    {
+      return 0;
+    }
+    if (it->count > 1)
+    {
+      --it->count;
+    }
+    else
+    {
+      __tree.erase(it);
+    }
+    --__size;
+    return 1;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  size_t multiset<Data_t, less, Alloc>::erase_all(const Data_t &data)
+  {
+    typename _tree_type::iterator it = __tree.find(data);
+    if (it == __tree.end())
+    {
+      return 0;
+    }
+    size_t count = it->count;
+    __tree.erase(it);
+    __size -= count;
+    return count;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  size_t multiset<Data_t, less, Alloc>::count(const Data_t &data) const
+  {
+    typename _tree_type::const_iterator it = __tree.find(data);
+    return it == __tree.end() ? 0 : it->count;
+  }
+
+#ifdef AVL_TREE_TEST
+
+  template <typename Data_t, typename less, typename Alloc>
+  bool multiset<Data_t, less, Alloc>::_validate() const
+  {
+    __tree._validate();
+    size_t size = 0;
+    for (typename _tree_type::const_iterator it = __tree.begin(); it != __tree.end(); ++it)
+    {
+      assert(it->count > 0);
+      size += it->count;
+    }
+    assert(size == __size);
+    return true;
+  }
+
+#endif // AVL_TREE_TEST
+}
+
+#endif // __AVL_MULTISET_H__
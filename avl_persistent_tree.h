@@ -0,0 +1,969 @@
+#ifndef __AVL_PERSISTENT_TREE_H__
+#define __AVL_PERSISTENT_TREE_H__
+
+#include "avl_tree.h"
+
+#include <atomic> // for std::atomic
+#include <vector>
+
+namespace avl
+{
+  /**
+   * a persistent (copy on write) AVL tree.
+   * the nodes are reference counted and shared between copies, so copying the tree (or snapshot()) is O(1).
+   * insert and remove copy only the O(log n) nodes on the path they change (and the few nodes a rotation touches),
+   * nodes owned by this tree alone are changed in place.
+   *
+   * the nodes have no parent pointers (a shared node has many parents), the iterators keep the path instead.
+   * different copies can be used from different threads at the same time, a single copy isn't thread safe.
+   * nodes are freed with the allocator of the copy that drops them last, so the allocator should be stateless.
+   * iterators are invalidated by any change to the tree (iterators of an older copy stay valid).
+   * when the comparator, a copy of the data or the allocator throws while a node is inserted or removed,
+   * the tree and its snapshots are left as they were (insert looks the new data up again to return its iterator,
+   * a throw from that lookup leaves the data in).
+   */
+  template <typename Data_t, typename less = def_less<Data_t>, typename Alloc = std::allocator<Data_t>>
+  class persistent_tree : private _compare_holder<less>
+  {
+  public:
+    typedef Data_t value_type;
+    typedef less key_compare;
+    typedef Alloc allocator_type;
+    class const_iterator;
+
+  private:
+    class _Node;
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<_Node> _node_allocator;
+    typedef std::allocator_traits<_node_allocator> _node_traits;
+
+    _Node *__root;
+    size_t __size;
+    _node_allocator __allocator;
+
+  public:
+    persistent_tree();                                                                                   // c'tor
+    explicit persistent_tree(const allocator_type &alloc);                                               // allocator c'tor
+    explicit persistent_tree(const less &comp, const allocator_type &alloc = allocator_type());         // comparator c'tor
+    persistent_tree(std::initializer_list<Data_t> list, const allocator_type &alloc = allocator_type()); // list c'tor
+    template <typename InputIt, typename = typename std::enable_if<!std::is_integral<InputIt>::value>::type>
+    persistent_tree(InputIt first, InputIt last, const allocator_type &alloc = allocator_type()); // range c'tor
+    template <typename InputIt, typename = typename std::enable_if<!std::is_integral<InputIt>::value>::type>
+    persistent_tree(InputIt first, InputIt last, const less &comp, const allocator_type &alloc = allocator_type()); // range c'tor, ordered by comp
+    persistent_tree(const persistent_tree &other);                                                  // copy c'tor, O(1)
+    persistent_tree(persistent_tree &&other);                                                       // move c'tor
+    persistent_tree &operator=(const persistent_tree &other);                                       // copy assignment operator, O(1)
+    persistent_tree &operator=(persistent_tree &&other);                                            // move assignment operator
+    ~persistent_tree();                                                                             // d'tor
+
+    // returns a copy of the tree in O(1), later changes to either of them don't show in the other
+    inline persistent_tree snapshot() const { return *this; }
+
+    // returns a copy of the allocator the nodes are allocated with
+    allocator_type get_allocator() const { return allocator_type(__allocator); }
+    // returns the comparator the data is ordered by, copies and snapshots keep it
+    inline const less &key_comp() const { return this->_get_comp(); }
+
+    // empty out the tree, the nodes shared with other copies stay alive
+    void clear();
+    // returns the size of the tree
+    inline size_t size() const { return __size; }
+    // return true if the tree doesn't have any elements
+    inline bool empty() const { return __size == 0; }
+    // return the tree's height
+    inline ssize_t height() const { return _get_height(__root); }
+
+    // returns a const reference to the data, throws data_not_found in case data not found
+    inline const Data_t &search(const Data_t &data) const;
+    // returns true if the data is in the tree
+    inline bool contains(const Data_t &data) const;
+    // non throwing lookup, returns an iterator to the data or end() in case data not found
+    inline const_iterator find(const Data_t &data) const;
+    // returns an iterator to the first data not less than data, end() if there is none
+    inline const_iterator lower_bound(const Data_t &data) const;
+
+    // heterogeneous lookup, only available when less::is_transparent is defined
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline const Data_t &search(const Key &key) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline bool contains(const Key &key) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline const_iterator find(const Key &key) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline const_iterator lower_bound(const Key &key) const;
+
+    // returns the smallest (largest) data in O(log n), throws data_not_found in case the tree is empty
+    inline const Data_t &min() const;
+    inline const Data_t &max() const;
+
+    // inserts the data, throws data_already_exists in case data is already in
+    inline void insert(const Data_t &data);
+    inline void insert(Data_t &&data);
+    // non throwing insert, returns an iterator to the data in the tree and true if it was inserted,
+    // or an iterator to the equal data already in the tree and false.
+    // use as: tree.insert(data, std::nothrow)
+    inline std::pair<const_iterator, bool> insert(const Data_t &data, const std::nothrow_t &);
+    inline std::pair<const_iterator, bool> insert(Data_t &&data, const std::nothrow_t &);
+    // removes the data, throws data_not_found in case data not found
+    inline void remove(const Data_t &data);
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline void remove(const Key &key);
+    // non throwing remove, returns the amount of data removed (0 or 1)
+    inline size_t erase(const Data_t &data);
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline size_t erase(const Key &key);
+
+    // const iterator (the data of a persistent tree can't be changed in place)
+    const_iterator begin() const;
+    const_iterator end() const;
+
+  private:
+    // * helper methods
+
+    template <typename Key>
+    const _Node *_search_aux(const Key &key) const;
+    template <typename Key>
+    const_iterator _lower_bound_aux(const Key &key) const;
+    template <typename T>
+    std::pair<const_iterator, bool> _insert_aux(T &&data);
+    template <typename Key>
+    bool _remove_aux(const Key &key);
+
+    // -*- node sharing helper methods -*- //
+
+    template <typename... Args>
+    _Node *_create_node(Args &&...args);
+    // takes another reference to the node
+    inline static _Node *_acquire(_Node *node);
+    // drops a reference to the node, the sub tree goes once nobody refers to it
+    void _release(_Node *node);
+    // returns a node this tree alone refers to (node itself, or a copy of it that takes its own references to the children).
+    // node must be referred to by a node that is already unshared (or by the root). the caller still holds its reference
+    // to node, and drops it once the copy is linked in node's place (or drops the copy if what comes after throws)
+    _Node *_unshare(_Node *node);
+    // links a node this tree alone refers to into the slot (see _unshare), the data stays the same
+    void _unshare_slot(_Node *&slot);
+    // unshares the nodes a rotation at node would touch in case one side shrinks,
+    // so removing doesn't allocate once it started changing links
+    void _unshare_for_rotation(_Node *node, bool left_shrinks);
+
+    // -*- path copying helper methods -*- //
+    // they take the node of a slot and return what the slot should hold now.
+    // everything that may throw (the comparator, copying a node) happens on the way down before any link changes,
+    // a throw releases the copies made so far, so the tree and its snapshots stay as they were
+
+    template <typename T>
+    _Node *_insert_rec(_Node *node, T &&data, _Node *&created);
+    template <typename Key>
+    _Node *_remove_rec(_Node *node, const Key &key);
+    // detaches the min of the sub tree into min_node
+    _Node *_remove_min_rec(_Node *node, _Node *&min_node);
+
+    // -*- AVL specific - helper methods -*- //
+    // the node must be unshared, the rotations expect the child that moves up to be unshared too
+
+    inline static int _get_height(const _Node *node);
+    inline static void _update_height(_Node *node);
+    inline _Node *_balance(_Node *node);
+    inline _Node *_rotate_left(_Node *node);
+    inline _Node *_rotate_right(_Node *node);
+
+#ifdef AVL_TREE_TEST
+  public:
+    bool _validate() const;
+
+  private:
+    size_t _validate_aux(const _Node *node, const Data_t *lo, const Data_t *hi) const;
+#endif // AVL_TREE_TEST
+  };
+
+  template <typename Data_t, typename less, typename Alloc>
+  class persistent_tree<Data_t, less, Alloc>::_Node
+  {
+  private:
+    friend class persistent_tree;
+    friend class const_iterator;
+
+    Data_t __data;
+    int __height;
+    _Node *__left, *__right;
+    std::atomic<size_t> __refs; // the amount of nodes (and trees) referring to this node
+
+    // the data is constructed in place from args
+    template <typename... Args>
+    explicit _Node(Args &&...args)
+        : __data(std::forward<Args>(args)...),
+          __height(0),
+          __left(nullptr),
+          __right(nullptr),
+          __refs(1) {}
+  };
+
+  /**
+   * in-order iterator, keeps the nodes from the root to the current node whose left sub tree was taken
+   */
+  template <typename Data_t, typename less, typename Alloc>
+  class persistent_tree<Data_t, less, Alloc>::const_iterator
+  {
+  private:
+    friend class persistent_tree; // so avl::persistent_tree can access the private members of const_iterator
+
+    std::vector<const _Node *> __path; // the back is the current node, empty for end()
+
+    inline void _push_left_most(const _Node *node)
+    {
+      while (node)
+      {
+        __path.push_back(node);
+        node = node->__left;
+      }
+    }
+
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Data_t value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const Data_t *pointer;
+    typedef const Data_t &reference;
+
+    inline const_iterator() {}
+
+    inline const Data_t &operator*() const { return __path.back()->__data; }
+
+    inline const Data_t *operator->() const { return &(__path.back()->__data); }
+
+    inline const_iterator &operator++()
+    {
+      const _Node *node = __path.back();
+      __path.pop_back();
+      _push_left_most(node->__right);
+      return *this;
+    }
+
+    inline const_iterator operator++(int)
+    {
+      const_iterator it = *this;
+      ++(*this);
+      return it;
+    }
+
+    inline bool operator!=(const const_iterator &other) const
+    {
+      return (__path.empty() ? nullptr : __path.back()) != (other.__path.empty() ? nullptr : other.__path.back());
+    }
+    inline bool operator==(const const_iterator &other) const { return !(*this != other); }
+  };
+
+  template <typename Data_t, typename less, typename Alloc>
+  persistent_tree<Data_t, less, Alloc>::persistent_tree()
+      : __root(nullptr),
+        __size(0),
+        __allocator()
+  {
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  persistent_tree<Data_t, less, Alloc>::persistent_tree(const allocator_type &alloc)
+      : __root(nullptr),
+        __size(0),
+        __allocator(alloc)
+  {
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  persistent_tree<Data_t, less, Alloc>::persistent_tree(const less &comp, const allocator_type &alloc)
+      : _compare_holder<less>(comp),
+        __root(nullptr),
+        __size(0),
+        __allocator(alloc)
+  {
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  persistent_tree<Data_t, less, Alloc>::persistent_tree(std::initializer_list<Data_t> list, const allocator_type &alloc)
+      : persistent_tree(list.begin(), list.end(), alloc)
+  {
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename InputIt, typename>
+  persistent_tree<Data_t, less, Alloc>::persistent_tree(InputIt first, InputIt last, const allocator_type &alloc)
+      : persistent_tree(first, last, less(), alloc)
+  {
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename InputIt, typename>
+  persistent_tree<Data_t, less, Alloc>::persistent_tree(InputIt first, InputIt last, const less &comp, const allocator_type &alloc)
+      : persistent_tree(comp, alloc)
+  {
+    for (; first != last; ++first)
+    {
+      if (_insert_aux(*first).second == false) // problem in inserting
+      {
+        this->clear(); // clear the tree
+        throw bad_input("inserting failed.");
+      }
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  persistent_tree<Data_t, less, Alloc>::persistent_tree(const persistent_tree &other)
+      : _compare_holder<less>(other.key_comp()),
+        __root(_acquire(other.__root)),
+        __size(other.__size),
+        __allocator(other.__allocator)
+  {
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  persistent_tree<Data_t, less, Alloc>::persistent_tree(persistent_tree &&other)
+      : _compare_holder<less>(other.key_comp()),
+        __root(other.__root),
+        __size(other.__size),
+        __allocator(std::move(other.__allocator))
+  {
+    other.__root = nullptr;
+    other.__size = 0;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  persistent_tree<Data_t, less, Alloc> &persistent_tree<Data_t, less, Alloc>::operator=(const persistent_tree &other)
+  {
+    if (this != &other)
+    {
+      _Node *old_root = __root;
+      __root = _acquire(other.__root);
+      __size = other.__size;
+      this->_set_comp(other.key_comp());
+      _release(old_root);
+    }
+    return *this;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  persistent_tree<Data_t, less, Alloc> &persistent_tree<Data_t, less, Alloc>::operator=(persistent_tree &&other)
+  {
+    if (this != &other)
+    {
+      std::swap(__root, other.__root);
+      std::swap(__size, other.__size);
+      this->_set_comp(other.key_comp());
+      other.clear();
+    }
+    return *this;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  persistent_tree<Data_t, less, Alloc>::~persistent_tree()
+  {
+    clear();
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void persistent_tree<Data_t, less, Alloc>::clear()
+  {
+    _release(__root);
+    __root = nullptr;
+    __size = 0;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  const Data_t &persistent_tree<Data_t, less, Alloc>::search(const Data_t &data) const
+  {
+    const _Node *node = _search_aux(data);
+    if (node == nullptr)
+    {
+      throw data_not_found();
+    }
+    return node->__data;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  bool persistent_tree<Data_t, less, Alloc>::contains(const Data_t &data) const
+  {
+    return _search_aux(data) != nullptr;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  typename persistent_tree<Data_t, less, Alloc>::const_iterator persistent_tree<Data_t, less, Alloc>::find(const Data_t &data) const
+  {
+    const_iterator it = _lower_bound_aux(data);
+    if (it == end() || key_comp()(data, *it))
+    {
+      return end();
+    }
+    return it;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  typename persistent_tree<Data_t, less, Alloc>::const_iterator persistent_tree<Data_t, less, Alloc>::lower_bound(const Data_t &data) const
+  {
+    return _lower_bound_aux(data);
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key, typename>
+  const Data_t &persistent_tree<Data_t, less, Alloc>::search(const Key &key) const
+  {
+    const _Node *node = _search_aux(key);
+    if (node == nullptr)
+    {
+      throw data_not_found();
+    }
+    return node->__data;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key, typename>
+  bool persistent_tree<Data_t, less, Alloc>::contains(const Key &key) const
+  {
+    return _search_aux(key) != nullptr;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key, typename>
+  typename persistent_tree<Data_t, less, Alloc>::const_iterator persistent_tree<Data_t, less, Alloc>::find(const Key &key) const
+  {
+    const_iterator it = _lower_bound_aux(key);
+    if (it == end() || key_comp()(key, *it))
+    {
+      return end();
+    }
+    return it;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key, typename>
+  typename persistent_tree<Data_t, less, Alloc>::const_iterator persistent_tree<Data_t, less, Alloc>::lower_bound(const Key &key) const
+  {
+    return _lower_bound_aux(key);
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  const Data_t &persistent_tree<Data_t, less, Alloc>::min() const
+  {
+    const _Node *node = __root;
+    if (node == nullptr)
+    {
+      throw data_not_found();
+    }
+    while (node->__left)
+    {
+      node = node->__left;
+    }
+    return node->__data;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  const Data_t &persistent_tree<Data_t, less, Alloc>::max() const
+  {
+    const _Node *node = __root;
+    if (node == nullptr)
+    {
+      throw data_not_found();
+    }
+    while (node->__right)
+    {
+      node = node->__right;
+    }
+    return node->__data;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void persistent_tree<Data_t, less, Alloc>::insert(const Data_t &data)
+  {
+    if (_insert_aux(data).second == false)
+    {
+      throw data_already_exists();
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void persistent_tree<Data_t, less, Alloc>::insert(Data_t &&data)
+  {
+    if (_insert_aux(std::move(data)).second == false)
+    {
+      throw data_already_exists();
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  std::pair<typename persistent_tree<Data_t, less, Alloc>::const_iterator, bool> persistent_tree<Data_t, less, Alloc>::insert(const Data_t &data, const std::nothrow_t &)
+  {
+    return _insert_aux(data);
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  std::pair<typename persistent_tree<Data_t, less, Alloc>::const_iterator, bool> persistent_tree<Data_t, less, Alloc>::insert(Data_t &&data, const std::nothrow_t &)
+  {
+    return _insert_aux(std::move(data));
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void persistent_tree<Data_t, less, Alloc>::remove(const Data_t &data)
+  {
+    if (!_remove_aux(data))
+    {
+      throw data_not_found();
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key, typename>
+  void persistent_tree<Data_t, less, Alloc>::remove(const Key &key)
+  {
+    if (!_remove_aux(key))
+    {
+      throw data_not_found();
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  size_t persistent_tree<Data_t, less, Alloc>::erase(const Data_t &data)
+  {
+    return _remove_aux(data) ? 1 : 0;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key, typename>
+  size_t persistent_tree<Data_t, less, Alloc>::erase(const Key &key)
+  {
+    return _remove_aux(key) ? 1 : 0;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  typename persistent_tree<Data_t, less, Alloc>::const_iterator persistent_tree<Data_t, less, Alloc>::begin() const
+  {
+    const_iterator it;
+    it._push_left_most(__root);
+    return it;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  typename persistent_tree<Data_t, less, Alloc>::const_iterator persistent_tree<Data_t, less, Alloc>::end() const
+  {
+    return const_iterator();
+  }
+
+  // * helper methods
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key>
+  const typename persistent_tree<Data_t, less, Alloc>::_Node *persistent_tree<Data_t, less, Alloc>::_search_aux(const Key &key) const
+  {
+    const _Node *node = __root;
+    while (node)
+    {
+      if (key_comp()(key, node->__data))
+      {
+        node = node->__left;
+      }
+      else if (key_comp()(node->__data, key))
+      {
+        node = node->__right;
+      }
+      else
+      {
+        return node;
+      }
+    }
+    return nullptr;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key>
+  typename persistent_tree<Data_t, less, Alloc>::const_iterator persistent_tree<Data_t, less, Alloc>::_lower_bound_aux(const Key &key) const
+  {
+    // the path keeps only the nodes the in-order walk still has to visit (the ones whose left sub tree was taken)
+    const_iterator it;
+    const _Node *node = __root;
+    while (node)
+    {
+      if (key_comp()(node->__data, key))
+      {
+        node = node->__right;
+      }
+      else
+      {
+        it.__path.push_back(node);
+        node = node->__left;
+      }
+    }
+    return it;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename T>
+  std::pair<typename persistent_tree<Data_t, less, Alloc>::const_iterator, bool> persistent_tree<Data_t, less, Alloc>::_insert_aux(T &&data)
+  {
+    // look first, so a failed insert doesn't copy the path
+    const_iterator it = _lower_bound_aux(data);
+    if (it != end() && !key_comp()(data, *it))
+    {
+      return std::pair<const_iterator, bool>(it, false);
+    }
+
+    _Node *created;
+    __root = _insert_rec(__root, std::forward<T>(data), created);
+    __size++;
+    // data may have been moved into the node, so the node data is the key now
+    return std::pair<const_iterator, bool>(_lower_bound_aux(created->__data), true);
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key>
+  bool persistent_tree<Data_t, less, Alloc>::_remove_aux(const Key &key)
+  {
+    // look first, so a failed remove doesn't copy the path
+    if (_search_aux(key) == nullptr)
+    {
+      return false;
+    }
+    __root = _remove_rec(__root, key);
+    __size--;
+    return true;
+  }
+
+  // -*- node sharing helper methods -*- //
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename... Args>
+  typename persistent_tree<Data_t, less, Alloc>::_Node *persistent_tree<Data_t, less, Alloc>::_create_node(Args &&...args)
+  {
+    _Node *node = _node_traits::allocate(__allocator, 1);
+    try
+    {
+      return ::new (static_cast<void *>(node)) _Node(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+      _node_traits::deallocate(__allocator, node, 1);
+      throw;
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  typename persistent_tree<Data_t, less, Alloc>::_Node *persistent_tree<Data_t, less, Alloc>::_acquire(_Node *node)
+  {
+    if (node)
+    {
+      node->__refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return node;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void persistent_tree<Data_t, less, Alloc>::_release(_Node *node)
+  {
+    // the left sub trees are released recursively (O(log n) deep), the right spine in the loop
+    while (node && node->__refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+      _Node *right = node->__right;
+      _release(node->__left);
+      node->~_Node();
+      _node_traits::deallocate(__allocator, node, 1);
+      node = right;
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  typename persistent_tree<Data_t, less, Alloc>::_Node *persistent_tree<Data_t, less, Alloc>::_unshare(_Node *node)
+  {
+    if (node == nullptr || node->__refs.load(std::memory_order_acquire) == 1)
+    {
+      return node;
+    }
+
+    // the copy takes its own references to the children
+    _Node *copy = _create_node(node->__data);
+    copy->__height = node->__height;
+    copy->__left = _acquire(node->__left);
+    copy->__right = _acquire(node->__right);
+    return copy;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void persistent_tree<Data_t, less, Alloc>::_unshare_slot(_Node *&slot)
+  {
+    _Node *copy = _unshare(slot);
+    if (copy != slot)
+    {
+      _release(slot);
+      slot = copy;
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void persistent_tree<Data_t, less, Alloc>::_unshare_for_rotation(_Node *node, bool left_shrinks)
+  {
+    // a rotation is needed only when the other side is already the taller one,
+    // it moves the other child up, and its inner child too for a double rotation
+    if (left_shrinks && _get_height(node->__right) - _get_height(node->__left) == 1)
+    {
+      _unshare_slot(node->__right);
+      if (_get_height(node->__right->__right) < _get_height(node->__right->__left))
+      {
+        _unshare_slot(node->__right->__left);
+      }
+    }
+    else if (!left_shrinks && _get_height(node->__left) - _get_height(node->__right) == 1)
+    {
+      _unshare_slot(node->__left);
+      if (_get_height(node->__left->__left) < _get_height(node->__left->__right))
+      {
+        _unshare_slot(node->__left->__right);
+      }
+    }
+  }
+
+  // -*- path copying helper methods -*- //
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename T>
+  typename persistent_tree<Data_t, less, Alloc>::_Node *persistent_tree<Data_t, less, Alloc>::_insert_rec(_Node *node, T &&data, _Node *&created)
+  {
+    if (node == nullptr)
+    {
+      created = _create_node(std::forward<T>(data));
+      return created;
+    }
+
+    _Node *copy = _unshare(node);
+    try
+    {
+      if (key_comp()(data, copy->__data))
+      {
+        copy->__left = _insert_rec(copy->__left, std::forward<T>(data), created);
+      }
+      else // the data isn't in the tree, so node data < data
+      {
+        copy->__right = _insert_rec(copy->__right, std::forward<T>(data), created);
+      }
+    }
+    catch (...)
+    {
+      // nothing below was linked in, node is still whole
+      if (copy != node)
+      {
+        _release(copy);
+      }
+      throw;
+    }
+    if (copy != node)
+    {
+      _release(node);
+    }
+    // the rotations after an insert move only nodes on the path, which are unshared by now
+    return _balance(copy);
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key>
+  typename persistent_tree<Data_t, less, Alloc>::_Node *persistent_tree<Data_t, less, Alloc>::_remove_rec(_Node *node, const Key &key)
+  {
+    _Node *copy = _unshare(node);
+    _Node *result = copy;
+    bool relinked = false;
+    try
+    {
+      if (key_comp()(key, copy->__data))
+      {
+        _unshare_for_rotation(copy, true);
+        copy->__left = _remove_rec(copy->__left, key);
+      }
+      else if (key_comp()(copy->__data, key))
+      {
+        _unshare_for_rotation(copy, false);
+        copy->__right = _remove_rec(copy->__right, key);
+      }
+      else if (copy->__left && copy->__right)
+      {
+        // node data == key, the successor takes its place (no data is copied)
+        _unshare_for_rotation(copy, false);
+        copy->__right = _remove_min_rec(copy->__right, result);
+        result->__left = copy->__left;
+        result->__right = copy->__right;
+        copy->__left = nullptr;
+        copy->__right = nullptr;
+      }
+      else
+      {
+        // node data == key, the node is relinked around
+        result = copy->__left ? copy->__left : copy->__right;
+        relinked = true;
+        copy->__left = nullptr;
+        copy->__right = nullptr;
+      }
+    }
+    catch (...)
+    {
+      if (copy != node)
+      {
+        _release(copy);
+      }
+      throw;
+    }
+
+    if (result != copy)
+    {
+      // the removed node has no children left
+      _release(copy);
+    }
+    if (copy != node)
+    {
+      _release(node);
+    }
+    // a child that took the removed node's place is balanced already (and may be shared)
+    return relinked ? result : _balance(result);
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  typename persistent_tree<Data_t, less, Alloc>::_Node *persistent_tree<Data_t, less, Alloc>::_remove_min_rec(_Node *node, _Node *&min_node)
+  {
+    _Node *copy = _unshare(node);
+    if (copy->__left == nullptr)
+    {
+      _Node *right = copy->__right;
+      copy->__right = nullptr;
+      min_node = copy;
+      if (copy != node)
+      {
+        _release(node);
+      }
+      return right;
+    }
+
+    try
+    {
+      _unshare_for_rotation(copy, true);
+      copy->__left = _remove_min_rec(copy->__left, min_node);
+    }
+    catch (...)
+    {
+      if (copy != node)
+      {
+        _release(copy);
+      }
+      throw;
+    }
+    if (copy != node)
+    {
+      _release(node);
+    }
+    return _balance(copy);
+  }
+
+  // -*- AVL specific - helper methods -*- //
+
+  template <typename Data_t, typename less, typename Alloc>
+  int persistent_tree<Data_t, less, Alloc>::_get_height(const _Node *node)
+  {
+    return node ? node->__height : -1;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void persistent_tree<Data_t, less, Alloc>::_update_height(_Node *node)
+  {
+    node->__height = 1 + std::max(_get_height(node->__left), _get_height(node->__right));
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  typename persistent_tree<Data_t, less, Alloc>::_Node *persistent_tree<Data_t, less, Alloc>::_balance(_Node *node)
+  {
+    _update_height(node);
+    int bf = _get_height(node->__left) - _get_height(node->__right);
+    if (bf >= 2)
+    {
+      // the children that move up are unshared before any link changes
+      _unshare_slot(node->__left);
+      if (_get_height(node->__left->__left) < _get_height(node->__left->__right)) // LR
+      {
+        _unshare_slot(node->__left->__right);
+        node->__left = _rotate_left(node->__left);
+      }
+      return _rotate_right(node); // LL
+    }
+    if (bf <= -2)
+    {
+      _unshare_slot(node->__right);
+      if (_get_height(node->__right->__right) < _get_height(node->__right->__left)) // RL
+      {
+        _unshare_slot(node->__right->__left);
+        node->__right = _rotate_right(node->__right);
+      }
+      return _rotate_left(node); // RR
+    }
+    return node;
+  }
+
+  /*
+   *
+   *        A        |        B
+   *      /   \      |      /   \
+   *    Al     B     |     A     Br
+   *         /   \   |   /   \
+   *        Bl   Br  |  Al   Bl
+   *
+   */
+  template <typename Data_t, typename less, typename Alloc>
+  typename persistent_tree<Data_t, less, Alloc>::_Node *persistent_tree<Data_t, less, Alloc>::_rotate_left(_Node *A_ptr)
+  {
+    _Node *B_ptr = A_ptr->__right;
+    A_ptr->__right = B_ptr->__left;
+    B_ptr->__left = A_ptr;
+    _update_height(A_ptr);
+    _update_height(B_ptr);
+    return B_ptr;
+  }
+
+  /*
+   *
+   *          A      |        B
+   *        /   \    |      /   \
+   *       B    Ar   |    Bl     A
+   *     /   \       |         /   \
+   *    Bl   Br      |        Br   Ar
+   *
+   */
+  template <typename Data_t, typename less, typename Alloc>
+  typename persistent_tree<Data_t, less, Alloc>::_Node *persistent_tree<Data_t, less, Alloc>::_rotate_right(_Node *A_ptr)
+  {
+    _Node *B_ptr = A_ptr->__left;
+    A_ptr->__left = B_ptr->__right;
+    B_ptr->__right = A_ptr;
+    _update_height(A_ptr);
+    _update_height(B_ptr);
+    return B_ptr;
+  }
+
+#ifdef AVL_TREE_TEST
+
+  template <typename Data_t, typename less, typename Alloc>
+  bool persistent_tree<Data_t, less, Alloc>::_validate() const
+  {
+    assert(__size == _validate_aux(__root, nullptr, nullptr));
+    return true;
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  size_t persistent_tree<Data_t, less, Alloc>::_validate_aux(const _Node *node, const Data_t *lo, const Data_t *hi) const
+  {
+    if (node == nullptr)
+    {
+      return 0;
+    }
+    assert(node->__refs.load() >= 1);
+    assert(!lo || key_comp()(*lo, node->__data));
+    assert(!hi || key_comp()(node->__data, *hi));
+    assert(node->__height == 1 + std::max(_get_height(node->__left), _get_height(node->__right)));
+    int bf = _get_height(node->__left) - _get_height(node->__right);
+    assert(bf >= -1 && bf <= 1);
+    (void)bf;
+    return 1 + _validate_aux(node->__left, lo, &node->__data) + _validate_aux(node->__right, &node->__data, hi);
+  }
+
+#endif // AVL_TREE_TEST
+
+} // namespace avl
+
+#endif // __AVL_PERSISTENT_TREE_H__
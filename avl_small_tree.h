@@ -0,0 +1,429 @@
+#ifndef __AVL_SMALL_TREE_H__
+#define __AVL_SMALL_TREE_H__
+
+#include "avl_tree.h"
+
+namespace avl
+{
+  /**
+   * an AVL tree for trees that are mostly small: up to N data are kept inline, in a sorted array inside the object
+   * (no allocation, no nodes), and searched with a branch free loop the compiler can vectorize.
+   * inserting the N+1st data moves everything into an avl::tree, which stays in use until it is emptied
+   * (so a tree going up and down around N doesn't move back and forth).
+   * the nodes of the avl::tree come from a thread local cache of chunks, so short lived trees rarely reach the allocator.
+   */
+  template <typename Data_t, size_t N = 16, typename less = def_less<Data_t>, typename Alloc = std::allocator<Data_t>>
+  class small_tree
+  {
+    static_assert(N > 0, "a small tree needs room for some data");
+
+  public:
+    typedef Data_t value_type;
+    typedef less key_compare;
+    typedef Alloc allocator_type;
+    class const_iterator;
+    typedef const_iterator iterator; // the data can't be changed, it would break the order
+
+  private:
+    typedef tree<Data_t, less, Alloc> _tree_type;
+
+    typename std::aligned_storage<sizeof(Data_t), alignof(Data_t)>::type __slots[N];
+    size_t __inline_size;
+    _tree_type __tree; // in use once it isn't empty, it holds the comparator either way
+
+  public:
+    small_tree() : __inline_size(0), __tree() {}                                                                                      // c'tor
+    explicit small_tree(const less &comp, const allocator_type &alloc = allocator_type()) : __inline_size(0), __tree(comp, alloc) {} // comparator c'tor
+    small_tree(std::initializer_list<Data_t> list, const less &comp = less(), const allocator_type &alloc = allocator_type());     // list c'tor
+    small_tree(const small_tree &other);
+    small_tree(small_tree &&other);
+    small_tree &operator=(const small_tree &other);
+    small_tree &operator=(small_tree &&other);
+    ~small_tree() { _clear_inline_aux(); }
+
+    allocator_type get_allocator() const { return __tree.get_allocator(); }
+    inline const less &key_comp() const { return __tree.key_comp(); }
+
+    inline size_t size() const { return _is_inline() ? __inline_size : __tree.size(); }
+    inline bool empty() const { return size() == 0; }
+    // true while the data is kept inline
+    inline bool is_inline() const { return _is_inline(); }
+    void clear();
+
+    // returns a const reference to the data, throws data_not_found in case data not found
+    inline const Data_t &search(const Data_t &data) const;
+    inline bool contains(const Data_t &data) const;
+    // non throwing lookup, returns an iterator to the data or end() in case data not found
+    inline const_iterator find(const Data_t &data) const;
+
+    // inserts the data, throws data_already_exists in case data is already in
+    inline void insert(const Data_t &data);
+    // non throwing insert, returns true if the data was inserted
+    inline bool insert(const Data_t &data, const std::nothrow_t &);
+    // removes the data, throws data_not_found in case data not found
+    inline void remove(const Data_t &data);
+    // non throwing remove, returns the amount of data removed (0 or 1)
+    inline size_t erase(const Data_t &data);
+
+    // returns the smallest (largest) data, throws data_not_found in case the tree is empty
+    inline const Data_t &min() const;
+    inline const Data_t &max() const;
+
+    inline const_iterator begin() const { return _is_inline() ? const_iterator(_inline_data()) : const_iterator(__tree.begin()); }
+    inline const_iterator end() const { return _is_inline() ? const_iterator(_inline_data() + __inline_size) : const_iterator(__tree.end()); }
+
+  private:
+    inline bool _is_inline() const { return __tree.empty(); }
+    inline Data_t *_inline_data() { return reinterpret_cast<Data_t *>(__slots); }
+    inline const Data_t *_inline_data() const { return reinterpret_cast<const Data_t *>(__slots); }
+
+    // the position of the first inline data not less than data
+    inline size_t _inline_lower_bound(const Data_t &data) const;
+    // the position of the inline data equal to data, __inline_size in case data not found
+    inline size_t _inline_find(const Data_t &data) const;
+    void _insert_inline_aux(size_t position, const Data_t &data);
+    void _erase_inline_aux(size_t position);
+    // moves the inline data into the tree
+    void _grow_aux();
+    void _clear_inline_aux();
+    void _copy_inline_aux(const small_tree &other);
+    void _move_inline_aux(small_tree &other);
+
+#ifdef AVL_TREE_TEST
+  public:
+    bool _validate() const;
+#endif // AVL_TREE_TEST
+  };
+
+  /**
+   * in-order iterator, over the inline array or the tree
+   */
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  class small_tree<Data_t, N, less, Alloc>::const_iterator
+  {
+  private:
+    friend class small_tree;
+    typedef typename _tree_type::const_iterator _tree_iterator;
+
+    inline explicit const_iterator(const Data_t *position) : inline_position(position), tree_position() {}
+    inline explicit const_iterator(const _tree_iterator &position) : inline_position(nullptr), tree_position(position) {}
+
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Data_t value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const Data_t *pointer;
+    typedef const Data_t &reference;
+
+    inline const Data_t &operator*() const { return inline_position ? *inline_position : *tree_position; }
+    inline const Data_t *operator->() const { return &**this; }
+
+    inline const_iterator &operator++()
+    {
+      if (inline_position)
+      {
+        ++inline_position;
+      }
+      else
+      {
+        ++tree_position;
+      }
+      return *this;
+    }
+
+    inline const_iterator operator++(int)
+    {
+      const_iterator it = *this;
+      ++(*this);
+      return it;
+    }
+
+    inline bool operator!=(const const_iterator &other) const { return inline_position != other.inline_position || tree_position != other.tree_position; }
+    inline bool operator==(const const_iterator &other) const { return !(*this != other); }
+
+  private:
+    const Data_t *inline_position; // nullptr when going over the tree
+    _tree_iterator tree_position;
+  };
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  small_tree<Data_t, N, less, Alloc>::small_tree(std::initializer_list<Data_t> list, const less &comp, const allocator_type &alloc)
+      : __inline_size(0), __tree(comp, alloc)
+  {
+    for (const Data_t &data : list)
+    {
+      insert(data, std::nothrow);
+    }
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  small_tree<Data_t, N, less, Alloc>::small_tree(const small_tree &other) : __inline_size(0), __tree(other.__tree)
+  {
+    _copy_inline_aux(other);
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  small_tree<Data_t, N, less, Alloc>::small_tree(small_tree &&other) : __inline_size(0), __tree(std::move(other.__tree))
+  {
+    _move_inline_aux(other);
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  small_tree<Data_t, N, less, Alloc> &small_tree<Data_t, N, less, Alloc>::operator=(const small_tree &other)
+  {
+    if (this != &other)
+    {
+      _clear_inline_aux();
+      __tree = other.__tree;
+      _copy_inline_aux(other);
+    }
+    return *this;
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  small_tree<Data_t, N, less, Alloc> &small_tree<Data_t, N, less, Alloc>::operator=(small_tree &&other)
+  {
+    if (this != &other)
+    {
+      _clear_inline_aux();
+      __tree = std::move(other.__tree);
+      _move_inline_aux(other);
+    }
+    return *this;
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  void small_tree<Data_t, N, less, Alloc>::clear()
+  {
+    _clear_inline_aux();
+    __tree.clear();
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  size_t small_tree<Data_t, N, less, Alloc>::_inline_lower_bound(const Data_t &data) const
+  {
+    // the array is sorted, so the position is the amount of data less than data.
+    // counting them all (no early exit) leaves the loop without branches
+    const Data_t *array = _inline_data();
+    size_t position = 0;
+    for (size_t i = 0; i < __inline_size; ++i)
+    {
+      position += key_comp()(array[i], data) ? 1 : 0;
+    }
+    return position;
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  size_t small_tree<Data_t, N, less, Alloc>::_inline_find(const Data_t &data) const
+  {
+    size_t position = _inline_lower_bound(data);
+    if (position < __inline_size && !key_comp()(data, _inline_data()[position]))
+    {
+      return position;
+    }
+    return __inline_size;
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  const Data_t &small_tree<Data_t, N, less, Alloc>::search(const Data_t &data) const
+  {
+    if (!_is_inline())
+    {
+      return __tree.search(data);
+    }
+    size_t position = _inline_find(data);
+    if (position == __inline_size)
+    {
+      throw data_not_found();
+    }
+    return _inline_data()[position];
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  bool small_tree<Data_t, N, less, Alloc>::contains(const Data_t &data) const
+  {
+    return _is_inline() ? _inline_find(data) != __inline_size : __tree.contains(data);
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  typename small_tree<Data_t, N, less, Alloc>::const_iterator small_tree<Data_t, N, less, Alloc>::find(const Data_t &data) const
+  {
+    if (!_is_inline())
+    {
+      return const_iterator(__tree.find(data));
+    }
+    return const_iterator(_inline_data() + _inline_find(data));
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  void small_tree<Data_t, N, less, Alloc>::insert(const Data_t &data)
+  {
+    if (!insert(data, std::nothrow))
+    {
+      throw data_already_exists();
+    }
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  bool small_tree<Data_t, N, less, Alloc>::insert(const Data_t &data, const std::nothrow_t &)
+  {
+    if (_is_inline())
+    {
+      size_t position = _inline_lower_bound(data);
+      if (position < __inline_size && !key_comp()(data, _inline_data()[position]))
+      {
+        return false;
+      }
+      if (__inline_size < N)
+      {
+        _insert_inline_aux(position, data);
+        return true;
+      }
+      _grow_aux();
+    }
+    return __tree.insert(data, std::nothrow).second;
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  void small_tree<Data_t, N, less, Alloc>::remove(const Data_t &data)
+  {
+    if (erase(data) == 0)
+    {
+      throw data_not_found();
+    }
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  size_t small_tree<Data_t, N, less, Alloc>::erase(const Data_t &data)
+  {
+    if (!_is_inline())
+    {
+      return __tree.erase(data);
+    }
+    size_t position = _inline_find(data);
+    if (position == __inline_size)
+    {
+      return 0;
+    }
+    _erase_inline_aux(position);
+    return 1;
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  const Data_t &small_tree<Data_t, N, less, Alloc>::min() const
+  {
+    if (!_is_inline())
+    {
+      return __tree.min();
+    }
+    if (__inline_size == 0)
+    {
+      throw data_not_found();
+    }
+    return _inline_data()[0];
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  const Data_t &small_tree<Data_t, N, less, Alloc>::max() const
+  {
+    if (!_is_inline())
+    {
+      return __tree.max();
+    }
+    if (__inline_size == 0)
+    {
+      throw data_not_found();
+    }
+    return _inline_data()[__inline_size - 1];
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  void small_tree<Data_t, N, less, Alloc>::_insert_inline_aux(size_t position, const Data_t &data)
+  {
+    Data_t *array = _inline_data();
+    if (position == __inline_size)
+    {
+      ::new (static_cast<void *>(array + __inline_size)) Data_t(data);
+      ++__inline_size;
+      return;
+    }
+    // the last data moves to the new slot, the rest shift over by 1
+    ::new (static_cast<void *>(array + __inline_size)) Data_t(std::move(array[__inline_size - 1]));
+    ++__inline_size; // the new slot is constructed, so it is destroyed with the rest in case of an exception
+    std::move_backward(array + position, array + __inline_size - 2, array + __inline_size - 1);
+    array[position] = data;
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  void small_tree<Data_t, N, less, Alloc>::_erase_inline_aux(size_t position)
+  {
+    Data_t *array = _inline_data();
+    std::move(array + position + 1, array + __inline_size, array + position);
+    array[--__inline_size].~Data_t();
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  void small_tree<Data_t, N, less, Alloc>::_grow_aux()
+  {
+    // the data is already in order, so every insert goes right by the end.
+    // copied, not moved: in case an allocation throws half way the inline data is still whole (and grown is dropped)
+    const Data_t *array = _inline_data();
+    _tree_type grown(key_comp(), __tree.get_allocator());
+    for (size_t i = 0; i < __inline_size; ++i)
+    {
+      grown.insert(grown.end(), array[i]);
+    }
+    _clear_inline_aux();
+    __tree = std::move(grown);
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  void small_tree<Data_t, N, less, Alloc>::_clear_inline_aux()
+  {
+    Data_t *array = _inline_data();
+    while (__inline_size > 0)
+    {
+      array[--__inline_size].~Data_t();
+    }
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  void small_tree<Data_t, N, less, Alloc>::_copy_inline_aux(const small_tree &other)
+  {
+    const Data_t *array = other._inline_data();
+    for (size_t i = 0; i < other.__inline_size; ++i, ++__inline_size)
+    {
+      ::new (static_cast<void *>(_inline_data() + i)) Data_t(array[i]);
+    }
+  }
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  void small_tree<Data_t, N, less, Alloc>::_move_inline_aux(small_tree &other)
+  {
+    Data_t *array = other._inline_data();
+    for (size_t i = 0; i < other.__inline_size; ++i, ++__inline_size)
+    {
+      ::new (static_cast<void *>(_inline_data() + i)) Data_t(std::move(array[i]));
+    }
+    other._clear_inline_aux();
+  }
+
+#ifdef AVL_TREE_TEST
+
+  template <typename Data_t, size_t N, typename less, typename Alloc>
+  bool small_tree<Data_t, N, less, Alloc>::_validate() const
+  {
+    __tree._validate();
+    assert(__inline_size <= N);
+    assert(__inline_size == 0 || __tree.empty());
+    for (size_t i = 1; i < __inline_size; ++i)
+    {
+      assert(key_comp()(_inline_data()[i - 1], _inline_data()[i]));
+    }
+    return true;
+  }
+
+#endif // AVL_TREE_TEST
+}
+
+#endif // __AVL_SMALL_TREE_H__
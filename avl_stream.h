@@ -0,0 +1,277 @@
+#ifndef __AVL_STREAM_H__
+#define __AVL_STREAM_H__
+
+#include "avl_tree.h"
+
+#include <stdint.h> // for uint32_t, uint64_t
+
+namespace avl
+{
+  /**
+   * streaming serialization of any of the trees (avl::tree, frozen_tree, compact_tree, ...) in order:
+   *
+   *      "AVLS", version (u32), size (u64), then chunks of: count (u32), count encoded data,
+   *      and a last chunk with a count of 0
+   *
+   * the integers are little endian. a writer is anything with write(const char *, size_t) and a reader anything
+   * with read(char *, size_t), both returning something that tests false on failure (std::ostream / std::istream do).
+   * deserialize() builds the tree in O(n) as the chunks are read (no rotations, no buffering of the input),
+   * checking the data is strictly increasing, so a bad stream throws bad_input instead of building a broken tree.
+   *
+   * a codec encodes and decodes 1 data: bool encode(Writer &, const Data_t &) const, bool decode(Reader &, Data_t &) const.
+   * trivial_codec (the default) copies the bytes of trivially copyable data, string_codec writes a length and the characters.
+   * decoding needs a default constructible Data_t.
+   */
+
+  template <typename Data_t>
+  struct trivial_codec
+  {
+    static_assert(std::is_trivially_copyable<Data_t>::value, "trivial_codec needs trivially copyable data, use a codec of your own");
+
+    template <typename Writer>
+    bool encode(Writer &writer, const Data_t &data) const { return bool(writer.write(reinterpret_cast<const char *>(&data), sizeof(Data_t))); }
+    template <typename Reader>
+    bool decode(Reader &reader, Data_t &data) const { return bool(reader.read(reinterpret_cast<char *>(&data), sizeof(Data_t))); }
+  };
+
+  // little endian integers of Bytes bytes
+  template <size_t Bytes, typename Writer>
+  bool _write_uint(Writer &writer, uint64_t value)
+  {
+    char bytes[Bytes];
+    for (size_t i = 0; i < Bytes; ++i)
+    {
+      bytes[i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+    }
+    return bool(writer.write(bytes, Bytes));
+  }
+
+  template <size_t Bytes, typename Reader>
+  bool _read_uint(Reader &reader, uint64_t &value)
+  {
+    char bytes[Bytes];
+    if (!reader.read(bytes, Bytes))
+    {
+      return false;
+    }
+    value = 0;
+    for (size_t i = 0; i < Bytes; ++i)
+    {
+      value |= static_cast<uint64_t>(static_cast<unsigned char>(bytes[i])) << (8 * i);
+    }
+    return true;
+  }
+
+  struct string_codec
+  {
+    template <typename Writer>
+    bool encode(Writer &writer, const std::string &data) const
+    {
+      return _write_uint<8>(writer, data.size()) && (data.empty() || bool(writer.write(data.data(), data.size())));
+    }
+    template <typename Reader>
+    bool decode(Reader &reader, std::string &data) const
+    {
+      uint64_t size;
+      if (!_read_uint<8>(reader, size))
+      {
+        return false;
+      }
+      // the length isn't trusted: the string grows a piece at a time as the bytes come in,
+      // so a broken length fails on the short read instead of on a huge allocation
+      data.clear();
+      while (size > 0)
+      {
+        size_t piece = static_cast<size_t>(std::min<uint64_t>(size, __piece_size));
+        size_t offset = data.size();
+        data.resize(offset + piece);
+        if (!reader.read(&data[offset], piece))
+        {
+          return false;
+        }
+        size -= piece;
+      }
+      return true;
+    }
+
+  private:
+    enum : size_t
+    {
+      __piece_size = 64 * 1024
+    };
+  };
+
+  static const char _stream_magic[4] = {'A', 'V', 'L', 'S'};
+  static const uint32_t _stream_version = 1;
+
+  /**
+   * writes the data of tree in order, chunk_size data per chunk.
+   * throws bad_input in case the writer fails
+   */
+  template <typename Tree, typename Writer, typename Codec>
+  void serialize(const Tree &tree, Writer &writer, const Codec &codec, size_t chunk_size = 4096)
+  {
+    chunk_size = chunk_size ? std::min<size_t>(chunk_size, std::numeric_limits<uint32_t>::max()) : 1;
+    size_t left = tree.size();
+    bool ok = bool(writer.write(_stream_magic, sizeof(_stream_magic))) &&
+              _write_uint<4>(writer, _stream_version) &&
+              _write_uint<8>(writer, left);
+    typename Tree::const_iterator it = tree.begin();
+    while (ok && left > 0)
+    {
+      size_t count = std::min(left, chunk_size);
+      ok = _write_uint<4>(writer, count);
+      for (size_t i = 0; ok && i < count; ++i, ++it)
+      {
+        ok = codec.encode(writer, *it);
+      }
+      left -= count;
+    }
+    if (!ok || !_write_uint<4>(writer, 0))
+    {
+      throw bad_input("serializing failed.");
+    }
+  }
+
+  template <typename Tree, typename Writer>
+  void serialize(const Tree &tree, Writer &writer)
+  {
+    serialize(tree, writer, trivial_codec<typename Tree::value_type>());
+  }
+
+  /**
+   * decodes the data of the chunks one by one, as the tree builder asks for them
+   */
+  template <typename Data_t, typename Reader, typename Codec, typename Compare>
+  class _chunk_decoder
+  {
+  public:
+    _chunk_decoder(Reader &reader, const Codec &codec, const Compare &comp, size_t size)
+        : __reader(reader), __codec(codec), __comp(comp), __left(size), __chunk_left(0), __loaded(false), __first(true) {}
+
+    const Data_t &current()
+    {
+      if (!__loaded)
+      {
+        _load_aux();
+      }
+      return __current;
+    }
+
+    void advance()
+    {
+      if (!__loaded)
+      {
+        _load_aux();
+      }
+      __loaded = false;
+    }
+
+    // the last chunk has to be empty
+    bool finish()
+    {
+      uint64_t count;
+      return __left == 0 && __chunk_left == 0 && _read_uint<4>(__reader, count) && count == 0;
+    }
+
+  private:
+    void _load_aux()
+    {
+      if (__chunk_left == 0)
+      {
+        uint64_t count;
+        if (!_read_uint<4>(__reader, count) || count == 0 || count > __left)
+        {
+          throw bad_input("deserializing failed.");
+        }
+        __chunk_left = static_cast<size_t>(count);
+      }
+      if (!__codec.decode(__reader, __next) || (!__first && !__comp(__current, __next)))
+      {
+        throw bad_input("deserializing failed.");
+      }
+      std::swap(__current, __next);
+      __first = false;
+      __loaded = true;
+      --__chunk_left;
+      --__left;
+    }
+
+    Reader &__reader;
+    const Codec &__codec;
+    Compare __comp;
+    size_t __left;       // data not read yet
+    size_t __chunk_left; // of them, in the chunk being read
+    bool __loaded;       // __current wasn't taken yet
+    bool __first;
+    Data_t __current;
+    Data_t __next;
+  };
+
+  // a single pass iterator over a _chunk_decoder
+  template <typename Decoder, typename Data_t>
+  class _chunk_iterator
+  {
+  public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef Data_t value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const Data_t *pointer;
+    typedef const Data_t &reference;
+
+    explicit _chunk_iterator(Decoder &decoder) : __decoder(&decoder) {}
+
+    inline const Data_t &operator*() const { return __decoder->current(); }
+    inline const Data_t *operator->() const { return &__decoder->current(); }
+    inline _chunk_iterator &operator++()
+    {
+      __decoder->advance();
+      return *this;
+    }
+
+  private:
+    Decoder *__decoder;
+  };
+
+  /**
+   * reads a tree written by serialize(), Tree is the avl::tree type to build, ordered by comp.
+   * throws bad_input in case the reader fails or the stream is broken (nothing is leaked, no tree is returned)
+   */
+  template <typename Tree, typename Reader, typename Codec>
+  Tree deserialize(Reader &reader, const Codec &codec, const typename Tree::key_compare &comp,
+                   const typename Tree::allocator_type &alloc = typename Tree::allocator_type())
+  {
+    typedef typename Tree::value_type data_type;
+    typedef _chunk_decoder<data_type, Reader, Codec, typename Tree::key_compare> decoder_type;
+
+    char magic[sizeof(_stream_magic)];
+    uint64_t version, size;
+    if (!reader.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), _stream_magic) ||
+        !_read_uint<4>(reader, version) || version != _stream_version || !_read_uint<8>(reader, size))
+    {
+      throw bad_input("deserializing failed.");
+    }
+
+    decoder_type decoder(reader, codec, comp, static_cast<size_t>(size));
+    Tree tree = Tree::from_sorted_n(_chunk_iterator<decoder_type, data_type>(decoder), static_cast<size_t>(size), comp, alloc);
+    if (!decoder.finish())
+    {
+      throw bad_input("deserializing failed.");
+    }
+    return tree;
+  }
+
+  template <typename Tree, typename Reader, typename Codec>
+  Tree deserialize(Reader &reader, const Codec &codec, const typename Tree::allocator_type &alloc = typename Tree::allocator_type())
+  {
+    return deserialize<Tree>(reader, codec, typename Tree::key_compare(), alloc);
+  }
+
+  template <typename Tree, typename Reader>
+  Tree deserialize(Reader &reader)
+  {
+    return deserialize<Tree>(reader, trivial_codec<typename Tree::value_type>());
+  }
+}
+
+#endif // __AVL_STREAM_H__
@@ -1,23 +1,15 @@
 #ifndef __AVL_TREE_H__
 #define __AVL_TREE_H__
 
-#undef AVL_TREE_TEST // to solve any MACRO conflicts
 /**
- * a MACRO to quickly toggle testing on/off.
- * comment out when you don't want to test.
+ * the debug layer is off by default, define AVL_TREE_TEST before including the header to turn it on:
  *
- * for example:
- *      #ifdef AVL_TREE_TEST
- *          test code
- *      #else
- *          good code
- *      #endif
- * or:
- *      #ifdef AVL_TREE_TEST
- *          code
- *      #endif
+ *      #define AVL_TREE_TEST
+ *      #include "avl_tree.h"
+ *
+ * it compiles in the validation (_validate()) and printing (_print_tree()) methods and the extra asserts,
+ * and pulls in <iostream>. without it none of that code is compiled, so release builds pay nothing for it
  */
-#define AVL_TREE_TEST
 
 // Includes
 
@@ -37,6 +29,17 @@
 #include <exception>
 #include <string>
 #include <initializer_list>
+#include <algorithm>   // for std::max, std::min
+#include <cmath>       // for std::log2
+#include <memory>      // for std::allocator, std::allocator_traits, std::shared_ptr
+#include <new>         // for placement new, std::nothrow_t
+#include <type_traits> // for std::is_trivially_destructible
+#include <limits>      // for std::numeric_limits
+#include <vector>
+#include <iterator>    // for std::iterator_traits, std::distance
+#include <future>      // for std::async
+#include <thread>      // for std::thread::hardware_concurrency
+#include <system_error> // for std::system_error
 
 namespace avl
 {
@@ -51,6 +54,39 @@ namespace avl
     inline bool operator()(const T &x, const T &y) const { return x < y; }
   }; // could use std::less defined in <functional> instead
 
+  /**
+   * transparent `less`, compares any two types that have an operator<
+   * lets the tree be searched by a key without building a whole Data_t
+   */
+  template <>
+  struct def_less<void>
+  {
+    typedef void is_transparent;
+
+    template <typename T, typename U>
+    inline bool operator()(const T &x, const U &y) const { return x < y; }
+  };
+
+  /**
+   * true if the `less` functor declares an `is_transparent` type,
+   * in which case it can compare keys that are not of type Data_t
+   */
+  template <typename>
+  struct _void_type
+  {
+    typedef void type;
+  };
+
+  template <typename less, typename = void>
+  struct _is_transparent : std::false_type
+  {
+  };
+
+  template <typename less>
+  struct _is_transparent<less, typename _void_type<typename less::is_transparent>::type> : std::true_type
+  {
+  };
+
   template <typename T>
   inline void swap(T &x, T &y) { std::swap<T>(x, y); }
 
@@ -85,970 +121,4962 @@ namespace avl
     bad_input(const std::string &msg) : _custom_exception("Invalid input: " + msg) {}
   };
 
-  template <typename Data_t, typename less = def_less<Data_t>>
-  class tree
+  /**
+   * the size of a node's sub tree (the node included),
+   * only kept in the nodes of trees that maintain order statistics
+   */
+  template <bool Ranked>
+  struct _node_count
   {
-  private:
-    class _Node;
-    _Node *__root;
-    _Node *__min_element;
-    _Node *__max_element;
-    size_t __size;
+    size_t __count;
+    _node_count() : __count(1) {}
+  };
 
-    inline void set_root(_Node *new_root) { __root = new_root; }
-    inline void set_size(size_t new_size) { __size = new_size; }
-    inline void set_max_element(_Node *new_max) { __max_element = new_max; }
-    inline void set_min_element(_Node *new_min) { __min_element = new_min; }
+  template <>
+  struct _node_count<false>
+  {
+  };
 
-  public:
-    tree();                                   // c'tor
-    tree(std::initializer_list<Data_t> list); // list c'tor
-    tree(tree &other);                        // copy c'tor
-    tree(tree &&other);                       // move c'tor
-    tree &operator=(const tree &other);       // copy assignment operator
-    tree &operator=(const tree &&other);      // move assignment operator
-    ~tree();                                  // d'tor
-
-    // empty out the tree
-    void clear();
-    // returns the size of the tree
-    inline size_t size() const;
-    // return true if the tree doesn't have any elements
-    inline bool empty() const;
-    // return the tree's height
-    inline ssize_t height() const;
+  /**
+   * Augment policies - keep a value of a monoid per sub tree,
+   * the in-order fold of all the data in it.
+   * a policy has to provide:
+   *    typedef ... value_type;
+   *    static value_type identity();                                            // the fold of an empty sub tree
+   *    static value_type lift(const Data_t &data);                              // the value of a single data
+   *    static value_type combine(const value_type &left, const value_type &right); // must be associative
+   * policies used for interval stabbing (see tree::stab) also provide:
+   *    static const point_type &low(const Data_t &data);
+   *    static const point_type &high(const Data_t &data);
+   */
 
-    // returns a const reference to the data, throws data_not_found in case data not found
-    inline const Data_t &search(const Data_t &data) const;
-    // returns a reference to the data, use with caution, only implemented for flexibility
-    inline Data_t &search(const Data_t &data);
+  // the default, nothing is kept
+  struct no_augment
+  {
+  };
 
-    // inserts the data, throws data_already_exists in case data is already in
-    inline void insert(const Data_t &data);
-    // removes the data, throws data_not_found in case data not found
-    inline void remove(const Data_t &data);
-    // unites 2 trees into 1 in linear time
-    inline static tree unite(const tree &t1, const tree &t2);
-    // unites 2 trees into 1 in linear time
-    inline static tree unite(tree &&t1, tree &&t2);
+  template <typename T>
+  struct sum_augment
+  {
+    typedef T value_type;
+    static value_type identity() { return value_type(); }
+    template <typename Data_t>
+    static value_type lift(const Data_t &data) { return static_cast<value_type>(data); }
+    static value_type combine(const value_type &left, const value_type &right) { return left + right; }
+  };
 
-    // iterator
-    class iterator;
-    iterator begin() { return iterator(__root); }
-    iterator end() { return iterator(nullptr); }
+  template <typename T>
+  struct max_augment
+  {
+    typedef T value_type;
+    static value_type identity() { return std::numeric_limits<value_type>::lowest(); }
+    template <typename Data_t>
+    static value_type lift(const Data_t &data) { return static_cast<value_type>(data); }
+    static value_type combine(const value_type &left, const value_type &right) { return (left < right) ? right : left; }
+  };
 
-    // const iterator
-    class const_iterator;
-    const_iterator begin() const { return const_iterator(__root); }
-    const_iterator end() const { return const_iterator(nullptr); }
+  template <typename T>
+  struct min_augment
+  {
+    typedef T value_type;
+    static value_type identity() { return std::numeric_limits<value_type>::max(); }
+    template <typename Data_t>
+    static value_type lift(const Data_t &data) { return static_cast<value_type>(data); }
+    static value_type combine(const value_type &left, const value_type &right) { return (right < left) ? right : left; }
+  };
 
-  private:
-    // private iterator
-    class _iterator;
-    _iterator _begin() { return _iterator(__root); }
-    _iterator _end() { return _iterator(nullptr); }
-    // private const iterator
-    class _const_iterator;
-    _const_iterator _begin() const { return _const_iterator(__root); }
-    _const_iterator _end() const { return _const_iterator(nullptr); }
+  /**
+   * interval tree policy, keeps the max end point of the intervals in every sub tree.
+   * GetLow / GetHigh are functors returning the end points of an interval (both included),
+   * the tree must be ordered by the low end point first
+   */
+  template <typename Point, typename GetLow, typename GetHigh>
+  struct interval_augment
+  {
+    typedef Point value_type;
+    typedef Point point_type;
+    static value_type identity() { return std::numeric_limits<value_type>::lowest(); }
+    template <typename Data_t>
+    static const point_type &low(const Data_t &data) { return GetLow()(data); }
+    template <typename Data_t>
+    static const point_type &high(const Data_t &data) { return GetHigh()(data); }
+    template <typename Data_t>
+    static value_type lift(const Data_t &data) { return high(data); }
+    static value_type combine(const value_type &left, const value_type &right) { return (left < right) ? right : left; }
+  };
 
-    // * helper methods
+  template <typename Pair>
+  struct _pair_first
+  {
+    const typename Pair::first_type &operator()(const Pair &pair) const { return pair.first; }
+  };
 
-    // -*- general tree helper methods -*- //
+  template <typename Pair>
+  struct _pair_second
+  {
+    const typename Pair::second_type &operator()(const Pair &pair) const { return pair.second; }
+  };
 
-    bool _insert_aux(const Data_t &data);
-    bool _remove_aux(const Data_t &data);
-    void _clear_aux();
+  // interval tree over std::pair<Point, Point> intervals, [first, second]
+  template <typename Point>
+  struct pair_interval_augment : interval_augment<Point, _pair_first<std::pair<Point, Point>>, _pair_second<std::pair<Point, Point>>>
+  {
+  };
 
-    std::pair<_Node *, _Node **> _search_place_aux(const Data_t &data);
-    std::pair<const _Node *, const _Node *const *> _search_place_aux(const Data_t &data) const;
-    const _Node *_search_aux(const Data_t &data) const;
-    _Node *_search_aux(const Data_t &data);
+  /**
+   * the augmented value of a node's sub tree, only kept when there is an Augment policy
+   */
+  template <typename Augment>
+  struct _node_augment
+  {
+    typename Augment::value_type __aug;
+    _node_augment() : __aug(Augment::identity()) {}
+  };
 
-    size_t _destroy_tree_iter(_Node **root);
-    size_t _destroy_tree_rec(_Node **root);
-    inline size_t _destroy_tree(_Node **root) { return _destroy_tree_rec(root); }
+  template <>
+  struct _node_augment<no_augment>
+  {
+  };
 
-    _Node *_copy_tree_iter(_Node *root);
-    _Node *_copy_tree_rec(_Node *root);
-    inline _Node *_copy_tree(_Node *root) { return _copy_tree_rec(root); }
+  template <typename Augment>
+  struct _augment_traits
+  {
+    typedef typename Augment::value_type value_type;
+    static const bool enabled = true;
+  };
 
-    ssize_t _get_tree_height_iter(_Node &node) const;
-    ssize_t _get_tree_height_rec(_Node *node) const;
-    ssize_t _get_tree_height(_Node &node) const { return _get_tree_height_rec(&node); }
+  template <>
+  struct _augment_traits<no_augment>
+  {
+    typedef void value_type;
+    static const bool enabled = false;
+  };
 
-    ssize_t _get_tree_size_iter(_Node *node) const;
-    ssize_t _get_tree_size_rec(_Node *node) const;
-    ssize_t _get_tree_size(_Node *node) const { return _get_tree_size_rec(node); }
+  /**
+   * Stats policies - count what the hot paths of the tree do, tree::stats() returns the counters.
+   * no_stats (the default) counts nothing and takes no space,
+   * tree_stats counts the searches, rotations, rebalancing walks and node allocations of the tree's
+   * insert / remove / lookup paths, and the comparisons, rotations and allocations of the join based operations,
+   * the batches and the bulk builds. a tree returned by a set operation or a join starts with the work
+   * of that operation, split() and the batches count on the tree they change.
+   * the counters aren't atomic, a counted tree shouldn't be searched from several threads at once
+   */
+  struct no_stats
+  {
+  };
 
-    inline static _Node *_get_left_most_node(_Node *node);
-    inline static _Node *_get_right_most_node(_Node *node);
+  struct tree_stats
+  {
+    static const size_t max_depth = 64; // the histograms count deeper paths in the last bucket
+    enum rotation
+    {
+      LL,
+      LR,
+      RL,
+      RR
+    };
+
+    unsigned long long comparisons;                // comparator calls made by searches, set operations, batches and builds
+    unsigned long long searches;                   // searches from the root
+    unsigned long long hinted_searches;            // insert(hint, ...) and emplace_hint calls, the ones with a bad hint also search from the root
+    unsigned long long search_depths[max_depth];   // searches by the amount of nodes they passed
+    unsigned long long rotations[4];               // rebalancing rotations by type, indexed by rotation
+    unsigned long long rebalances;                 // walks up the tree after an insert or a remove
+    unsigned long long rebalance_steps[max_depth]; // walks by the amount of nodes they updated
+    unsigned long long nodes_created;
+
+    tree_stats() { reset(); }
+
+    void reset()
+    {
+      comparisons = 0;
+      searches = 0;
+      hinted_searches = 0;
+      std::fill(search_depths, search_depths + max_depth, 0ULL);
+      std::fill(rotations, rotations + 4, 0ULL);
+      rebalances = 0;
+      std::fill(rebalance_steps, rebalance_steps + max_depth, 0ULL);
+      nodes_created = 0;
+    }
 
-    inline void _swap_nodes(_Node **a, _Node **b);
+    tree_stats &operator+=(const tree_stats &other)
+    {
+      comparisons += other.comparisons;
+      searches += other.searches;
+      hinted_searches += other.hinted_searches;
+      for (size_t i = 0; i < max_depth; ++i)
+      {
+        search_depths[i] += other.search_depths[i];
+        rebalance_steps[i] += other.rebalance_steps[i];
+      }
+      for (size_t i = 0; i < 4; ++i)
+      {
+        rotations[i] += other.rotations[i];
+      }
+      rebalances += other.rebalances;
+      nodes_created += other.nodes_created;
+      return *this;
+    }
+  };
 
-    inline _Node **_get_node_pptr(_Node *node_ptr);
+  /**
+   * the tree inherits the counters from here, so no_stats adds nothing (empty base)
+   */
+  template <typename Stats>
+  class _stats_counter
+  {
+  protected:
+    inline const Stats &_get_stats() const { return __stats; }
+    inline void _reset_stats() { __stats.reset(); }
+    inline void _add_stats(const Stats &other) const { __stats += other; }
+    inline void _count_comparison() const { ++__stats.comparisons; }
+    inline void _count_search(size_t depth) const
+    {
+      ++__stats.searches;
+      ++__stats.search_depths[std::min<size_t>(depth, Stats::max_depth - 1)];
+    }
+    inline void _count_hinted_search() const { ++__stats.hinted_searches; }
+    inline void _count_rotation(unsigned rotation) const { ++__stats.rotations[rotation]; }
+    inline void _count_rebalance(size_t steps) const
+    {
+      ++__stats.rebalances;
+      ++__stats.rebalance_steps[std::min<size_t>(steps, Stats::max_depth - 1)];
+    }
+    inline void _count_node() const { ++__stats.nodes_created; }
 
-    inline static _Node *_create_almost_full_tree(const Data_t **data_ptr, size_t size);
-    inline static _Node *_create_almost_full_tree_in_place(_Node **data_ptr, size_t size);
+  private:
+    mutable Stats __stats;
+  };
 
-#ifdef AVL_TREE_TEST
+  template <>
+  class _stats_counter<no_stats>
+  {
+  protected:
+    inline const no_stats &_get_stats() const
+    {
+      static const no_stats stats = no_stats();
+      return stats;
+    }
+    inline void _reset_stats() {}
+    inline void _add_stats(const no_stats &) const {}
+    inline void _count_comparison() const {}
+    inline void _count_search(size_t) const {}
+    inline void _count_hinted_search() const {}
+    inline void _count_rotation(unsigned) const {}
+    inline void _count_rebalance(size_t) const {}
+    inline void _count_node() const {}
+  };
+
+  /**
+   * a pair of iterators that can be used in a range based for loop
+   */
+  template <typename It>
+  class range_view
+  {
   public:
-    void _print_tree() const;
-    void _print_tree_aux(_Node *root, size_t indentation) const;
+    range_view(It first, It last) : __first(first), __last(last) {}
+
+    It begin() const { return __first; }
+    It end() const { return __last; }
+    bool empty() const { return !(__first != __last); }
 
   private:
-#endif // AVL_TREE_TEST
+    It __first;
+    It __last;
+  };
 
-    // -*- tree with specifications - helper methods -*- //
+  /**
+   * tells the divide and conquer algorithms (set operations, bulk builds) how to run in parallel.
+   * each split hands half of the remaining threads to a new thread (std::async),
+   * sub problems with less than cutoff data stay on the current thread
+   */
+  struct parallel_policy
+  {
+    unsigned threads;
+    size_t cutoff;
 
-    // requires a height field
-    inline size_t _get_tree_height_from_children(_Node &node) const;
-    // requires a *min field
-    _Node *_find_min() const;
-    // requires a *max field
-    _Node *_find_max() const;
+    explicit parallel_policy(unsigned threads = std::thread::hardware_concurrency(), size_t cutoff = size_t(1) << 15)
+        : threads(threads ? threads : 1), cutoff(cutoff ? cutoff : 1) {}
+  };
 
-    // -*- AVL specific - helper methods -*- //
+  // hints the cpu to start loading address into the cache, a no-op where it isn't supported
+  inline void _prefetch_read(const void *address)
+  {
+#if defined(__GNUC__)
+    __builtin_prefetch(address);
+#else
+    (void)address;
+#endif
+  }
 
-    inline ssize_t _get_balance_factor(_Node *node) const;
-    inline void _balance_to_root(_Node **node);
-    inline void _rotate_right(_Node **node);
-    inline void _rotate_left(_Node **node);
-    inline void _rotate_LL(_Node **node);
-    inline void _rotate_LR(_Node **node);
-    inline void _rotate_RL(_Node **node);
-    inline void _rotate_RR(_Node **node);
+#if __cplusplus >= 201402L
+  template <typename T>
+  struct _is_final : std::is_final<T>
+  {
+  };
+#elif defined(__GNUC__)
+  template <typename T>
+  struct _is_final : std::integral_constant<bool, __is_final(T)>
+  {
+  };
+#else
+  // can't tell, so never derive from the comparator
+  template <typename T>
+  struct _is_final : std::true_type
+  {
+  };
+#endif
 
-#ifdef AVL_TREE_TEST
-  public:
-    bool _validate() const;
-    void _validate_aux(_Node *root) const;
-    void _validate_min_element() const;
-    _Node *_validate_min_element_aux(_Node *node) const;
-    void _validate_max_element() const;
-    _Node *_validate_max_element_aux(_Node *node) const;
-    void _validate_data_order() const;
-    void _validate_data_order_aux(_Node *node) const;
+  /**
+   * keeps the comparator of a tree. an empty comparator (def_less, std::less, a lambda without captures)
+   * is a base so it takes no space (empty base optimization), a stateful one is a member
+   */
+  template <typename Compare, bool = std::is_empty<Compare>::value && !_is_final<Compare>::value>
+  class _compare_holder : private Compare
+  {
+  protected:
+    _compare_holder() : Compare() {}
+    explicit _compare_holder(const Compare &comp) : Compare(comp) {}
+    inline const Compare &_get_comp() const { return *this; }
+    inline void _set_comp(const Compare &comp) { static_cast<Compare &>(*this) = comp; }
+  };
+
+  template <typename Compare>
+  class _compare_holder<Compare, false>
+  {
+  protected:
+    _compare_holder() : __comp() {}
+    explicit _compare_holder(const Compare &comp) : __comp(comp) {}
+    inline const Compare &_get_comp() const { return __comp; }
+    inline void _set_comp(const Compare &comp) { __comp = comp; }
 
   private:
-#endif // AVL_TREE_TEST
+    Compare __comp;
   };
 
-  template <typename Data_t, typename less>
-  class avl::tree<Data_t, less>::_Node
+  // opens frozen trees up to avl_mapped_tree.h, which saves and maps them
+  template <typename Frozen>
+  struct _mapped_access;
+
+  /**
+   * a read only copy of strictly increasing data, laid out as an implicit tree in Eytzinger (BFS) order:
+   * the children of position k are 2k and 2k + 1 (positions start at 1), so there are no pointers,
+   * the top levels share a few cache lines and the 16 descendants 4 levels down are contiguous.
+   * lookups descend without branching on the comparison and prefetch 4 levels ahead.
+   * built by tree::freeze() or from a strictly increasing range, iterates in order.
+   * the layout has no pointers so it can also be saved and mapped back from a file (avl_mapped_tree.h),
+   * copies of a mapped tree share the mapping.
+   */
+  template <typename Data_t, typename less = def_less<Data_t>, typename Alloc = std::allocator<Data_t>>
+  class frozen_tree : private _compare_holder<less>
   {
+  public:
+    typedef Data_t value_type;
+    typedef less key_compare;
+    typedef Alloc allocator_type;
+    class const_iterator;
+    typedef const_iterator iterator; // the data can't be changed
+
   private:
-    friend class tree;            // so avl::tree can access the private members of avl::tree::_Node
-    friend class _iterator;       // so avl::tree::_iterator can access the private members of avl::tree::_Node
-    friend class _const_iterator; // so avl::tree::_const_iterator can access the private members of avl::tree::_Node
-    template <typename T, typename L>
-    friend tree<T, L> unite(tree<T, L> &&t1, tree<T, L> &&t2);
+    typedef std::allocator_traits<Alloc> _traits;
 
-    Data_t __data;
-    int __height;
-    _Node *__parent, *__left, *__right;
+    Data_t *__data; // __data[k - 1] is position k
+    size_t __size;
+    allocator_type __allocator;
+    std::shared_ptr<const void> __storage; // keeps a mapped file alive, the data isn't allocated when it's set
 
-    _Node(const Data_t &data)
-        : __data(data),
-          __height(0),
-          __parent(nullptr),
-          __left(nullptr),
-          __right(nullptr) {}
+  public:
+    frozen_tree();                                       // c'tor
+    explicit frozen_tree(const allocator_type &alloc);   // allocator c'tor
+    // builds from strictly increasing data in O(n), throws bad_input otherwise
+    template <typename ForwardIt, typename = typename std::enable_if<!std::is_integral<ForwardIt>::value>::type>
+    frozen_tree(ForwardIt first, ForwardIt last, const allocator_type &alloc = allocator_type()); // range c'tor
+    // the same with a comparator object (one that has state), the data has to be increasing by comp
+    template <typename ForwardIt, typename = typename std::enable_if<!std::is_integral<ForwardIt>::value>::type>
+    frozen_tree(ForwardIt first, ForwardIt last, const less &comp, const allocator_type &alloc = allocator_type());
+    frozen_tree(const frozen_tree &other);                                                     // copy c'tor
+    frozen_tree(frozen_tree &&other);                                                          // move c'tor
+    frozen_tree &operator=(const frozen_tree &other);                                          // copy assignment operator
+    frozen_tree &operator=(frozen_tree &&other);                                               // move assignment operator
+    ~frozen_tree();                                                                            // d'tor
+
+    // returns a copy of the allocator the data is allocated with
+    allocator_type get_allocator() const { return __allocator; }
+    // returns the comparator the data is ordered by
+    inline const less &key_comp() const { return this->_get_comp(); }
 
-    Data_t &get_data() { return __data; }
-    const Data_t &get_data() const { return __data; }
+    // returns the size of the tree
+    inline size_t size() const { return __size; }
+    // return true if the tree doesn't have any elements
+    inline bool empty() const { return __size == 0; }
+    // return the tree's height (every level but the last is full)
+    inline ssize_t height() const;
+
+    // returns a const reference to the data, throws data_not_found in case data not found
+    inline const Data_t &search(const Data_t &data) const;
+    // returns true if the data is in the tree
+    inline bool contains(const Data_t &data) const;
+    // non throwing lookup, returns an iterator to the data or end() in case data not found
+    inline const_iterator find(const Data_t &data) const;
+    // returns an iterator to the first data not less than (greater than) data, end() if there is none
+    inline const_iterator lower_bound(const Data_t &data) const;
+    inline const_iterator upper_bound(const Data_t &data) const;
+
+    // heterogeneous lookup, only available when less::is_transparent is defined
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline const Data_t &search(const Key &key) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline bool contains(const Key &key) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline const_iterator find(const Key &key) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline const_iterator lower_bound(const Key &key) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline const_iterator upper_bound(const Key &key) const;
+
+    // batched lookup, the descents of up to 16 keys advance level by level together so their cache misses overlap.
+    // contains_batch writes a bool per key to out, search_batch a const Data_t * (nullptr when not found),
+    // both return out past the last write
+    template <typename ForwardIt, typename OutputIt>
+    inline OutputIt contains_batch(ForwardIt first, ForwardIt last, OutputIt out) const;
+    template <typename ForwardIt, typename OutputIt>
+    inline OutputIt search_batch(ForwardIt first, ForwardIt last, OutputIt out) const;
+
+    // returns the smallest (largest) data in O(log n), throws data_not_found in case the tree is empty
+    inline const Data_t &min() const;
+    inline const Data_t &max() const;
+
+    inline const_iterator begin() const { return const_iterator(this, _first_position(__size)); }
+    inline const_iterator end() const { return const_iterator(this, 0); }
+
+  private:
+    // * helper methods
+
+    inline const Data_t &_at(size_t position) const { return __data[position - 1]; }
+
+    // the in-order first position, 0 for an empty tree
+    inline static size_t _first_position(size_t size);
+    // the in-order next position, 0 after the last one
+    inline static size_t _next_position(size_t position, size_t size);
+
+    // the position of the first data not less than key (0 if there is none)
+    template <typename Key>
+    inline size_t _lower_bound_aux(const Key &key) const;
+    // the position of the first data greater than key (0 if there is none)
+    template <typename Key>
+    inline size_t _upper_bound_aux(const Key &key) const;
+    // a descent that fell off the tree at position went right at its trailing 1 bits,
+    // the answer is where it last went left
+    inline static size_t _undo_right_turns(size_t position);
+    inline void _prefetch(size_t position) const;
+
+    enum
+    {
+      __batch_lanes = 16
+    };
+    // calls visit(key, position) for every key in order, position as in _lower_bound_aux
+    template <typename ForwardIt, typename Visit>
+    inline void _lower_bound_batch_aux(ForwardIt first, ForwardIt last, Visit visit) const;
+
+    // allocates and copy constructs size data from first in in-order positions
+    template <typename ForwardIt>
+    void _construct_aux(ForwardIt first, size_t size, bool check_order);
+    // destroys the data in the first count in-order positions
+    void _destroy_aux(size_t count);
+
+    // builds from data already known to be strictly increasing (tree::freeze())
+    struct _sorted_tag
+    {
+    };
+    template <typename ForwardIt>
+    frozen_tree(_sorted_tag, ForwardIt first, size_t size, const less &comp, const allocator_type &alloc)
+        : _compare_holder<less>(comp), __data(nullptr), __size(0), __allocator(alloc)
+    {
+      _construct_aux(first, size, false);
+    }
+
+    friend class const_iterator;
+    template <typename, typename, typename, bool, typename, typename>
+    friend class tree;
+    template <typename>
+    friend struct _mapped_access;
+
+#ifdef AVL_TREE_TEST
+  public:
+    bool _validate() const;
+#endif // AVL_TREE_TEST
   };
 
-  template <typename Data_t, typename less>
-  class avl::tree<Data_t, less>::iterator
+  /**
+   * in-order iterator, holds a position
+   */
+  template <typename Data_t, typename less, typename Alloc>
+  class frozen_tree<Data_t, less, Alloc>::const_iterator
   {
   private:
-    friend class tree; // so avl::tree can access the private members of avl::tree::iterator
-    inline explicit iterator(_Node *root) : current(_get_left_most_node(root)) {}
+    friend class frozen_tree; // so avl::frozen_tree can access the private members of const_iterator
+
+    const frozen_tree *__tree;
+    size_t __position; // 0 for end()
+
+    inline const_iterator(const frozen_tree *tree, size_t position) : __tree(tree), __position(position) {}
 
   public:
-    inline const Data_t &operator*() const { return current->__data; }
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Data_t value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const Data_t *pointer;
+    typedef const Data_t &reference;
 
-    inline const Data_t &operator->() const { return current->__data; }
+    inline const_iterator() : __tree(nullptr), __position(0) {}
 
-    inline iterator &operator++()
+    inline const Data_t &operator*() const { return __tree->_at(__position); }
+
+    inline const Data_t *operator->() const { return &(__tree->_at(__position)); }
+
+    inline const_iterator &operator++()
     {
-      ++current;
+      __position = frozen_tree::_next_position(__position, __tree->__size);
       return *this;
     }
 
-    inline iterator operator++(int)
+    inline const_iterator operator++(int)
     {
-      iterator it = *this;
+      const_iterator it = *this;
       ++(*this);
       return it;
     }
 
-    inline bool operator!=(const iterator &other) const { return current != other.current; }
+    inline bool operator!=(const const_iterator &other) const { return __position != other.__position; }
+    inline bool operator==(const const_iterator &other) const { return __position == other.__position; }
+  };
 
-  private:
-    _iterator current;
-  };
-
-  template <typename Data_t, typename less>
-  class avl::tree<Data_t, less>::const_iterator
+  template <typename Data_t, typename less, typename Alloc>
+  frozen_tree<Data_t, less, Alloc>::frozen_tree() : __data(nullptr), __size(0), __allocator()
   {
-  private:
-    friend class tree; // so avl::tree can access the private members of avl::tree::const_iterator
-    inline explicit const_iterator(_Node *root) : current(_get_left_most_node(root)) {}
+  }
 
-  public:
-    inline const Data_t &operator*() const { return current->__data; }
+  template <typename Data_t, typename less, typename Alloc>
+  frozen_tree<Data_t, less, Alloc>::frozen_tree(const allocator_type &alloc) : __data(nullptr), __size(0), __allocator(alloc)
+  {
+  }
 
-    inline const Data_t &operator->() const { return current->__data; }
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename ForwardIt, typename>
+  frozen_tree<Data_t, less, Alloc>::frozen_tree(ForwardIt first, ForwardIt last, const allocator_type &alloc)
+      : __data(nullptr), __size(0), __allocator(alloc)
+  {
+    _construct_aux(first, static_cast<size_t>(std::distance(first, last)), true);
+  }
 
-    inline const_iterator &operator++()
-    {
-      ++current;
-      return *this;
-    }
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename ForwardIt, typename>
+  frozen_tree<Data_t, less, Alloc>::frozen_tree(ForwardIt first, ForwardIt last, const less &comp, const allocator_type &alloc)
+      : _compare_holder<less>(comp), __data(nullptr), __size(0), __allocator(alloc)
+  {
+    _construct_aux(first, static_cast<size_t>(std::distance(first, last)), true);
+  }
 
-    inline const_iterator operator++(int)
+  template <typename Data_t, typename less, typename Alloc>
+  frozen_tree<Data_t, less, Alloc>::frozen_tree(const frozen_tree &other)
+      : _compare_holder<less>(other.key_comp()), __data(nullptr), __size(0), __allocator(_traits::select_on_container_copy_construction(other.__allocator))
+  {
+    if (other.__storage)
     {
-      iterator it = *this;
-      ++(*this);
-      return it;
+      // the mapped data is read only, so it can be shared
+      __data = other.__data;
+      __size = other.__size;
+      __storage = other.__storage;
+      return;
     }
+    _construct_aux(other.begin(), other.__size, false);
+  }
 
-    inline bool operator!=(const const_iterator &other) const { return current != other.current; }
-
-  private:
-    _const_iterator current;
-  };
-
-  template <typename Data_t, typename less>
-  class avl::tree<Data_t, less>::_iterator
+  template <typename Data_t, typename less, typename Alloc>
+  frozen_tree<Data_t, less, Alloc>::frozen_tree(frozen_tree &&other)
+      : _compare_holder<less>(other.key_comp()), __data(other.__data), __size(other.__size), __allocator(std::move(other.__allocator)),
+        __storage(std::move(other.__storage))
   {
-  private:
-    friend class tree; // so avl::tree can access the private members of avl::tree::_iterator
-    inline explicit _iterator(_Node *root) : current(_get_left_most_node(root)) {}
-
-  public:
-    inline _Node *operator*() const { return current; }
-
-    inline _Node *operator->() const { return current; }
+    other.__data = nullptr;
+    other.__size = 0;
+  }
 
-    inline _iterator &operator++()
+  template <typename Data_t, typename less, typename Alloc>
+  frozen_tree<Data_t, less, Alloc> &frozen_tree<Data_t, less, Alloc>::operator=(const frozen_tree &other)
+  {
+    if (this != &other)
     {
-      if (current->__right)
-      {
-        current = _get_left_most_node(current->__right);
-      }
-      else
-      {
-        _Node *p = current->__parent;
-        while (p && current == p->__right)
-        {
-          current = p;
-          p = p->__parent;
-        }
-        current = p;
-      }
-      return *this;
+      frozen_tree copy(other);
+      *this = std::move(copy);
     }
+    return *this;
+  }
 
-    inline _iterator operator++(int)
+  template <typename Data_t, typename less, typename Alloc>
+  frozen_tree<Data_t, less, Alloc> &frozen_tree<Data_t, less, Alloc>::operator=(frozen_tree &&other)
+  {
+    if (this != &other)
     {
-      _iterator it = *this;
-      ++(*this);
-      return it;
+      _destroy_aux(__size);
+      std::swap(__data, other.__data);
+      std::swap(__size, other.__size);
+      std::swap(__allocator, other.__allocator);
+      std::swap(__storage, other.__storage);
+      this->_set_comp(other.key_comp());
     }
+    return *this;
+  }
 
-    inline bool operator!=(const _iterator &other) const { return current != other.current; }
-
-  private:
-    _Node *current;
-  };
-
-  template <typename Data_t, typename less>
-  class avl::tree<Data_t, less>::_const_iterator
+  template <typename Data_t, typename less, typename Alloc>
+  frozen_tree<Data_t, less, Alloc>::~frozen_tree()
   {
-  private:
-    friend class tree; // so avl::tree can access the private members of avl::tree::_const_iterator
-    inline explicit _const_iterator(_Node *root) : current(_get_left_most_node(root)) {}
-
-  public:
-    inline const _Node *operator*() const { return current; }
-
-    inline const _Node *operator->() const { return current; }
+    _destroy_aux(__size);
+  }
 
-    inline _const_iterator &operator++()
+  template <typename Data_t, typename less, typename Alloc>
+  ssize_t frozen_tree<Data_t, less, Alloc>::height() const
+  {
+    ssize_t height = -1;
+    for (size_t size = __size; size; size >>= 1)
     {
-      if (current->__right)
-      {
-        current = _get_left_most_node(current->__right);
-      }
-      else
-      {
-        _Node *p = current->__parent;
-        while (p && current == p->__right)
-        {
-          current = p;
-          p = p->__parent;
-        }
-        current = p;
-      }
-      return *this;
+      ++height;
     }
+    return height;
+  }
 
-    inline _const_iterator operator++(int)
+  template <typename Data_t, typename less, typename Alloc>
+  const Data_t &frozen_tree<Data_t, less, Alloc>::search(const Data_t &data) const
+  {
+    size_t position = _lower_bound_aux(data);
+    if (position == 0 || key_comp()(data, _at(position)))
     {
-      _const_iterator it = *this;
-      ++(*this);
-      return it;
+      throw data_not_found();
     }
+    return _at(position);
+  }
 
-    inline bool operator!=(const _const_iterator &other) const { return current != other.current; }
-
-  private:
-    _Node *current;
-  };
-
-  template <typename Data_t, typename less>
-  tree<Data_t, less>::tree()
-      : __root(nullptr),
-        __min_element(nullptr),
-        __max_element(nullptr),
-        __size(0)
+  template <typename Data_t, typename less, typename Alloc>
+  bool frozen_tree<Data_t, less, Alloc>::contains(const Data_t &data) const
   {
+    size_t position = _lower_bound_aux(data);
+    return position != 0 && !key_comp()(data, _at(position));
   }
 
-  template <typename Data_t, typename less>
-  tree<Data_t, less>::tree(std::initializer_list<Data_t> list)
-      : __root(nullptr),
-        __min_element(nullptr),
-        __max_element(nullptr),
-        __size(0)
+  template <typename Data_t, typename less, typename Alloc>
+  typename frozen_tree<Data_t, less, Alloc>::const_iterator frozen_tree<Data_t, less, Alloc>::find(const Data_t &data) const
   {
-    // basic implementation, could be better
-    for (const Data_t &data : list)
+    size_t position = _lower_bound_aux(data);
+    if (position == 0 || key_comp()(data, _at(position)))
     {
-      if (_insert_aux(data) == false) // problem in inserting
-      {
-        this->_destroy_tree(&__root); // clear the tree
-        throw bad_input("inserting failed.");
-      }
+      return end();
     }
-    __size = list.size();
-    __min_element = _find_min();
-    __max_element = _find_max();
+    return const_iterator(this, position);
   }
 
-  template <typename Data_t, typename less>
-  tree<Data_t, less>::tree(tree &other)
+  template <typename Data_t, typename less, typename Alloc>
+  typename frozen_tree<Data_t, less, Alloc>::const_iterator frozen_tree<Data_t, less, Alloc>::lower_bound(const Data_t &data) const
   {
-    this->__root = _copy_tree(other->__root);
-
-    this->__size = other->__size;
-    this->__max_element = _find_max(this->__root);
-    this->__min_element = _find_min(this->__root);
+    return const_iterator(this, _lower_bound_aux(data));
   }
 
-  template <typename Data_t, typename less>
-  tree<Data_t, less>::tree(tree &&other)
+  template <typename Data_t, typename less, typename Alloc>
+  typename frozen_tree<Data_t, less, Alloc>::const_iterator frozen_tree<Data_t, less, Alloc>::upper_bound(const Data_t &data) const
   {
-    this->__root = other.__root;
-    other.__root = nullptr;
-
-    this->__size = other.__size;
-    other.__size = 0;
-
-    this->__max_element = other.__max_element;
-    other.__max_element = nullptr;
-
-    this->__min_element = other.__min_element;
-    other.__min_element = nullptr;
+    return const_iterator(this, _upper_bound_aux(data));
   }
 
-  template <typename Data_t, typename less>
-  tree<Data_t, less> &tree<Data_t, less>::operator=(const tree<Data_t, less> &other)
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key, typename>
+  const Data_t &frozen_tree<Data_t, less, Alloc>::search(const Key &key) const
   {
-    if (this != &other)
+    size_t position = _lower_bound_aux(key);
+    if (position == 0 || key_comp()(key, _at(position)))
     {
-      // copy the tree first so in case the copying failed (due to insufficient memory) this object will still be valid
-      _Node *new_root = _copy_tree(other.__root);
-      
-      this->clear();
-
-      this->__root = new_root;
-      this->__size = other.__size;
-      this->__max_element = _find_max(new_root);
-      this->__min_element = _find_min(new_root);
+      throw data_not_found();
     }
-    return *this;
+    return _at(position);
   }
 
-  template <typename Data_t, typename less>
-  tree<Data_t, less> &tree<Data_t, less>::operator=(const tree<Data_t, less> &&other)
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key, typename>
+  bool frozen_tree<Data_t, less, Alloc>::contains(const Key &key) const
   {
-    if (this != &other)
-    {
-      if (this->__root)
-      {
-        _destroy_tree(this->__root);
-      }
-      this->__root = other.__root;
-      this->__size = other.__size;
-      this->__max_element = other.__max_element;
-      this->__min_element = other.__min_element;
-      other.__root = nullptr;
-      other.__size = 0;
-      other.__max_element = nullptr;
-      other.__min_element = nullptr;
-    }
-    return *this;
+    size_t position = _lower_bound_aux(key);
+    return position != 0 && !key_comp()(key, _at(position));
   }
 
-  template <typename Data_t, typename less>
-  tree<Data_t, less>::~tree()
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key, typename>
+  typename frozen_tree<Data_t, less, Alloc>::const_iterator frozen_tree<Data_t, less, Alloc>::find(const Key &key) const
   {
-    _clear_aux();
+    size_t position = _lower_bound_aux(key);
+    if (position == 0 || key_comp()(key, _at(position)))
+    {
+      return end();
+    }
+    return const_iterator(this, position);
   }
 
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::clear()
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key, typename>
+  typename frozen_tree<Data_t, less, Alloc>::const_iterator frozen_tree<Data_t, less, Alloc>::lower_bound(const Key &key) const
   {
-    _clear_aux();
+    return const_iterator(this, _lower_bound_aux(key));
   }
 
-  template <typename Data_t, typename less>
-  size_t tree<Data_t, less>::size() const
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key, typename>
+  typename frozen_tree<Data_t, less, Alloc>::const_iterator frozen_tree<Data_t, less, Alloc>::upper_bound(const Key &key) const
   {
-    return __size;
+    return const_iterator(this, _upper_bound_aux(key));
   }
 
-  template <typename Data_t, typename less>
-  bool tree<Data_t, less>::empty() const
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename ForwardIt, typename OutputIt>
+  OutputIt frozen_tree<Data_t, less, Alloc>::contains_batch(ForwardIt first, ForwardIt last, OutputIt out) const
   {
-#ifdef AVL_TREE_TEST
-    bool empty = __root == nullptr;
-    if (empty)
-    {
-      assert(__size == 0);
-    }
-    else
-    {
-      assert(__size != 0);
-    }
-#endif
-    return __root == nullptr;
+    typedef typename std::iterator_traits<ForwardIt>::value_type key_type;
+    _lower_bound_batch_aux(first, last, [this, &out](const key_type &key, size_t position)
+                           { *out++ = (position != 0 && !key_comp()(key, _at(position))); });
+    return out;
   }
 
-  template <typename Data_t, typename less>
-  inline ssize_t tree<Data_t, less>::height() const
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename ForwardIt, typename OutputIt>
+  OutputIt frozen_tree<Data_t, less, Alloc>::search_batch(ForwardIt first, ForwardIt last, OutputIt out) const
   {
-    return __root ? _get_tree_height_from_children(*__root) : -1;
+    typedef typename std::iterator_traits<ForwardIt>::value_type key_type;
+    _lower_bound_batch_aux(first, last, [this, &out](const key_type &key, size_t position)
+                           { *out++ = (position != 0 && !key_comp()(key, _at(position))) ? &_at(position) : static_cast<const Data_t *>(nullptr); });
+    return out;
   }
 
-  template <typename Data_t, typename less>
-  const Data_t &tree<Data_t, less>::search(const Data_t &data) const
+  template <typename Data_t, typename less, typename Alloc>
+  const Data_t &frozen_tree<Data_t, less, Alloc>::min() const
   {
-    return _search_aux(data);
+    if (__size == 0)
+    {
+      throw data_not_found();
+    }
+    return _at(_first_position(__size));
   }
 
-  template <typename Data_t, typename less>
-  Data_t &tree<Data_t, less>::search(const Data_t &data)
+  template <typename Data_t, typename less, typename Alloc>
+  const Data_t &frozen_tree<Data_t, less, Alloc>::max() const
   {
-    return _search_aux(data);
+    if (__size == 0)
+    {
+      throw data_not_found();
+    }
+    size_t position = 1;
+    while (2 * position + 1 <= __size)
+    {
+      position = 2 * position + 1;
+    }
+    return _at(position);
   }
 
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::insert(const Data_t &data)
+  // * helper methods
+
+  template <typename Data_t, typename less, typename Alloc>
+  size_t frozen_tree<Data_t, less, Alloc>::_first_position(size_t size)
   {
-    if (_insert_aux(data)) // insert successful
+    if (size == 0)
     {
-      __size++;
-      __min_element = _find_min();
-      __max_element = _find_max();
+      return 0;
     }
-    else
+    size_t position = 1;
+    while (2 * position <= size)
     {
-      throw data_already_exists();
+      position *= 2;
     }
+    return position;
   }
 
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::remove(const Data_t &data)
+  template <typename Data_t, typename less, typename Alloc>
+  size_t frozen_tree<Data_t, less, Alloc>::_next_position(size_t position, size_t size)
   {
-    if (_remove_aux(data)) // deletion successful
+    if (2 * position + 1 <= size)
     {
-      __size--;
-      if (this->empty())
-      {
-        __min_element = nullptr;
-        __max_element = nullptr;
-      }
-      else
+      // the left most position of the right sub tree
+      position = 2 * position + 1;
+      while (2 * position <= size)
       {
-        __min_element = _find_min();
-        __max_element = _find_max();
+        position *= 2;
       }
+      return position;
     }
-    else
+    // climb while coming from a right child, then once more
+    return _undo_right_turns(position);
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key>
+  size_t frozen_tree<Data_t, less, Alloc>::_lower_bound_aux(const Key &key) const
+  {
+    size_t position = 1;
+    while (position <= __size)
     {
-      throw data_not_found();
+      _prefetch(16 * position);
+      position = 2 * position + static_cast<size_t>(key_comp()(_at(position), key));
     }
+    return _undo_right_turns(position);
   }
 
-  template <typename Data_t, typename less>
-  tree<Data_t, less> tree<Data_t, less>::unite(const tree<Data_t, less> &t1, const tree<Data_t, less> &t2)
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename Key>
+  size_t frozen_tree<Data_t, less, Alloc>::_upper_bound_aux(const Key &key) const
   {
-    tree<Data_t, less> united_tree;
-
-    size_t size_sum = t1.size() + t2.size();
-    // avoid new[](0) which has undefined behaviour
-    if (size_sum > 0)
+    size_t position = 1;
+    while (position <= __size)
     {
-      // allocate space for pointers to ordered data (in-order)
-      const Data_t **data_ptr = new const Data_t *[size_sum];
+      _prefetch(16 * position);
+      position = 2 * position + static_cast<size_t>(!key_comp()(key, _at(position)));
+    }
+    return _undo_right_turns(position);
+  }
 
-      auto it1 = t1.begin();
-      auto it2 = t2.begin();
-      auto end1 = t1.end();
-      auto end2 = t2.end();
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename ForwardIt, typename Visit>
+  void frozen_tree<Data_t, less, Alloc>::_lower_bound_batch_aux(ForwardIt first, ForwardIt last, Visit visit) const
+  {
+    typedef typename std::iterator_traits<ForwardIt>::value_type key_type;
 
-      size_t index = 0;
+    // every level above the last one is full, so every descent takes a step on each of them
+    size_t full_levels = 0;
+    while ((size_t(2) << full_levels) - 1 <= __size)
+    {
+      ++full_levels;
+    }
 
-      while ((it1 != end1) && (it2 != end2))
+    const key_type *keys[__batch_lanes];
+    size_t positions[__batch_lanes];
+    while (first != last)
+    {
+      size_t count = 0;
+      for (; count < __batch_lanes && first != last; ++first, ++count)
       {
-        if (less()(*it1, *it2)) // *it1 < *it2
-        {
-          data_ptr[index] = &(*it1); // *it1 returns Data_t
-          ++it1;
-        }
-        else if (less()(*it2, *it1)) // *it1 > *it2
-        {
-          data_ptr[index] = &(*it2); // *it2 returns Data_t
-          ++it2;
-        }
-        else // *t1 == *t2
+        keys[count] = std::addressof(*first);
+        positions[count] = 1;
+      }
+
+      // each lane takes a branch free step, then prefetches its next position for the next round
+      for (size_t level = 0; level < full_levels; ++level)
+      {
+        for (size_t lane = 0; lane < count; ++lane)
         {
-          data_ptr[index] = &(*it1); // *it1 returns Data_t
-          ++it1;
-          ++it2; // duplicates will be copied 1 time only
+          size_t position = positions[lane];
+          position = 2 * position + static_cast<size_t>(key_comp()(_at(position), *keys[lane]));
+          _prefetch(position);
+          positions[lane] = position;
         }
-        ++index;
       }
-
-      while (it1 != end1)
+      // the last level isn't full
+      for (size_t lane = 0; lane < count; ++lane)
       {
-        data_ptr[index] = &(*it1); // *it1 returns Data_t
-        ++it1;
-        ++index;
+        size_t position = positions[lane];
+        if (position <= __size)
+        {
+          positions[lane] = 2 * position + static_cast<size_t>(key_comp()(_at(position), *keys[lane]));
+        }
       }
 
-      while (it2 != end2)
+      for (size_t lane = 0; lane < count; ++lane)
       {
-        data_ptr[index] = &(*it2); // *it1 returns Data_t
-        ++it2;
-        ++index;
+        visit(*keys[lane], _undo_right_turns(positions[lane]));
       }
-
-      // data_ptr now holds pointers to the ordered data in both trees
-      // index is the amount of (non-duplicates) data in the *new* tree, index > 0 guaranteed
-
-      // we now need to build an almost complete binary tree using the array method
-      // an almost complete binary (search) tree is considered an AVL tree since it abides by it's rules
-      united_tree.set_root(tree::_create_almost_full_tree(data_ptr, index));
-      united_tree.set_size(index);
-      united_tree.set_max_element(united_tree._find_max());
-      united_tree.set_min_element(united_tree._find_min());
-
-      delete[] data_ptr;
     }
-    return united_tree;
   }
 
-  template <typename Data_t, typename less>
-  tree<Data_t, less> tree<Data_t, less>::unite(tree<Data_t, less> &&t1, tree<Data_t, less> &&t2)
+  template <typename Data_t, typename less, typename Alloc>
+  size_t frozen_tree<Data_t, less, Alloc>::_undo_right_turns(size_t position)
   {
-    tree<Data_t, less> united_tree;
-
-    size_t size_sum = t1.size() + t2.size();
-    // avoid new[](0) which has undefined behaviour
-    if (size_sum > 0)
+#if defined(__GNUC__)
+    return position >> (__builtin_ctzll(~static_cast<unsigned long long>(position)) + 1);
+#else
+    while (position & 1)
     {
-      // allocate space for pointers to ordered data (in-order)
-      typename tree<Data_t, less>::_Node **node_ptr = new typename tree<Data_t, less>::_Node *[size_sum];
-
-      auto it1 = t1._begin();
-      auto it2 = t2._begin();
-      auto end1 = t1._end();
-      auto end2 = t2._end();
+      position >>= 1;
+    }
+    return position >> 1;
+#endif
+  }
 
-      size_t index = 0;
+  template <typename Data_t, typename less, typename Alloc>
+  void frozen_tree<Data_t, less, Alloc>::_prefetch(size_t position) const
+  {
+    if (position <= __size)
+    {
+      _prefetch_read(__data + (position - 1));
+    }
+  }
 
-      while ((it1 != end1) && (it2 != end2))
-      {
-        if (less()((*it1)->get_data(), (*it2)->get_data())) // *it1 < *it2
+  template <typename Data_t, typename less, typename Alloc>
+  template <typename ForwardIt>
+  void frozen_tree<Data_t, less, Alloc>::_construct_aux(ForwardIt first, size_t size, bool check_order)
+  {
+    if (size == 0)
+    {
+      return;
+    }
+    __data = _traits::allocate(__allocator, size);
+    __size = size;
+    size_t count = 0;
+    try
+    {
+      const Data_t *prev = nullptr;
+      for (size_t position = _first_position(size); position; position = _next_position(position, size), ++first)
+      {
+        Data_t *data = __data + (position - 1);
+        _traits::construct(__allocator, data, *first);
+        ++count;
+        if (check_order && prev && !key_comp()(*prev, *data))
+        {
+          throw bad_input("freezing failed.");
+        }
+        prev = data;
+      }
+    }
+    catch (...)
+    {
+      _destroy_aux(count);
+      throw;
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc>
+  void frozen_tree<Data_t, less, Alloc>::_destroy_aux(size_t count)
+  {
+    if (__data == nullptr)
+    {
+      return;
+    }
+    if (__storage)
+    {
+      // mapped, the data belongs to the file
+      __storage.reset();
+      __data = nullptr;
+      __size = 0;
+      return;
+    }
+    if (!std::is_trivially_destructible<Data_t>::value)
+    {
+      for (size_t position = _first_position(__size); count; position = _next_position(position, __size), --count)
+      {
+        _traits::destroy(__allocator, __data + (position - 1));
+      }
+    }
+    _traits::deallocate(__allocator, __data, __size);
+    __data = nullptr;
+    __size = 0;
+  }
+
+#ifdef AVL_TREE_TEST
+
+  template <typename Data_t, typename less, typename Alloc>
+  bool frozen_tree<Data_t, less, Alloc>::_validate() const
+  {
+    size_t count = 0;
+    const Data_t *prev = nullptr;
+    for (const_iterator it = begin(); it != end(); ++it, ++count)
+    {
+      assert(!prev || key_comp()(*prev, *it));
+      prev = &*it;
+    }
+    assert(count == __size);
+    return true;
+  }
+
+#endif // AVL_TREE_TEST
+
+  /**
+   * Ranked - when true every node also keeps the size of its sub tree,
+   * which enables rank(), select() and count_range() in O(log n)
+   * Augment - a policy for keeping a monoid per sub tree (see above),
+   * which enables fold_range() and (for interval policies) stab() in O(log n)
+   * Stats - a policy for counting what the hot paths do (see above), read with stats()
+   */
+  template <typename Data_t, typename less = def_less<Data_t>, typename Alloc = std::allocator<Data_t>, bool Ranked = false, typename Augment = no_augment, typename Stats = no_stats>
+  class tree : private _stats_counter<Stats>, private _compare_holder<less>
+  {
+  public:
+    typedef Data_t value_type;
+    typedef less key_compare;
+    typedef Alloc allocator_type;
+    typedef typename _augment_traits<Augment>::value_type augment_type;
+    typedef Stats stats_type;
+    class iterator;
+    class const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+    class cursor;
+
+  private:
+    class _Node;
+    class _node_pool;
+    class _iterator;
+    class _const_iterator;
+
+    // tag for building an iterator that points exactly at a node (instead of the left most node under it)
+    struct _at_node_tag
+    {
+    };
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<_Node> _node_allocator;
+
+    _Node *__root;
+    _Node *__min_element;
+    _Node *__max_element;
+    size_t __size;
+    allocator_type __allocator;
+    std::shared_ptr<_node_pool> __pool; // created on the first allocation, kept alive by trees that took some of its nodes
+
+    inline void set_root(_Node *new_root) { __root = new_root; }
+    inline void set_size(size_t new_size) { __size = new_size; }
+    inline void set_max_element(_Node *new_max) { __max_element = new_max; }
+    inline void set_min_element(_Node *new_min) { __min_element = new_min; }
+
+  public:
+    tree();                                                                                      // c'tor
+    explicit tree(const allocator_type &alloc);                                                  // allocator c'tor
+    explicit tree(const less &comp, const allocator_type &alloc = allocator_type());            // comparator c'tor
+    tree(std::initializer_list<Data_t> list, const allocator_type &alloc = allocator_type()); // list c'tor
+    template <typename InputIt, typename = typename std::enable_if<!std::is_integral<InputIt>::value>::type>
+    tree(InputIt first, InputIt last, const allocator_type &alloc = allocator_type()); // range c'tor, O(n) for sorted forward ranges
+    template <typename InputIt, typename = typename std::enable_if<!std::is_integral<InputIt>::value>::type>
+    tree(InputIt first, InputIt last, const less &comp, const allocator_type &alloc = allocator_type()); // range c'tor, ordered by comp
+    tree(const tree &other);                                                                     // copy c'tor
+    tree(tree &&other);                                                                          // move c'tor
+    tree &operator=(const tree &other);                                                          // copy assignment operator
+    tree &operator=(tree &&other);                                                               // move assignment operator
+    ~tree();                                                                                     // d'tor
+
+    // builds the tree from strictly increasing data in O(n) with no rotations, the order is trusted (not checked)
+    template <typename ForwardIt>
+    static tree from_sorted(ForwardIt first, ForwardIt last, const allocator_type &alloc = allocator_type());
+    // same, ordered by comp
+    template <typename ForwardIt>
+    static tree from_sorted(ForwardIt first, ForwardIt last, const less &comp, const allocator_type &alloc = allocator_type());
+    // same, the halves of big ranges are built in parallel
+    template <typename RandomIt>
+    static tree from_sorted(const parallel_policy &policy, RandomIt first, RandomIt last, const allocator_type &alloc = allocator_type());
+    template <typename RandomIt>
+    static tree from_sorted(const parallel_policy &policy, RandomIt first, RandomIt last, const less &comp, const allocator_type &alloc = allocator_type());
+    // same, from the first size data of a single pass range (read in order exactly once, so it can be streamed in)
+    template <typename InputIt>
+    static tree from_sorted_n(InputIt first, size_t size, const allocator_type &alloc = allocator_type());
+    // same, ordered by comp
+    template <typename InputIt>
+    static tree from_sorted_n(InputIt first, size_t size, const less &comp, const allocator_type &alloc = allocator_type());
+
+    // returns a copy of the allocator the nodes are allocated with
+    allocator_type get_allocator() const { return __allocator; }
+    // returns the comparator the data is ordered by, copies and the results of set operations keep it
+    inline const less &key_comp() const { return this->_get_comp(); }
+
+    // the counters of the Stats policy, a copy of the tree starts from zero, a moved tree takes them along
+    // (a move assignment keeps the counters of the tree assigned to)
+    inline const Stats &stats() const { return this->_get_stats(); }
+    inline void reset_stats() { this->_reset_stats(); }
+
+    // empty out the tree, drops the whole node pool at once when possible
+    void clear();
+    // returns the size of the tree
+    inline size_t size() const;
+    // return true if the tree doesn't have any elements
+    inline bool empty() const;
+    // return the tree's height
+    inline ssize_t height() const;
+
+    // returns a const reference to the data, throws data_not_found in case data not found
+    inline const Data_t &search(const Data_t &data) const;
+    // returns a reference to the data, use with caution, only implemented for flexibility
+    inline Data_t &search(const Data_t &data);
+    // returns true if the data is in the tree
+    inline bool contains(const Data_t &data) const;
+
+    // batched lookup, the descents of up to 16 keys advance level by level together so their cache misses overlap,
+    // for frozen trees see frozen_tree::contains_batch.
+    // contains_batch writes a bool per key to out, search_batch a const Data_t * (nullptr when not found),
+    // both return out past the last write
+    template <typename ForwardIt, typename OutputIt>
+    inline OutputIt contains_batch(ForwardIt first, ForwardIt last, OutputIt out) const;
+    template <typename ForwardIt, typename OutputIt>
+    inline OutputIt search_batch(ForwardIt first, ForwardIt last, OutputIt out) const;
+
+    // returns the smallest (largest) data in O(1), throws data_not_found in case the tree is empty
+    inline const Data_t &min() const;
+    inline const Data_t &max() const;
+    // removes the smallest (largest) data and returns it, throws data_not_found in case the tree is empty
+    inline Data_t pop_min();
+    inline Data_t pop_max();
+
+    // heterogeneous lookup, only available when less::is_transparent is defined
+    // same as the above but compares key against the stored data directly
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline const Data_t &search(const Key &key) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline Data_t &search(const Key &key);
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline bool contains(const Key &key) const;
+
+    // non throwing lookup, returns an iterator to the data or end() in case data not found
+    inline iterator find(const Data_t &data);
+    inline const_iterator find(const Data_t &data) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline iterator find(const Key &key);
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline const_iterator find(const Key &key) const;
+
+    // bounded iteration, every bound is found with a single descent in O(log n)
+
+    // returns an iterator to the first data not less than data, end() if there is none
+    inline iterator lower_bound(const Data_t &data);
+    inline const_iterator lower_bound(const Data_t &data) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline iterator lower_bound(const Key &key);
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline const_iterator lower_bound(const Key &key) const;
+    // returns an iterator to the first data greater than data, end() if there is none
+    inline iterator upper_bound(const Data_t &data);
+    inline const_iterator upper_bound(const Data_t &data) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline iterator upper_bound(const Key &key);
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline const_iterator upper_bound(const Key &key) const;
+    // returns {lower_bound(data), upper_bound(data)}
+    inline std::pair<iterator, iterator> equal_range(const Data_t &data);
+    inline std::pair<const_iterator, const_iterator> equal_range(const Data_t &data) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline std::pair<iterator, iterator> equal_range(const Key &key);
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline std::pair<const_iterator, const_iterator> equal_range(const Key &key) const;
+    // returns a view of the data in the range [lo, hi), to be used in a range based for loop
+    inline range_view<iterator> range(const Data_t &lo, const Data_t &hi);
+    inline range_view<const_iterator> range(const Data_t &lo, const Data_t &hi) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline range_view<iterator> range(const Key &lo, const Key &hi);
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline range_view<const_iterator> range(const Key &lo, const Key &hi) const;
+
+    // inserts the data, throws data_already_exists in case data is already in
+    inline void insert(const Data_t &data);
+    // inserts the data by moving it in, throws data_already_exists in case data is already in (data is left untouched then)
+    inline void insert(Data_t &&data);
+    // non throwing insert, returns an iterator to the data in the tree and true if it was inserted,
+    // or an iterator to the equal data already in the tree and false.
+    // use as: tree.insert(data, std::nothrow)
+    inline std::pair<iterator, bool> insert(const Data_t &data, const std::nothrow_t &);
+    inline std::pair<iterator, bool> insert(Data_t &&data, const std::nothrow_t &);
+    // hinted insert, the data is expected to go right before hint, which takes O(1) amortized comparisons when it does.
+    // never throws data_already_exists, returns an iterator to the data in the tree (or to the equal data already in)
+    inline iterator insert(const_iterator hint, const Data_t &data);
+    inline iterator insert(const_iterator hint, Data_t &&data);
+    template <typename... Args>
+    inline iterator emplace_hint(const_iterator hint, Args &&...args);
+    // constructs the data in place from args, throws data_already_exists in case an equal data is already in
+    template <typename... Args>
+    inline void emplace(Args &&...args);
+    // constructs the data in place from args only if key isn't in the tree, never throws data_already_exists.
+    // returns the same as the non throwing insert, the constructed data must be equal to key
+    template <typename... Args>
+    inline std::pair<iterator, bool> try_emplace(const Data_t &key, Args &&...args);
+    template <typename Key, typename... Args, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline std::pair<iterator, bool> try_emplace(const Key &key, Args &&...args);
+    // removes the data, throws data_not_found in case data not found
+    inline void remove(const Data_t &data);
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline void remove(const Key &key);
+    // non throwing remove, returns the amount of data removed (0 or 1)
+    inline size_t erase(const Data_t &data);
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline size_t erase(const Key &key);
+    // removes the data pos points to (pos must not be end()) without searching for it,
+    // returns an iterator to the data after it. other iterators stay valid
+    inline iterator erase(const_iterator pos);
+    inline iterator erase(iterator pos);
+
+    // -*- order statistics, only available when Ranked -*- //
+
+    // returns the amount of data smaller than data (its index in case it's in the tree), in O(log n)
+    inline size_t rank(const Data_t &data) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline size_t rank(const Key &key) const;
+    // returns the k-th smallest data (0 based) in O(log n), throws bad_input in case k >= size()
+    inline const Data_t &select(size_t k) const;
+    // returns the amount of data in the range [lo, hi) in O(log n)
+    inline size_t count_range(const Data_t &lo, const Data_t &hi) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline size_t count_range(const Key &lo, const Key &hi) const;
+
+    // -*- augmented queries, only available with an Augment policy -*- //
+
+    // returns the fold of all the data in the tree in O(1)
+    inline augment_type fold() const;
+    // returns the in-order fold of the data in the range [lo, hi) in O(log n)
+    inline augment_type fold_range(const Data_t &lo, const Data_t &hi) const;
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline augment_type fold_range(const Key &lo, const Key &hi) const;
+    // writes every interval that contains point to out (in order) in O((k + 1) log n), k being the amount written,
+    // requires an interval policy
+    template <typename Point, typename OutputIt>
+    inline OutputIt stab(const Point &point, OutputIt out) const;
+
+    // -*- join based operations -*- //
+
+    // joins t1, data and t2 into 1 tree in O(|h1 - h2| + 1), every data in t1 must be less than data
+    // and data less than every data in t2 (throws bad_input otherwise), t1 and t2 are left empty
+    inline static tree join(tree &&t1, const Data_t &data, tree &&t2);
+    inline static tree join(tree &&t1, Data_t &&data, tree &&t2);
+    // moves the data not less than key into the returned tree, the data less than key stays.
+    // O(log n) when Ranked, otherwise the sizes are recounted in O(log n + min(k, n - k)).
+    // the 2 trees share no state afterwards, each can be changed on a thread of its own
+    inline tree split(const Data_t &key);
+    template <typename Key, typename = typename std::enable_if<_is_transparent<less>::value, Key>::type>
+    inline tree split(const Key &key);
+
+    // -*- set operations -*- //
+    // the const versions copy the data in linear time. the rvalue versions reuse the nodes of both trees
+    // (left empty), they run in O(m log(n/m + 1)) for sizes m <= n and fall back to the linear merge when
+    // the sizes are close. data found in both trees is taken from t1
+
+    // the policy versions split the work between threads: the const ones build the result in parallel,
+    // the rvalue ones always use the join based algorithm and handle the sub trees in parallel
+
+    // unites 2 trees into 1
+    inline static tree unite(const tree &t1, const tree &t2);
+    inline static tree unite(tree &&t1, tree &&t2);
+    inline static tree unite(const parallel_policy &policy, const tree &t1, const tree &t2);
+    inline static tree unite(const parallel_policy &policy, tree &&t1, tree &&t2);
+    // the data found in both trees
+    inline static tree intersect(const tree &t1, const tree &t2);
+    inline static tree intersect(tree &&t1, tree &&t2);
+    inline static tree intersect(const parallel_policy &policy, const tree &t1, const tree &t2);
+    inline static tree intersect(const parallel_policy &policy, tree &&t1, tree &&t2);
+    // the data of t1 not found in t2
+    inline static tree difference(const tree &t1, const tree &t2);
+    inline static tree difference(tree &&t1, tree &&t2);
+    inline static tree difference(const parallel_policy &policy, const tree &t1, const tree &t2);
+    inline static tree difference(const parallel_policy &policy, tree &&t1, tree &&t2);
+    // the data found in exactly 1 of the trees
+    inline static tree symmetric_difference(const tree &t1, const tree &t2);
+    inline static tree symmetric_difference(tree &&t1, tree &&t2);
+    inline static tree symmetric_difference(const parallel_policy &policy, const tree &t1, const tree &t2);
+    inline static tree symmetric_difference(const parallel_policy &policy, tree &&t1, tree &&t2);
+
+    // -*- batched updates -*- //
+    // the batch is sorted and built into a tree in O(k log k), then merged in with the rvalue set operations
+    // (O(k log(n/k + 1)) for small batches), instead of k walks to the root.
+    // they don't give the strong guarantee: if the comparator throws while the batch is sorted or built the tree
+    // is unchanged, if it throws while the batch is merged in the tree is left empty (its nodes are destroyed)
+
+    // inserts the data not already in, the first of equal data in the batch wins. returns the amount inserted
+    template <typename InputIt>
+    size_t insert_batch(InputIt first, InputIt last);
+    // removes the data found in the batch, returns the amount removed
+    template <typename InputIt>
+    size_t remove_batch(InputIt first, InputIt last);
+    // applies a batch of std::pair<Data_t, bool>, true to insert the data and false to remove it.
+    // the last operation on equal data wins, an insert of data already in keeps the old data
+    template <typename InputIt>
+    void apply(InputIt first, InputIt last);
+    // removes every data pred(data) is true for in 1 linear pass, the kept nodes are relinked into an almost full tree
+    // (no allocation, no rotations). returns the amount removed
+    template <typename Pred>
+    size_t erase_if(Pred pred);
+
+    // -*- read only copy -*- //
+
+    // copies the data into a frozen_tree (a pointer free array in Eytzinger order) in O(n),
+    // for trees that are built once and then only searched
+    inline frozen_tree<Data_t, less, Alloc> freeze() const;
+
+    // iterator, bidirectional: --end() is the max element
+    iterator begin() { return iterator(this, __min_element); }
+    iterator end() { return iterator(this, nullptr); }
+
+    // const iterator
+    const_iterator begin() const { return const_iterator(this, __min_element); }
+    const_iterator end() const { return const_iterator(this, nullptr); }
+
+    // reverse iterators, from the max element down
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+    // a cursor that copies the data out in order, many at a time (see cursor::drain)
+    cursor scan() const { return cursor(__min_element); }
+    // the same, starting at from
+    cursor scan(const_iterator from) const { return cursor(*from.current); }
+
+  private:
+    // private iterator
+    _iterator _begin() { return _iterator(_at_node_tag(), __min_element); }
+    _iterator _end() { return _iterator(nullptr); }
+    // private const iterator
+    _const_iterator _begin() const { return _const_iterator(_at_node_tag(), __min_element); }
+    _const_iterator _end() const { return _const_iterator(nullptr); }
+
+    // * helper methods
+
+    // -*- general tree helper methods -*- //
+
+    // returns the node holding the data and true if it was just inserted.
+    // the search starts at hint (nullptr stands for end(), which appends in O(1) when data is greater than the max)
+    template <typename T>
+    std::pair<_Node *, bool> _insert_aux(_Node *hint, T &&data);
+    std::pair<_Node *, bool> _insert_node_aux(_Node *hint, _Node *node);
+    void _link_node_aux(_Node *parent_ptr, _Node **node_pptr, _Node *node);
+    template <typename Key>
+    void _remove_or_throw(const Key &key);
+    template <typename Key>
+    bool _remove_aux(const Key &key);
+    // removes (and destroys) the node *data_pptr points to
+    void _unlink_node_aux(_Node *parent_ptr, _Node **data_pptr);
+    template <bool Max>
+    Data_t _pop_aux();
+    void _clear_aux();
+
+    // -*- node allocation helper methods -*- //
+
+    _node_pool &_get_pool();
+    template <typename... Args>
+    _Node *_create_node(Args &&...args);
+    void _destroy_node(_Node *node);
+    void _adopt_pool(tree &other);
+
+    // Key is Data_t or, when less is transparent, anything less can compare against Data_t
+    template <typename Key>
+    std::pair<_Node *, _Node **> _search_place_aux(const Key &key);
+    template <typename Key>
+    std::pair<const _Node *, const _Node *const *> _search_place_aux(const Key &key) const;
+    // same as _search_place_aux, but first tries the place right before hint (nullptr for end()) with O(1) comparisons
+    template <typename Key>
+    std::pair<_Node *, _Node **> _search_place_hint_aux(_Node *hint, const Key &key);
+    template <typename Key>
+    const _Node *_search_aux(const Key &key) const;
+    template <typename Key>
+    _Node *_search_aux(const Key &key);
+    enum
+    {
+      __batch_lanes = 16
+    };
+    // calls visit(key, node) for every key in order, node is nullptr for keys not found
+    template <typename ForwardIt, typename Visit>
+    inline void _search_batch_aux(ForwardIt first, ForwardIt last, Visit visit) const;
+    template <typename Key, typename... Args>
+    std::pair<iterator, bool> _try_emplace_aux(const Key &key, Args &&...args);
+    template <typename Key>
+    size_t _rank_aux(const Key &key) const;
+    // the first node with data not less than key, nullptr if there is none
+    template <typename Key>
+    _Node *_lower_bound_aux(const Key &key) const;
+    // the first node with data greater than key, nullptr if there is none
+    template <typename Key>
+    _Node *_upper_bound_aux(const Key &key) const;
+    template <typename Key>
+    augment_type _fold_range_aux(const Key &lo, const Key &hi) const;
+    template <typename Point, typename OutputIt>
+    OutputIt _stab_aux(const Point &point, OutputIt out) const;
+
+    // -*- join based helper methods -*- //
+    // they work on detached sub trees (the root has no parent) and return the root of the resulting sub tree
+
+    // which data a set operation keeps
+    enum _set_op : unsigned
+    {
+      __keep_first = 1,  // found only in t1
+      __keep_second = 2, // found only in t2
+      __keep_both = 4,   // found in both (taken from t1)
+      __unite = __keep_first | __keep_second | __keep_both,
+      __intersect = __keep_both,
+      __difference = __keep_first,
+      __symmetric_difference = __keep_first | __keep_second
+    };
+    // what the recursive set operation needs to know on the way down
+    struct _set_op_context
+    {
+      unsigned op;
+      int cutoff_height;            // sub trees lower than this stay on the current thread
+      bool concurrent;              // other threads may use the pool, so nothing is destroyed until the end
+      size_t destroyed;             // the amount of nodes that were dropped
+      std::vector<_Node *> dropped; // detached sub trees waiting to be destroyed (when concurrent)
+      _Node *garbage;               // detached sub trees left behind by an exception (or a failed push to dropped)
+    };
+    // the linear merge, the result is built on up to threads threads
+    static tree _set_op_copy_aux(const tree &t1, const tree &t2, unsigned op, unsigned threads = 1, size_t cutoff = 1);
+    // the linear merge that reuses the nodes, needs no extra memory
+    static tree _set_op_move_aux(tree &t1, tree &t2, unsigned op);
+    // the join based algorithm, the sub trees are handled on up to threads threads
+    static tree _set_op_join_tree_aux(tree &t1, tree &t2, unsigned op, unsigned threads = 1, size_t cutoff = 1);
+    // true when the join based algorithm is expected to beat the linear merge
+    inline static bool _prefer_join_aux(size_t size1, size_t size2);
+    // sorts the batch, drops all but the first of equal data and builds a tree from it
+    tree _sorted_batch_aux(std::vector<Data_t, Alloc> &batch) const;
+    // moves the result of an operation on this tree into it, the work counted by the result is added to ours
+    inline void _assign_result_aux(tree &&result);
+    // splits t2 around the root of t1 and recurses on both sides
+    _Node *_set_op_join_aux(_Node *t1, _Node *t2, _set_op_context &context, unsigned threads);
+    // destroys the detached sub tree, or keeps it for later when other threads are running.
+    // if keeping it throws, it's left in the context's garbage
+    void _drop_aux(_Node *root, _set_op_context &context);
+    // hangs the detached sub tree under the left most node of garbage, only the child links of the result are valid
+    inline static void _hang_aux(_Node *&garbage, _Node *root);
+    // returns node and sets it to nullptr, for handing a sub tree over to a call that owns it from then on
+    inline static _Node *_take_aux(_Node *&node);
+    // node must be detached, everything in left < node < everything in right.
+    // members only so the rotations are counted by the Stats policy
+    inline _Node *_join_aux(_Node *left, _Node *node, _Node *right) const;
+    inline _Node *_join_right_aux(_Node *left, _Node *node, _Node *right) const;
+    inline _Node *_join_left_aux(_Node *left, _Node *node, _Node *right) const;
+    // everything in left < everything in right
+    inline _Node *_join2_aux(_Node *left, _Node *right) const;
+    // detaches the max of root into last, returns the rest
+    inline _Node *_split_last_aux(_Node *root, _Node *&last) const;
+    // splits root into the data less than key and the data greater than key, returns the detached node equal to key (or nullptr).
+    // the comparisons all come before the first join, so if the comparator throws root is still whole through its child links
+    template <typename Key>
+    _Node *_split_aux(_Node *root, const Key &key, _Node *&left, _Node *&right) const;
+    template <typename Key>
+    tree _split_tree_aux(const Key &key);
+    template <typename T>
+    static tree _join_tree_aux(tree &t1, T &&data, tree &t2);
+    // the amount of nodes in left, when the 2 trees hold size nodes together
+    inline static size_t _get_split_size_aux(_Node *left, _Node *right, size_t size, std::true_type);
+    inline static size_t _get_split_size_aux(_Node *left, _Node *right, size_t size, std::false_type);
+    // sets the children of node and updates it
+    inline static _Node *_make_node_aux(_Node *left, _Node *node, _Node *right);
+    inline static void _set_left_aux(_Node *node, _Node *left);
+    inline static void _set_right_aux(_Node *node, _Node *right);
+    inline static _Node *_rotate_left_aux(_Node *node);
+    inline static _Node *_rotate_right_aux(_Node *node);
+    // -1 for nullptr
+    inline static int _get_height(const _Node *node);
+    // forgets the nodes without destroying them, they belong to another tree now
+    inline void _release_aux();
+
+    // the iterative versions use no stack (the copy and the walkers climb back up with the parent pointers)
+    size_t _destroy_tree_iter(_Node **root);
+    size_t _destroy_tree_rec(_Node **root);
+    inline size_t _destroy_tree(_Node **root) { return _destroy_tree_iter(root); }
+
+    _Node *_copy_tree_iter(_Node *root);
+    _Node *_copy_tree_rec(_Node *root);
+    inline _Node *_copy_tree(_Node *root) { return _copy_tree_iter(root); }
+
+    ssize_t _get_tree_height_iter(_Node &node) const;
+    ssize_t _get_tree_height_rec(_Node *node) const;
+    ssize_t _get_tree_height(_Node &node) const { return _get_tree_height_iter(node); }
+
+    ssize_t _get_tree_size_iter(_Node *node) const;
+    ssize_t _get_tree_size_rec(_Node *node) const;
+    ssize_t _get_tree_size(_Node *node) const { return _get_tree_size_iter(node); }
+
+    // calls visit(node, depth) on every node of the sub tree in pre-order, without recursion
+    template <typename Visit>
+    static void _walk_tree_iter(const _Node *root, Visit visit);
+
+    inline static _Node *_get_left_most_node(_Node *node);
+    inline static _Node *_get_right_most_node(_Node *node);
+    // in-order neighbours, nullptr if there is none
+    inline static _Node *_get_next_node(_Node *node);
+    inline static _Node *_get_prev_node(_Node *node);
+
+    inline _Node **_get_node_pptr(_Node *node_ptr);
+    // the comparator, counted by the Stats policy
+    template <typename Lhs, typename Rhs>
+    inline bool _less(const Lhs &lhs, const Rhs &rhs) const
+    {
+      this->_count_comparison();
+      return key_comp()(lhs, rhs);
+    }
+
+    inline _Node *_create_almost_full_tree(const Data_t **data_ptr, size_t size);
+    // flattens a detached sub tree into an in-order list linked by __right (right rotations, no extra memory)
+    inline static _Node *_tree_to_list_aux(_Node *root);
+    // builds from the first size nodes of a list linked by __right, list is advanced past them.
+    // iterative, the pending nodes are kept on a stack of O(log n) entries
+    inline static _Node *_create_almost_full_tree_from_list(_Node *&list, size_t size);
+    // makes the size nodes of list (in order, through __right) the whole tree
+    void _rebuild_from_list_aux(_Node *list, size_t size);
+    // builds from the next size (sorted) data of the sequence, it is advanced past them
+    template <typename ForwardIt>
+    _Node *_create_almost_full_tree_from_sequence(ForwardIt &it, size_t size);
+    // the size of the left sub tree of the root of an almost full tree with size nodes
+    inline static size_t _get_almost_full_left_size(size_t size);
+
+    template <typename InputIt>
+    void _construct_aux(InputIt first, InputIt last, std::input_iterator_tag);
+    template <typename ForwardIt>
+    void _construct_aux(ForwardIt first, ForwardIt last, std::forward_iterator_tag);
+    template <typename ForwardIt>
+    void _construct_from_sorted_aux(ForwardIt first, size_t size);
+
+    // builds the left halves of big ranges on new threads, each with its own pool (adopted when done)
+    template <typename RandomIt>
+    _Node *_create_almost_full_tree_parallel(RandomIt first, size_t size, unsigned threads, size_t cutoff);
+    // walks an array of pointers to data as if it was the data itself
+    struct _indirect_iterator
+    {
+      const Data_t **__ptr;
+
+      const Data_t &operator*() const { return **__ptr; }
+      _indirect_iterator &operator++()
+      {
+        ++__ptr;
+        return *this;
+      }
+      _indirect_iterator operator+(size_t n) const { return _indirect_iterator{__ptr + n}; }
+    };
+
+#ifdef AVL_TREE_TEST
+  public:
+    void _print_tree() const;
+    void _print_tree_aux(_Node *root, size_t indentation) const;
+
+  private:
+#endif // AVL_TREE_TEST
+
+    // -*- tree with specifications - helper methods -*- //
+
+    // requires a height field
+    inline static size_t _get_tree_height_from_children(_Node &node);
+    // recomputes what a node keeps about its sub tree (height, and size when Ranked) from its children
+    inline static void _update_node(_Node &node);
+    inline static void _update_count(_Node &node, std::true_type);
+    inline static void _update_count(_Node &, std::false_type) {}
+    inline static void _update_augment(_Node &node, std::true_type);
+    inline static void _update_augment(_Node &, std::false_type) {}
+    // requires an Augment policy, the identity for nullptr
+    inline static augment_type _get_augment(const _Node *node);
+    // requires a count field (Ranked), 0 for nullptr
+    inline static size_t _get_count(const _Node *node);
+    // requires a *min field
+    _Node *_find_min() const;
+    // requires a *max field
+    _Node *_find_max() const;
+
+    // -*- AVL specific - helper methods -*- //
+
+    inline ssize_t _get_balance_factor(_Node *node) const;
+    // updates and rebalances the nodes from node up, until a sub tree is as high as it was before
+    inline void _balance_to_root(_Node **node);
+    inline void _rotate_right(_Node **node);
+    inline void _rotate_left(_Node **node);
+    inline void _rotate_LL(_Node **node);
+    inline void _rotate_LR(_Node **node);
+    inline void _rotate_RL(_Node **node);
+    inline void _rotate_RR(_Node **node);
+
+#ifdef AVL_TREE_TEST
+  public:
+    bool _validate() const;
+    void _validate_aux(_Node *root) const;
+    void _validate_count(_Node *root, std::true_type) const;
+    void _validate_count(_Node *, std::false_type) const {}
+    void _validate_augment(_Node *root, std::true_type) const;
+    void _validate_augment(_Node *, std::false_type) const {}
+    void _validate_min_element() const;
+    _Node *_validate_min_element_aux(_Node *node) const;
+    void _validate_max_element() const;
+    _Node *_validate_max_element_aux(_Node *node) const;
+    void _validate_data_order() const;
+    void _validate_data_order_aux(_Node *node) const;
+
+  private:
+#endif // AVL_TREE_TEST
+  };
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  class avl::tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node : public _node_count<Ranked>, public _node_augment<Augment>
+  {
+  private:
+    friend class tree;            // so avl::tree can access the private members of avl::tree::_Node
+    friend class _iterator;       // so avl::tree::_iterator can access the private members of avl::tree::_Node
+    friend class _const_iterator; // so avl::tree::_const_iterator can access the private members of avl::tree::_Node
+    friend class cursor;          // so avl::tree::cursor can access the private members of avl::tree::_Node
+
+    Data_t __data;
+    int __height;
+    _Node *__parent, *__left, *__right;
+
+    // the data is constructed in place from args
+    template <typename... Args>
+    explicit _Node(Args &&...args)
+        : __data(std::forward<Args>(args)...),
+          __height(0),
+          __parent(nullptr),
+          __left(nullptr),
+          __right(nullptr) {}
+
+    Data_t &get_data() { return __data; }
+    const Data_t &get_data() const { return __data; }
+  };
+
+  /**
+   * slab allocator for the nodes of the tree.
+   * nodes are handed out from big chunks allocated with the tree's allocator,
+   * freed nodes go to a free list and are reused before a new chunk is touched.
+   * destroying the pool releases all of its chunks in O(chunks) time.
+   * a pool belongs to a single tree (it isn't thread safe), a tree holding nodes from chunks of other pools
+   * keeps those pools alive through __upstream and frees the nodes into its own free list.
+   */
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  class avl::tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_node_pool
+  {
+  private:
+    typedef std::allocator_traits<_node_allocator> _traits;
+
+    // the first slot of every chunk holds the chunk header
+    struct _chunk_header
+    {
+      _chunk_header *next;
+      size_t capacity; // in slots, the header slot included
+    };
+
+    // a free slot holds the link to the next free slot
+    struct _free_slot
+    {
+      _free_slot *next;
+    };
+
+    enum : size_t
+    {
+      __first_chunk_capacity = 16,
+      __max_chunk_capacity = 4096,
+      __max_cached_chunks = 64
+    };
+
+    // first chunks given back on this thread, the next pools on the thread start from them
+    // so short lived trees don't go to the allocator for every one of them.
+    // only for stateless allocators (any instance can free what another allocated)
+    struct _chunk_cache
+    {
+      _chunk_header *chunks;
+      size_t size;
+
+      _chunk_cache() : chunks(nullptr), size(0) { _cache_state() = __cache_alive; }
+      ~_chunk_cache()
+      {
+        _cache_state() = __cache_destroyed;
+        _node_allocator allocator;
+        while (chunks)
+        {
+          _chunk_header *chunk = chunks;
+          chunks = chunk->next;
+          size_t capacity = chunk->capacity;
+          chunk->~_chunk_header();
+          _traits::deallocate(allocator, reinterpret_cast<_Node *>(chunk), capacity);
+        }
+      }
+    };
+    typedef std::integral_constant<bool, std::is_empty<_node_allocator>::value && std::is_default_constructible<_node_allocator>::value> _cache_chunks;
+
+    enum : unsigned char
+    {
+      __cache_unborn,
+      __cache_alive,
+      __cache_destroyed
+    };
+
+    // the lifetime of this thread's cache, trivially destructible so it is still readable once the cache is gone:
+    // pools released by later thread_local or static destructors (a global tree, at exit) free their chunks directly
+    static inline unsigned char &_cache_state()
+    {
+      static thread_local unsigned char state = __cache_unborn;
+      return state;
+    }
+
+    static inline _chunk_cache &_thread_cache()
+    {
+      static thread_local _chunk_cache cache;
+      return cache;
+    }
+
+    // a cached first chunk, nullptr if there is none
+    static inline _Node *_take_cached_chunk(std::true_type)
+    {
+      if (_cache_state() == __cache_destroyed)
+      {
+        return nullptr;
+      }
+      _chunk_cache &cache = _thread_cache();
+      _chunk_header *chunk = cache.chunks;
+      if (chunk == nullptr)
+      {
+        return nullptr;
+      }
+      cache.chunks = chunk->next;
+      --cache.size;
+      chunk->~_chunk_header();
+      return reinterpret_cast<_Node *>(chunk);
+    }
+    static inline _Node *_take_cached_chunk(std::false_type) { return nullptr; }
+
+    // keeps a first chunk for the next pool on the thread, false if the cache is full
+    static inline bool _cache_chunk(_chunk_header *chunk, std::true_type)
+    {
+      if (_cache_state() == __cache_destroyed)
+      {
+        return false;
+      }
+      _chunk_cache &cache = _thread_cache();
+      if (cache.size == __max_cached_chunks)
+      {
+        return false;
+      }
+      chunk->next = cache.chunks;
+      cache.chunks = chunk;
+      ++cache.size;
+      return true;
+    }
+    static inline bool _cache_chunk(_chunk_header *, std::false_type) { return false; }
+
+    _node_allocator __allocator;
+    _chunk_header *__chunks;
+    _free_slot *__free_list;
+    _Node *__next_slot; // bump pointer into the newest chunk
+    _Node *__end_slot;
+    size_t __next_capacity;
+    std::vector<std::shared_ptr<_node_pool>> __upstream; // pools that own chunks some of our nodes live in
+
+    void _grow()
+    {
+      static_assert(sizeof(_chunk_header) <= sizeof(_Node), "a node slot must be able to hold a chunk header");
+      static_assert(sizeof(_free_slot) <= sizeof(_Node), "a node slot must be able to hold a free list link");
+
+      size_t capacity = __next_capacity;
+      _Node *chunk = capacity == __first_chunk_capacity ? _take_cached_chunk(_cache_chunks()) : nullptr;
+      if (chunk == nullptr)
+      {
+        chunk = _traits::allocate(__allocator, capacity);
+      }
+
+      _chunk_header *header = ::new (static_cast<void *>(chunk)) _chunk_header;
+      header->next = __chunks;
+      header->capacity = capacity;
+      __chunks = header;
+
+      __next_slot = chunk + 1;
+      __end_slot = chunk + capacity;
+      if (__next_capacity < __max_chunk_capacity)
+      {
+        __next_capacity *= 2;
+      }
+    }
+
+    // move the untouched slots of the newest chunk to the free list
+    void _retire_bump()
+    {
+      while (__next_slot != __end_slot)
+      {
+        deallocate(__next_slot++);
+      }
+    }
+
+  public:
+    explicit _node_pool(const _node_allocator &alloc)
+        : __allocator(alloc),
+          __chunks(nullptr),
+          __free_list(nullptr),
+          __next_slot(nullptr),
+          __end_slot(nullptr),
+          __next_capacity(__first_chunk_capacity),
+          __upstream() {}
+
+    _node_pool(const _node_pool &) = delete;
+    _node_pool &operator=(const _node_pool &) = delete;
+
+    ~_node_pool() { release(); }
+
+    // returns raw storage for a single node
+    _Node *allocate()
+    {
+      if (__free_list)
+      {
+        _free_slot *slot = __free_list;
+        __free_list = slot->next;
+        return reinterpret_cast<_Node *>(slot);
+      }
+      if (__next_slot == __end_slot)
+      {
+        _grow();
+      }
+      return __next_slot++;
+    }
+
+    // takes back the storage of an already destroyed node
+    void deallocate(_Node *node)
+    {
+      _free_slot *slot = ::new (static_cast<void *>(node)) _free_slot;
+      slot->next = __free_list;
+      __free_list = slot;
+    }
+
+    // after this call, nodes allocated from other may be freed into this pool.
+    // other's chunks are taken over when nobody else uses it, otherwise it's kept alive
+    void absorb(const std::shared_ptr<_node_pool> &other)
+    {
+      if (!other || other.get() == this)
+      {
+        return;
+      }
+      if (other.use_count() > 1 || !(__allocator == other->__allocator))
+      {
+        __upstream.push_back(other);
+        return;
+      }
+
+      other->_retire_bump();
+      other->__next_slot = other->__end_slot = nullptr;
+
+      if (other->__chunks)
+      {
+        _chunk_header *tail = other->__chunks;
+        while (tail->next)
+        {
+          tail = tail->next;
+        }
+        tail->next = __chunks;
+        __chunks = other->__chunks;
+        other->__chunks = nullptr;
+      }
+
+      if (other->__free_list)
+      {
+        _free_slot *tail = other->__free_list;
+        while (tail->next)
+        {
+          tail = tail->next;
+        }
+        tail->next = __free_list;
+        __free_list = other->__free_list;
+        other->__free_list = nullptr;
+      }
+
+      // a split off tree keeps the pool it came from alive, joining it back must not make this pool keep itself alive
+      for (std::shared_ptr<_node_pool> &pool : other->__upstream)
+      {
+        if (pool.get() != this)
+        {
+          __upstream.push_back(std::move(pool));
+        }
+      }
+      other->__upstream.clear();
+    }
+
+    // after this call, nodes allocated from other may be freed into this pool while other stays in use
+    void keep_alive(const std::shared_ptr<_node_pool> &other)
+    {
+      if (other && other.get() != this)
+      {
+        __upstream.push_back(other);
+      }
+    }
+
+    // gives all the chunks back to the allocator, every node handed out is invalidated
+    void release()
+    {
+      while (__chunks)
+      {
+        _chunk_header *chunk = __chunks;
+        __chunks = chunk->next;
+        size_t capacity = chunk->capacity;
+        if (capacity == __first_chunk_capacity && _cache_chunk(chunk, _cache_chunks()))
+        {
+          continue;
+        }
+        chunk->~_chunk_header();
+        _traits::deallocate(__allocator, reinterpret_cast<_Node *>(chunk), capacity);
+      }
+      __free_list = nullptr;
+      __next_slot = nullptr;
+      __end_slot = nullptr;
+      __next_capacity = __first_chunk_capacity;
+      __upstream.clear();
+    }
+  };
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  class avl::tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator
+  {
+  private:
+    friend class tree;           // so avl::tree can access the private members of avl::tree::iterator
+    friend class const_iterator; // so an iterator can be converted into a const_iterator
+    inline iterator(const tree *owner, _Node *node) : current(_at_node_tag(), node), owner(owner) {}
+
+  public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef Data_t value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const Data_t *pointer;
+    typedef const Data_t &reference;
+
+    inline iterator() : current(_at_node_tag(), nullptr), owner(nullptr) {}
+
+    inline const Data_t &operator*() const { return current->__data; }
+
+    inline const Data_t *operator->() const { return &(current->__data); }
+
+    inline iterator &operator++()
+    {
+      ++current;
+      return *this;
+    }
+
+    inline iterator operator++(int)
+    {
+      iterator it = *this;
+      ++(*this);
+      return it;
+    }
+
+    inline iterator &operator--()
+    {
+      if (*current == nullptr)
+      {
+        current = _iterator(_at_node_tag(), owner->__max_element);
+      }
+      else
+      {
+        --current;
+      }
+      return *this;
+    }
+
+    inline iterator operator--(int)
+    {
+      iterator it = *this;
+      --(*this);
+      return it;
+    }
+
+    inline bool operator!=(const iterator &other) const { return current != other.current; }
+    inline bool operator==(const iterator &other) const { return !(current != other.current); }
+
+  private:
+    _iterator current;
+    const tree *owner; // for --end()
+  };
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  class avl::tree<Data_t, less, Alloc, Ranked, Augment, Stats>::const_iterator
+  {
+  private:
+    friend class tree; // so avl::tree can access the private members of avl::tree::const_iterator
+    inline const_iterator(const tree *owner, _Node *node) : current(_at_node_tag(), node), owner(owner) {}
+
+  public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef Data_t value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const Data_t *pointer;
+    typedef const Data_t &reference;
+
+    inline const_iterator() : current(_at_node_tag(), nullptr), owner(nullptr) {}
+    inline const_iterator(const iterator &it) : current(_at_node_tag(), *(it.current)), owner(it.owner) {}
+
+    inline const Data_t &operator*() const { return current->__data; }
+
+    inline const Data_t *operator->() const { return &(current->__data); }
+
+    inline const_iterator &operator++()
+    {
+      ++current;
+      return *this;
+    }
+
+    inline const_iterator operator++(int)
+    {
+      const_iterator it = *this;
+      ++(*this);
+      return it;
+    }
+
+    inline const_iterator &operator--()
+    {
+      if (*current == nullptr)
+      {
+        current = _const_iterator(_at_node_tag(), owner->__max_element);
+      }
+      else
+      {
+        --current;
+      }
+      return *this;
+    }
+
+    inline const_iterator operator--(int)
+    {
+      const_iterator it = *this;
+      --(*this);
+      return it;
+    }
+
+    inline bool operator!=(const const_iterator &other) const { return current != other.current; }
+    inline bool operator==(const const_iterator &other) const { return !(current != other.current); }
+
+  private:
+    _const_iterator current;
+    const tree *owner; // for --end()
+  };
+
+  /**
+   * copies the data out in order into a buffer, n at a time.
+   * the path still to go is kept on a stack of its own, so a step is a pop and a walk down a left spine
+   * instead of a climb through the parents, and the loop over a buffer runs with no calls in between.
+   * like the iterators, it is invalidated by changing the tree
+   *
+   *      avl::tree<int>::cursor cursor = tree.scan();
+   *      int buffer[256];
+   *      while (size_t count = cursor.drain(buffer, 256)) { ... }
+   */
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  class avl::tree<Data_t, less, Alloc, Ranked, Augment, Stats>::cursor
+  {
+  private:
+    friend class tree; // so avl::tree can access the private members of avl::tree::cursor
+
+    // starts at node, the ancestors it is on the left of are still to go
+    inline explicit cursor(const _Node *node) : depth(0)
+    {
+      if (node)
+      {
+        stack[depth++] = node;
+      }
+      for (const _Node *child = node; child && child->__parent; child = child->__parent)
+      {
+        if (child == child->__parent->__left)
+        {
+          stack[depth++] = child->__parent;
+        }
+      }
+      for (size_t i = 0; i < depth / 2; ++i) // the nearest goes on top
+      {
+        const _Node *node = stack[i];
+        stack[i] = stack[depth - 1 - i];
+        stack[depth - 1 - i] = node;
+      }
+    }
+
+  public:
+    // true once every data was drained
+    inline bool done() const { return depth == 0; }
+
+    // copies up to n data to out, returns how many were copied (0 once done)
+    template <typename OutputIt>
+    inline size_t drain(OutputIt out, size_t n)
+    {
+      size_t count = 0;
+      while (count < n && depth > 0)
+      {
+        const _Node *node = stack[--depth];
+        *out = node->__data;
+        ++out;
+        ++count;
+        for (const _Node *right = node->__right; right; right = right->__left)
+        {
+          stack[depth++] = right;
+        }
+      }
+      return count;
+    }
+
+  private:
+    const _Node *stack[2 * std::numeric_limits<size_t>::digits]; // an AVL tree is less than 1.45 log(n) high
+    size_t depth;
+  };
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  class avl::tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_iterator
+  {
+  private:
+    friend class tree; // so avl::tree can access the private members of avl::tree::_iterator
+    inline explicit _iterator(_Node *root) : current(_get_left_most_node(root)) {}
+    inline _iterator(_at_node_tag, _Node *node) : current(node) {}
+
+  public:
+    inline _Node *operator*() const { return current; }
+
+    inline _Node *operator->() const { return current; }
+
+    inline _iterator &operator++()
+    {
+      if (current->__right)
+      {
+        current = _get_left_most_node(current->__right);
+      }
+      else
+      {
+        _Node *p = current->__parent;
+        while (p && current == p->__right)
+        {
+          current = p;
+          p = p->__parent;
+        }
+        current = p;
+      }
+      return *this;
+    }
+
+    inline _iterator operator++(int)
+    {
+      _iterator it = *this;
+      ++(*this);
+      return it;
+    }
+
+    // the end can't be stepped back from here, the public iterators take it to the max element
+    inline _iterator &operator--()
+    {
+      if (current->__left)
+      {
+        current = _get_right_most_node(current->__left);
+      }
+      else
+      {
+        _Node *p = current->__parent;
+        while (p && current == p->__left)
+        {
+          current = p;
+          p = p->__parent;
+        }
+        current = p;
+      }
+      return *this;
+    }
+
+    inline bool operator!=(const _iterator &other) const { return current != other.current; }
+
+  private:
+    _Node *current;
+  };
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  class avl::tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_const_iterator
+  {
+  private:
+    friend class tree; // so avl::tree can access the private members of avl::tree::_const_iterator
+    inline explicit _const_iterator(_Node *root) : current(_get_left_most_node(root)) {}
+    inline _const_iterator(_at_node_tag, _Node *node) : current(node) {}
+
+  public:
+    inline const _Node *operator*() const { return current; }
+
+    inline const _Node *operator->() const { return current; }
+
+    inline _const_iterator &operator++()
+    {
+      if (current->__right)
+      {
+        current = _get_left_most_node(current->__right);
+      }
+      else
+      {
+        _Node *p = current->__parent;
+        while (p && current == p->__right)
+        {
+          current = p;
+          p = p->__parent;
+        }
+        current = p;
+      }
+      return *this;
+    }
+
+    inline _const_iterator operator++(int)
+    {
+      _const_iterator it = *this;
+      ++(*this);
+      return it;
+    }
+
+    // the end can't be stepped back from here, the public iterators take it to the max element
+    inline _const_iterator &operator--()
+    {
+      if (current->__left)
+      {
+        current = _get_right_most_node(current->__left);
+      }
+      else
+      {
+        _Node *p = current->__parent;
+        while (p && current == p->__left)
+        {
+          current = p;
+          p = p->__parent;
+        }
+        current = p;
+      }
+      return *this;
+    }
+
+    inline bool operator!=(const _const_iterator &other) const { return current != other.current; }
+
+  private:
+    _Node *current;
+  };
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats>::tree()
+      : __root(nullptr),
+        __min_element(nullptr),
+        __max_element(nullptr),
+        __size(0),
+        __allocator(),
+        __pool()
+  {
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats>::tree(const allocator_type &alloc)
+      : __root(nullptr),
+        __min_element(nullptr),
+        __max_element(nullptr),
+        __size(0),
+        __allocator(alloc),
+        __pool()
+  {
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats>::tree(const less &comp, const allocator_type &alloc)
+      : _compare_holder<less>(comp),
+        __root(nullptr),
+        __min_element(nullptr),
+        __max_element(nullptr),
+        __size(0),
+        __allocator(alloc),
+        __pool()
+  {
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats>::tree(std::initializer_list<Data_t> list, const allocator_type &alloc)
+      : tree(list.begin(), list.end(), alloc)
+  {
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename InputIt, typename>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats>::tree(InputIt first, InputIt last, const allocator_type &alloc)
+      : tree(first, last, less(), alloc)
+  {
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename InputIt, typename>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats>::tree(InputIt first, InputIt last, const less &comp, const allocator_type &alloc)
+      : tree(comp, alloc)
+  {
+    // the d'tor doesn't run for a tree whose c'tor throws, so the nodes inserted so far are destroyed here
+    try
+    {
+      _construct_aux(first, last, typename std::iterator_traits<InputIt>::iterator_category());
+    }
+    catch (...)
+    {
+      clear();
+      throw;
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename ForwardIt>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::from_sorted(ForwardIt first, ForwardIt last, const allocator_type &alloc)
+  {
+    return from_sorted(first, last, key_compare(), alloc);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename ForwardIt>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::from_sorted(ForwardIt first, ForwardIt last, const less &comp, const allocator_type &alloc)
+  {
+    tree sorted_tree(comp, alloc);
+    sorted_tree._construct_from_sorted_aux(first, static_cast<size_t>(std::distance(first, last)));
+    return sorted_tree;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename InputIt>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::from_sorted_n(InputIt first, size_t size, const allocator_type &alloc)
+  {
+    return from_sorted_n(first, size, key_compare(), alloc);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename InputIt>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::from_sorted_n(InputIt first, size_t size, const less &comp, const allocator_type &alloc)
+  {
+    tree sorted_tree(comp, alloc);
+    sorted_tree._construct_from_sorted_aux(first, size);
+    return sorted_tree;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename RandomIt>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::from_sorted(const parallel_policy &policy, RandomIt first, RandomIt last, const allocator_type &alloc)
+  {
+    return from_sorted(policy, first, last, key_compare(), alloc);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename RandomIt>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::from_sorted(const parallel_policy &policy, RandomIt first, RandomIt last, const less &comp, const allocator_type &alloc)
+  {
+    tree sorted_tree(comp, alloc);
+    size_t size = static_cast<size_t>(last - first);
+    sorted_tree.__root = sorted_tree._create_almost_full_tree_parallel(first, size, policy.threads, policy.cutoff);
+    sorted_tree.__size = size;
+    sorted_tree.__min_element = _get_left_most_node(sorted_tree.__root);
+    sorted_tree.__max_element = _get_right_most_node(sorted_tree.__root);
+    return sorted_tree;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename InputIt>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_construct_aux(InputIt first, InputIt last, std::input_iterator_tag)
+  {
+    // single pass, sorted input still only costs one comparison per data (appended at the max)
+    for (; first != last; ++first)
+    {
+      if (_insert_aux(nullptr, *first).second == false) // problem in inserting
+      {
+        this->_clear_aux(); // clear the tree
+        throw bad_input("inserting failed.");
+      }
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename ForwardIt>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_construct_aux(ForwardIt first, ForwardIt last, std::forward_iterator_tag)
+  {
+    // strictly increasing data is built directly in linear time, anything else is inserted one by one
+    size_t size = 0;
+    bool sorted = true;
+    for (ForwardIt prev = first, curr = first; curr != last; prev = curr, ++curr, ++size)
+    {
+      if (size > 0 && !_less(*prev, *curr))
+      {
+        sorted = false;
+        break;
+      }
+    }
+
+    if (sorted)
+    {
+      _construct_from_sorted_aux(first, size);
+    }
+    else
+    {
+      _construct_aux(first, last, std::input_iterator_tag());
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename ForwardIt>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_construct_from_sorted_aux(ForwardIt first, size_t size)
+  {
+    __root = _create_almost_full_tree_from_sequence(first, size);
+    __size = size;
+    __min_element = _get_left_most_node(__root);
+    __max_element = _get_right_most_node(__root);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats>::tree(const tree &other)
+      : _stats_counter<Stats>(),
+        _compare_holder<less>(other.key_comp()),
+        __root(nullptr),
+        __min_element(nullptr),
+        __max_element(nullptr),
+        __size(0),
+        __allocator(std::allocator_traits<Alloc>::select_on_container_copy_construction(other.__allocator)),
+        __pool()
+  {
+    this->__root = _copy_tree(other.__root);
+
+    this->__size = other.__size;
+    this->__max_element = _get_right_most_node(this->__root);
+    this->__min_element = _get_left_most_node(this->__root);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats>::tree(tree &&other)
+      : _stats_counter<Stats>(other), // the counters go along with the nodes
+        _compare_holder<less>(other.key_comp()),
+        __root(other.__root),
+        __min_element(other.__min_element),
+        __max_element(other.__max_element),
+        __size(other.__size),
+        __allocator(other.__allocator),
+        __pool(std::move(other.__pool)) // the nodes go together with the pool they were allocated from
+  {
+    other.__root = nullptr;
+    other.__size = 0;
+    other.__max_element = nullptr;
+    other.__min_element = nullptr;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> &tree<Data_t, less, Alloc, Ranked, Augment, Stats>::operator=(const tree<Data_t, less, Alloc, Ranked, Augment, Stats> &other)
+  {
+    if (this != &other)
+    {
+      // copy the tree first so in case the copying failed (due to insufficient memory) this object will still be valid
+      tree copy(other);
+      *this = std::move(copy);
+    }
+    return *this;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> &tree<Data_t, less, Alloc, Ranked, Augment, Stats>::operator=(tree<Data_t, less, Alloc, Ranked, Augment, Stats> &&other)
+  {
+    if (this != &other)
+    {
+      this->clear();
+
+      this->__root = other.__root;
+      this->__size = other.__size;
+      this->__max_element = other.__max_element;
+      this->__min_element = other.__min_element;
+      this->__allocator = other.__allocator;
+      this->_set_comp(other.key_comp());
+      this->__pool = std::move(other.__pool);
+      other.__root = nullptr;
+      other.__size = 0;
+      other.__max_element = nullptr;
+      other.__min_element = nullptr;
+    }
+    return *this;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats>::~tree()
+  {
+    _clear_aux();
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::clear()
+  {
+    _clear_aux();
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  size_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::size() const
+  {
+    return __size;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  bool tree<Data_t, less, Alloc, Ranked, Augment, Stats>::empty() const
+  {
+#ifdef AVL_TREE_TEST
+    bool empty = __root == nullptr;
+    if (empty)
+    {
+      assert(__size == 0);
+    }
+    else
+    {
+      assert(__size != 0);
+    }
+#endif
+    return __root == nullptr;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  inline ssize_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::height() const
+  {
+    return __root ? _get_tree_height_from_children(*__root) : -1;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  const Data_t &tree<Data_t, less, Alloc, Ranked, Augment, Stats>::search(const Data_t &data) const
+  {
+    return _search_aux(data)->__data;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  Data_t &tree<Data_t, less, Alloc, Ranked, Augment, Stats>::search(const Data_t &data)
+  {
+    return _search_aux(data)->__data;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  const Data_t &tree<Data_t, less, Alloc, Ranked, Augment, Stats>::min() const
+  {
+    if (__min_element == nullptr)
+    {
+      throw data_not_found();
+    }
+    return __min_element->__data;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  const Data_t &tree<Data_t, less, Alloc, Ranked, Augment, Stats>::max() const
+  {
+    if (__max_element == nullptr)
+    {
+      throw data_not_found();
+    }
+    return __max_element->__data;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  Data_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::pop_min()
+  {
+    return _pop_aux<false>();
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  Data_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::pop_max()
+  {
+    return _pop_aux<true>();
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <bool Max>
+  Data_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_pop_aux()
+  {
+    _Node *node = Max ? __max_element : __min_element;
+    if (node == nullptr)
+    {
+      throw data_not_found();
+    }
+
+    // unlinking only relinks nodes, the moved from data is never looked at
+    Data_t data(std::move(node->__data));
+    _unlink_node_aux(node->__parent, _get_node_pptr(node));
+    return data;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  bool tree<Data_t, less, Alloc, Ranked, Augment, Stats>::contains(const Data_t &data) const
+  {
+    return *(_search_place_aux(data).second) != nullptr;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename ForwardIt, typename OutputIt>
+  OutputIt tree<Data_t, less, Alloc, Ranked, Augment, Stats>::contains_batch(ForwardIt first, ForwardIt last, OutputIt out) const
+  {
+    typedef typename std::iterator_traits<ForwardIt>::value_type key_type;
+    _search_batch_aux(first, last, [&out](const key_type &, const _Node *node)
+                      { *out++ = (node != nullptr); });
+    return out;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename ForwardIt, typename OutputIt>
+  OutputIt tree<Data_t, less, Alloc, Ranked, Augment, Stats>::search_batch(ForwardIt first, ForwardIt last, OutputIt out) const
+  {
+    typedef typename std::iterator_traits<ForwardIt>::value_type key_type;
+    _search_batch_aux(first, last, [&out](const key_type &, const _Node *node)
+                      { *out++ = node ? &node->__data : static_cast<const Data_t *>(nullptr); });
+    return out;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  const Data_t &tree<Data_t, less, Alloc, Ranked, Augment, Stats>::search(const Key &key) const
+  {
+    return _search_aux(key)->__data;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  Data_t &tree<Data_t, less, Alloc, Ranked, Augment, Stats>::search(const Key &key)
+  {
+    return _search_aux(key)->__data;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  bool tree<Data_t, less, Alloc, Ranked, Augment, Stats>::contains(const Key &key) const
+  {
+    return *(_search_place_aux(key).second) != nullptr;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator tree<Data_t, less, Alloc, Ranked, Augment, Stats>::find(const Data_t &data)
+  {
+    return iterator(this, *(_search_place_aux(data).second));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::const_iterator tree<Data_t, less, Alloc, Ranked, Augment, Stats>::find(const Data_t &data) const
+  {
+    // the const iterator never changes the node it points to
+    return const_iterator(this, const_cast<_Node *>(*(_search_place_aux(data).second)));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator tree<Data_t, less, Alloc, Ranked, Augment, Stats>::find(const Key &key)
+  {
+    return iterator(this, *(_search_place_aux(key).second));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::const_iterator tree<Data_t, less, Alloc, Ranked, Augment, Stats>::find(const Key &key) const
+  {
+    // the const iterator never changes the node it points to
+    return const_iterator(this, const_cast<_Node *>(*(_search_place_aux(key).second)));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator tree<Data_t, less, Alloc, Ranked, Augment, Stats>::lower_bound(const Data_t &data)
+  {
+    return iterator(this, _lower_bound_aux(data));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::const_iterator tree<Data_t, less, Alloc, Ranked, Augment, Stats>::lower_bound(const Data_t &data) const
+  {
+    return const_iterator(this, _lower_bound_aux(data));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator tree<Data_t, less, Alloc, Ranked, Augment, Stats>::lower_bound(const Key &key)
+  {
+    return iterator(this, _lower_bound_aux(key));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::const_iterator tree<Data_t, less, Alloc, Ranked, Augment, Stats>::lower_bound(const Key &key) const
+  {
+    return const_iterator(this, _lower_bound_aux(key));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator tree<Data_t, less, Alloc, Ranked, Augment, Stats>::upper_bound(const Data_t &data)
+  {
+    return iterator(this, _upper_bound_aux(data));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::const_iterator tree<Data_t, less, Alloc, Ranked, Augment, Stats>::upper_bound(const Data_t &data) const
+  {
+    return const_iterator(this, _upper_bound_aux(data));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator tree<Data_t, less, Alloc, Ranked, Augment, Stats>::upper_bound(const Key &key)
+  {
+    return iterator(this, _upper_bound_aux(key));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::const_iterator tree<Data_t, less, Alloc, Ranked, Augment, Stats>::upper_bound(const Key &key) const
+  {
+    return const_iterator(this, _upper_bound_aux(key));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  std::pair<typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator, typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::equal_range(const Data_t &data)
+  {
+    return {lower_bound(data), upper_bound(data)};
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  std::pair<typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::const_iterator, typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::const_iterator> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::equal_range(const Data_t &data) const
+  {
+    return {lower_bound(data), upper_bound(data)};
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  std::pair<typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator, typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::equal_range(const Key &key)
+  {
+    return {lower_bound(key), upper_bound(key)};
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  std::pair<typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::const_iterator, typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::const_iterator> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::equal_range(const Key &key) const
+  {
+    return {lower_bound(key), upper_bound(key)};
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  range_view<typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::range(const Data_t &lo, const Data_t &hi)
+  {
+    iterator first = lower_bound(lo);
+    // nothing in [lo, hi), covers hi <= lo as well
+    if (first == end() || !_less(*first, hi))
+    {
+      return range_view<iterator>(first, first);
+    }
+    return range_view<iterator>(first, lower_bound(hi));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  range_view<typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::const_iterator> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::range(const Data_t &lo, const Data_t &hi) const
+  {
+    const_iterator first = lower_bound(lo);
+    // nothing in [lo, hi), covers hi <= lo as well
+    if (first == end() || !_less(*first, hi))
+    {
+      return range_view<const_iterator>(first, first);
+    }
+    return range_view<const_iterator>(first, lower_bound(hi));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  range_view<typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::range(const Key &lo, const Key &hi)
+  {
+    iterator first = lower_bound(lo);
+    // nothing in [lo, hi), covers hi <= lo as well
+    if (first == end() || !_less(*first, hi))
+    {
+      return range_view<iterator>(first, first);
+    }
+    return range_view<iterator>(first, lower_bound(hi));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  range_view<typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::const_iterator> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::range(const Key &lo, const Key &hi) const
+  {
+    const_iterator first = lower_bound(lo);
+    // nothing in [lo, hi), covers hi <= lo as well
+    if (first == end() || !_less(*first, hi))
+    {
+      return range_view<const_iterator>(first, first);
+    }
+    return range_view<const_iterator>(first, lower_bound(hi));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::insert(const Data_t &data)
+  {
+    if (_insert_aux(nullptr, data).second == false)
+    {
+      throw data_already_exists();
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::insert(Data_t &&data)
+  {
+    if (_insert_aux(nullptr, std::move(data)).second == false)
+    {
+      throw data_already_exists();
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  std::pair<typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator, bool> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::insert(const Data_t &data, const std::nothrow_t &)
+  {
+    std::pair<_Node *, bool> result = _insert_aux(nullptr, data);
+    return {iterator(this, result.first), result.second};
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  std::pair<typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator, bool> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::insert(Data_t &&data, const std::nothrow_t &)
+  {
+    std::pair<_Node *, bool> result = _insert_aux(nullptr, std::move(data));
+    return {iterator(this, result.first), result.second};
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator tree<Data_t, less, Alloc, Ranked, Augment, Stats>::insert(const_iterator hint, const Data_t &data)
+  {
+    this->_count_hinted_search();
+    return iterator(this, _insert_aux(const_cast<_Node *>(*hint.current), data).first);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator tree<Data_t, less, Alloc, Ranked, Augment, Stats>::insert(const_iterator hint, Data_t &&data)
+  {
+    this->_count_hinted_search();
+    return iterator(this, _insert_aux(const_cast<_Node *>(*hint.current), std::move(data)).first);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename... Args>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator tree<Data_t, less, Alloc, Ranked, Augment, Stats>::emplace_hint(const_iterator hint, Args &&...args)
+  {
+    this->_count_hinted_search();
+    _Node *node = _create_node(std::forward<Args>(args)...);
+    std::pair<_Node *, bool> result = _insert_node_aux(const_cast<_Node *>(*hint.current), node);
+    if (result.second == false)
+    {
+      _destroy_node(node);
+    }
+    return iterator(this, result.first);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename... Args>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::emplace(Args &&...args)
+  {
+    // the data has to exist before its place can be searched for
+    _Node *node = _create_node(std::forward<Args>(args)...);
+    if (_insert_node_aux(nullptr, node).second == false)
+    {
+      _destroy_node(node);
+      throw data_already_exists();
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename... Args>
+  std::pair<typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator, bool> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::try_emplace(const Data_t &key, Args &&...args)
+  {
+    return _try_emplace_aux(key, std::forward<Args>(args)...);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename... Args, typename>
+  std::pair<typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator, bool> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::try_emplace(const Key &key, Args &&...args)
+  {
+    return _try_emplace_aux(key, std::forward<Args>(args)...);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename... Args>
+  std::pair<typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator, bool> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_try_emplace_aux(const Key &key, Args &&...args)
+  {
+    std::pair<_Node *, _Node **> parent_data_pair = _search_place_hint_aux(nullptr, key);
+    if (*parent_data_pair.second)
+    {
+      return {iterator(this, *parent_data_pair.second), false};
+    }
+
+    _Node *node = _create_node(std::forward<Args>(args)...);
+#ifdef AVL_TREE_TEST
+    assert(!key_comp()(key, node->__data) && !key_comp()(node->__data, key));
+#endif
+    _link_node_aux(parent_data_pair.first, parent_data_pair.second, node);
+
+    return {iterator(this, node), true};
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::remove(const Data_t &data)
+  {
+    _remove_or_throw(data);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::remove(const Key &key)
+  {
+    _remove_or_throw(key);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  size_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::erase(const Data_t &data)
+  {
+    return _remove_aux(data) ? 1 : 0;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  size_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::erase(const Key &key)
+  {
+    return _remove_aux(key) ? 1 : 0;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator tree<Data_t, less, Alloc, Ranked, Augment, Stats>::erase(const_iterator pos)
+  {
+    _Node *node = const_cast<_Node *>(*pos.current);
+    // unlinking only relinks nodes, so the next node stays where it is
+    _Node *next = const_cast<_Node *>(*(++pos.current));
+    _unlink_node_aux(node->__parent, _get_node_pptr(node));
+    return iterator(this, next);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::iterator tree<Data_t, less, Alloc, Ranked, Augment, Stats>::erase(iterator pos)
+  {
+    return erase(const_iterator(pos));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_remove_or_throw(const Key &key)
+  {
+    if (_remove_aux(key) == false)
+    {
+      throw data_not_found();
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  size_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::rank(const Data_t &data) const
+  {
+    return _rank_aux(data);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  size_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::rank(const Key &key) const
+  {
+    return _rank_aux(key);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  const Data_t &tree<Data_t, less, Alloc, Ranked, Augment, Stats>::select(size_t k) const
+  {
+    static_assert(Ranked, "select() requires a Ranked tree");
+    if (k >= __size)
+    {
+      throw bad_input("index out of range.");
+    }
+
+    const _Node *node = __root;
+    while (true)
+    {
+      size_t left_count = _get_count(node->__left);
+      if (k < left_count)
+      {
+        node = node->__left;
+      }
+      else if (k == left_count)
+      {
+        return node->__data;
+      }
+      else
+      {
+        k -= left_count + 1;
+        node = node->__right;
+      }
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  size_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::count_range(const Data_t &lo, const Data_t &hi) const
+  {
+    size_t lo_rank = _rank_aux(lo);
+    size_t hi_rank = _rank_aux(hi);
+    return (lo_rank < hi_rank) ? (hi_rank - lo_rank) : 0;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  size_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::count_range(const Key &lo, const Key &hi) const
+  {
+    size_t lo_rank = _rank_aux(lo);
+    size_t hi_rank = _rank_aux(hi);
+    return (lo_rank < hi_rank) ? (hi_rank - lo_rank) : 0;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::augment_type tree<Data_t, less, Alloc, Ranked, Augment, Stats>::fold() const
+  {
+    static_assert(_augment_traits<Augment>::enabled, "fold() requires an Augment policy");
+    return _get_augment(__root);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::augment_type tree<Data_t, less, Alloc, Ranked, Augment, Stats>::fold_range(const Data_t &lo, const Data_t &hi) const
+  {
+    return _fold_range_aux(lo, hi);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::augment_type tree<Data_t, less, Alloc, Ranked, Augment, Stats>::fold_range(const Key &lo, const Key &hi) const
+  {
+    return _fold_range_aux(lo, hi);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Point, typename OutputIt>
+  OutputIt tree<Data_t, less, Alloc, Ranked, Augment, Stats>::stab(const Point &point, OutputIt out) const
+  {
+    static_assert(_augment_traits<Augment>::enabled, "stab() requires an interval Augment policy");
+    return _stab_aux(point, out);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::join(tree &&t1, const Data_t &data, tree &&t2)
+  {
+    return _join_tree_aux(t1, data, t2);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::join(tree &&t1, Data_t &&data, tree &&t2)
+  {
+    return _join_tree_aux(t1, std::move(data), t2);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::split(const Data_t &key)
+  {
+    return _split_tree_aux(key);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key, typename>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::split(const Key &key)
+  {
+    return _split_tree_aux(key);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::unite(const tree &t1, const tree &t2)
+  {
+    return _set_op_copy_aux(t1, t2, __unite);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::unite(tree &&t1, tree &&t2)
+  {
+    if (!_prefer_join_aux(t1.size(), t2.size()))
+    {
+      return _set_op_move_aux(t1, t2, __unite);
+    }
+    return _set_op_join_tree_aux(t1, t2, __unite);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::unite(const parallel_policy &policy, const tree &t1, const tree &t2)
+  {
+    return _set_op_copy_aux(t1, t2, __unite, policy.threads, policy.cutoff);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::unite(const parallel_policy &policy, tree &&t1, tree &&t2)
+  {
+    if (policy.threads <= 1)
+    {
+      return unite(std::move(t1), std::move(t2));
+    }
+    return _set_op_join_tree_aux(t1, t2, __unite, policy.threads, policy.cutoff);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::intersect(const tree &t1, const tree &t2)
+  {
+    return _set_op_copy_aux(t1, t2, __intersect);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::intersect(tree &&t1, tree &&t2)
+  {
+    if (!_prefer_join_aux(t1.size(), t2.size()))
+    {
+      return _set_op_move_aux(t1, t2, __intersect);
+    }
+    return _set_op_join_tree_aux(t1, t2, __intersect);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::intersect(const parallel_policy &policy, const tree &t1, const tree &t2)
+  {
+    return _set_op_copy_aux(t1, t2, __intersect, policy.threads, policy.cutoff);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::intersect(const parallel_policy &policy, tree &&t1, tree &&t2)
+  {
+    if (policy.threads <= 1)
+    {
+      return intersect(std::move(t1), std::move(t2));
+    }
+    return _set_op_join_tree_aux(t1, t2, __intersect, policy.threads, policy.cutoff);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::difference(const tree &t1, const tree &t2)
+  {
+    return _set_op_copy_aux(t1, t2, __difference);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::difference(tree &&t1, tree &&t2)
+  {
+    if (!_prefer_join_aux(t1.size(), t2.size()))
+    {
+      return _set_op_move_aux(t1, t2, __difference);
+    }
+    return _set_op_join_tree_aux(t1, t2, __difference);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::difference(const parallel_policy &policy, const tree &t1, const tree &t2)
+  {
+    return _set_op_copy_aux(t1, t2, __difference, policy.threads, policy.cutoff);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::difference(const parallel_policy &policy, tree &&t1, tree &&t2)
+  {
+    if (policy.threads <= 1)
+    {
+      return difference(std::move(t1), std::move(t2));
+    }
+    return _set_op_join_tree_aux(t1, t2, __difference, policy.threads, policy.cutoff);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::symmetric_difference(const tree &t1, const tree &t2)
+  {
+    return _set_op_copy_aux(t1, t2, __symmetric_difference);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::symmetric_difference(tree &&t1, tree &&t2)
+  {
+    if (!_prefer_join_aux(t1.size(), t2.size()))
+    {
+      return _set_op_move_aux(t1, t2, __symmetric_difference);
+    }
+    return _set_op_join_tree_aux(t1, t2, __symmetric_difference);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::symmetric_difference(const parallel_policy &policy, const tree &t1, const tree &t2)
+  {
+    return _set_op_copy_aux(t1, t2, __symmetric_difference, policy.threads, policy.cutoff);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::symmetric_difference(const parallel_policy &policy, tree &&t1, tree &&t2)
+  {
+    if (policy.threads <= 1)
+    {
+      return symmetric_difference(std::move(t1), std::move(t2));
+    }
+    return _set_op_join_tree_aux(t1, t2, __symmetric_difference, policy.threads, policy.cutoff);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename InputIt>
+  size_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::insert_batch(InputIt first, InputIt last)
+  {
+    std::vector<Data_t, Alloc> batch(first, last, __allocator);
+    size_t old_size = __size;
+    tree sorted_tree = _sorted_batch_aux(batch);
+    this->_add_stats(sorted_tree._get_stats());
+    _assign_result_aux(unite(std::move(*this), std::move(sorted_tree)));
+    return __size - old_size;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename InputIt>
+  size_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::remove_batch(InputIt first, InputIt last)
+  {
+    std::vector<Data_t, Alloc> batch(first, last, __allocator);
+    size_t old_size = __size;
+    tree sorted_tree = _sorted_batch_aux(batch);
+    this->_add_stats(sorted_tree._get_stats());
+    _assign_result_aux(difference(std::move(*this), std::move(sorted_tree)));
+    return old_size - __size;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename InputIt>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::apply(InputIt first, InputIt last)
+  {
+    typedef std::pair<Data_t, bool> op_type;
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<op_type> op_allocator;
+    std::vector<op_type, op_allocator> ops(first, last, op_allocator(__allocator));
+    std::stable_sort(ops.begin(), ops.end(), [this](const op_type &op1, const op_type &op2)
+                     { return _less(op1.first, op2.first); });
+
+    // the last of equal data is the one that counts
+    std::vector<Data_t, Alloc> inserts(__allocator);
+    std::vector<Data_t, Alloc> removes(__allocator);
+    for (size_t i = 0; i < ops.size(); ++i)
+    {
+      if (i + 1 == ops.size() || _less(ops[i].first, ops[i + 1].first))
+      {
+        (ops[i].second ? inserts : removes).push_back(std::move(ops[i].first));
+      }
+    }
+
+    // both batch trees are built before the tree is touched, only the merges below may leave it empty
+    tree removed(key_comp(), __allocator);
+    removed._construct_from_sorted_aux(std::make_move_iterator(removes.begin()), removes.size());
+    tree inserted(key_comp(), __allocator);
+    inserted._construct_from_sorted_aux(std::make_move_iterator(inserts.begin()), inserts.size());
+    this->_add_stats(removed._get_stats());
+    this->_add_stats(inserted._get_stats());
+
+    // the 2 batches are disjoint, so the order doesn't matter
+    if (!removed.empty())
+    {
+      _assign_result_aux(difference(std::move(*this), std::move(removed)));
+    }
+    if (!inserted.empty())
+    {
+      _assign_result_aux(unite(std::move(*this), std::move(inserted)));
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Pred>
+  size_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::erase_if(Pred pred)
+  {
+    _Node *list = _tree_to_list_aux(__root);
+    size_t old_size = __size;
+
+    // the kept nodes go on a list of their own (through __right), the rest are destroyed
+    _Node *kept = nullptr;
+    _Node **tail = &kept;
+    size_t size = 0;
+    try
+    {
+      while (list)
+      {
+        _Node *node = list;
+        bool remove = pred(static_cast<const Data_t &>(node->__data)); // node stays on list in case pred throws
+        list = list->__right;
+        if (remove)
+        {
+          _destroy_node(node);
+        }
+        else
+        {
+          *tail = node;
+          tail = &node->__right;
+          ++size;
+        }
+      }
+    }
+    catch (...)
+    {
+      // keep whatever wasn't checked yet
+      for (*tail = list; list; list = list->__right)
+      {
+        ++size;
+      }
+      _rebuild_from_list_aux(kept, size);
+      throw;
+    }
+    *tail = nullptr;
+    _rebuild_from_list_aux(kept, size);
+    return old_size - size;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_rebuild_from_list_aux(_Node *list, size_t size)
+  {
+    __root = _create_almost_full_tree_from_list(list, size);
+    if (__root)
+    {
+      __root->__parent = nullptr;
+    }
+    __size = size;
+    __min_element = _get_left_most_node(__root);
+    __max_element = _get_right_most_node(__root);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  frozen_tree<Data_t, less, Alloc> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::freeze() const
+  {
+    typedef frozen_tree<Data_t, less, Alloc> frozen;
+    return frozen(typename frozen::_sorted_tag(), begin(), __size, key_comp(), __allocator);
+  }
+
+  // * helper methods
+
+  // -*- general tree helper methods -*- //
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename T>
+  std::pair<typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *, bool> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_insert_aux(_Node *hint, T &&data)
+  {
+    std::pair<_Node *, _Node **> parent_data_pair = _search_place_hint_aux(hint, data);
+    _Node *parent_ptr = parent_data_pair.first;
+    _Node **data_pptr = parent_data_pair.second;
+
+    assert(data_pptr != nullptr);
+    if (*data_pptr)
+    {
+      return {*data_pptr, false};
+    }
+
+    // the data is only moved from once its place is known to be free
+    _Node *node = _create_node(std::forward<T>(data));
+    _link_node_aux(parent_ptr, data_pptr, node);
+
+    return {node, true};
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  std::pair<typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *, bool> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_insert_node_aux(_Node *hint, _Node *node)
+  {
+    std::pair<_Node *, _Node **> parent_data_pair = _search_place_hint_aux(hint, node->__data);
+    _Node *parent_ptr = parent_data_pair.first;
+    _Node **data_pptr = parent_data_pair.second;
+
+    assert(data_pptr != nullptr);
+    if (*data_pptr)
+    {
+      return {*data_pptr, false};
+    }
+
+    _link_node_aux(parent_ptr, data_pptr, node);
+
+    return {node, true};
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key>
+  std::pair<typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *, typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node **> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_search_place_hint_aux(_Node *hint, const Key &key)
+  {
+    if (hint == nullptr) // end()
+    {
+      if (__max_element == nullptr)
+      {
+        return {nullptr, &__root};
+      }
+      if (_less(__max_element->__data, key))
+      {
+        // the max has no right child
+        return {__max_element, &(__max_element->__right)};
+      }
+    }
+    else if (_less(key, hint->__data))
+    {
+      _Node *prev = _get_prev_node(hint);
+      if (prev == nullptr || _less(prev->__data, key))
+      {
+        // key belongs between prev and hint, either hint has no left child or prev has no right child
+        if (hint->__left == nullptr)
+        {
+          return {hint, &(hint->__left)};
+        }
+        return {prev, &(prev->__right)};
+      }
+    }
+    else if (_less(hint->__data, key))
+    {
+      _Node *next = _get_next_node(hint);
+      if (next == nullptr || _less(key, next->__data))
+      {
+        // key belongs between hint and next, either hint has no right child or next has no left child
+        if (hint->__right == nullptr)
+        {
+          return {hint, &(hint->__right)};
+        }
+        return {next, &(next->__left)};
+      }
+    }
+    else // the data is in hint
+    {
+      return {hint->__parent, _get_node_pptr(hint)};
+    }
+
+    // a bad hint, search from the root
+    return _search_place_aux(key);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_link_node_aux(_Node *parent_ptr, _Node **node_pptr, _Node *node)
+  {
+    /* AVL tree specific implementation */
+
+    /* adding node logic */
+    // a new min (max) can only be linked as the left (right) child of the old one
+    if (parent_ptr == nullptr)
+    {
+      __min_element = node;
+      __max_element = node;
+    }
+    else
+    {
+      if (parent_ptr == __min_element && node_pptr == &(parent_ptr->__left))
+      {
+        __min_element = node;
+      }
+      if (parent_ptr == __max_element && node_pptr == &(parent_ptr->__right))
+      {
+        __max_element = node;
+      }
+    }
+
+    *node_pptr = node;
+    node->__parent = parent_ptr;
+
+    _balance_to_root(node_pptr);
+
+    __size++;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key>
+  bool tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_remove_aux(const Key &key)
+  {
+
+    std::pair<_Node *, _Node **> parent_data_pair = _search_place_aux(key);
+    _Node *parent_ptr = parent_data_pair.first;
+    _Node **data_pptr = parent_data_pair.second;
+
+    assert(data_pptr != nullptr);
+    if (*data_pptr == nullptr)
+    {
+      /* nothing to remove */
+      return false;
+    }
+
+    _unlink_node_aux(parent_ptr, data_pptr);
+
+    return true;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_unlink_node_aux(_Node *parent_ptr, _Node **data_pptr)
+  {
+    /* removing node logic */
+    /* AVL tree specific implementation */
+
+    // the min (max) node has no left (right) child, so its neighbour is under its right (left) child or its parent
+    if (*data_pptr == __min_element)
+    {
+      __min_element = ((*data_pptr)->__right) ? (_get_left_most_node((*data_pptr)->__right)) : (parent_ptr);
+    }
+    if (*data_pptr == __max_element)
+    {
+      __max_element = ((*data_pptr)->__left) ? (_get_right_most_node((*data_pptr)->__left)) : (parent_ptr);
+    }
+
+    _Node **node_pptr = data_pptr;
+    bool left_exists = (*data_pptr)->__left != nullptr;
+    bool right_exists = (*data_pptr)->__right != nullptr;
+
+    if (left_exists && right_exists) /* both children */
+    {
+      // the successor node is relinked into the place of the removed node, no data is swapped
+      _Node *to_delete = *data_pptr;
+      parent_ptr = to_delete;
+      node_pptr = &(to_delete->__right);
+
+      while ((*node_pptr)->__left)
+      {
+        parent_ptr = (*node_pptr);
+        node_pptr = &((*node_pptr)->__left);
+      }
+
+      _Node *successor = *node_pptr;
+
+      if (parent_ptr != to_delete)
+      {
+        // detach the successor (it has no left child) and give it the right sub tree of the removed node
+        *node_pptr = successor->__right;
+        if (*node_pptr)
+        {
+          (*node_pptr)->__parent = parent_ptr;
+        }
+        successor->__right = to_delete->__right;
+        successor->__right->__parent = successor;
+      }
+      else
+      {
+        // the successor is the right child, it keeps its own right sub tree
+        parent_ptr = successor;
+      }
+
+      successor->__left = to_delete->__left;
+      successor->__left->__parent = successor;
+      successor->__parent = to_delete->__parent;
+      successor->__height = to_delete->__height;
+      *data_pptr = successor;
+
+      node_pptr = _get_node_pptr(parent_ptr);
+
+      _destroy_node(to_delete);
+    }
+    else
+    {
+      _Node *to_delete = *node_pptr;
+
+      if (left_exists) /* only the left child */
+      {
+        *node_pptr = (*node_pptr)->__left;
+      }
+      else /* no children - or - only the right child */
+      {
+        *node_pptr = (*node_pptr)->__right;
+      }
+
+      if (*node_pptr)
+      {
+        (*node_pptr)->__parent = parent_ptr;
+      }
+
+      node_pptr = _get_node_pptr(parent_ptr);
+
+      _destroy_node(to_delete);
+    }
+
+    _balance_to_root(node_pptr);
+
+    __size--;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_clear_aux()
+  {
+    if (__pool && __pool.use_count() == 1)
+    {
+      // no other tree hands out nodes from this pool, so it can be dropped as a whole
+      // (the augment value lives in the node too, so the whole node has to be trivial)
+      if (std::is_trivially_destructible<_Node>::value)
+      {
+        __root = nullptr;
+        __size = 0;
+      }
+      else
+      {
+        __size -= _destroy_tree(&__root);
+      }
+      __pool.reset();
+    }
+    else
+    {
+      __size -= _destroy_tree(&__root);
+    }
+    __min_element = nullptr;
+    __max_element = nullptr;
+#ifdef AVL_TREE_TEST
+    assert(__size == 0);
+#endif
+  }
+
+  // -*- join based helper methods -*- //
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_set_op_copy_aux(const tree &t1, const tree &t2, unsigned op, unsigned threads, size_t cutoff)
+  {
+    tree<Data_t, less, Alloc, Ranked, Augment, Stats> united_tree(t1.key_comp(), t1.get_allocator());
+
+    size_t size_sum = t1.size() + t2.size();
+    // avoid new[](0) which has undefined behaviour
+    if (size_sum > 0)
+    {
+      // allocate space for pointers to ordered data (in-order)
+      // owned by a unique_ptr, the comparator or the copies may throw
+      std::unique_ptr<const Data_t *[]> data_ptr(new const Data_t *[size_sum]);
+
+      auto it1 = t1.begin();
+      auto it2 = t2.begin();
+      auto end1 = t1.end();
+      auto end2 = t2.end();
+
+      size_t index = 0;
+
+      while ((it1 != end1) && (it2 != end2))
+      {
+        if (united_tree._less(*it1, *it2)) // *it1 < *it2
         {
-          node_ptr[index] = *it1; // *it1 returns *Data_t
+          if (op & __keep_first)
+          {
+            data_ptr[index++] = &(*it1); // *it1 returns Data_t
+          }
           ++it1;
         }
-        else if (less()((*it2)->get_data(), (*it1)->get_data())) // *it1 > *it2
+        else if (united_tree._less(*it2, *it1)) // *it1 > *it2
         {
-          node_ptr[index] = *it2; // *it2 returns *Data_t
+          if (op & __keep_second)
+          {
+            data_ptr[index++] = &(*it2); // *it2 returns Data_t
+          }
           ++it2;
         }
         else // *t1 == *t2
         {
-          node_ptr[index] = *it1; // *it1 returns *Data_t
+          if (op & __keep_both)
+          {
+            data_ptr[index++] = &(*it1); // *it1 returns Data_t
+          }
           ++it1;
           ++it2; // duplicates will be copied 1 time only
         }
+      }
+
+      while ((op & __keep_first) && it1 != end1)
+      {
+        data_ptr[index] = &(*it1); // *it1 returns Data_t
+        ++it1;
+        ++index;
+      }
+
+      while ((op & __keep_second) && it2 != end2)
+      {
+        data_ptr[index] = &(*it2); // *it2 returns Data_t
+        ++it2;
         ++index;
       }
 
-      while (it1 != end1)
+      // data_ptr now holds pointers to the ordered data the operation keeps
+      // index is the amount of (non-duplicates) data in the *new* tree
+
+      // we now need to build an almost complete binary tree using the array method
+      // an almost complete binary (search) tree is considered an AVL tree since it abides by it's rules
+      if (index > 0)
+      {
+        if (threads > 1)
+        {
+          united_tree.set_root(united_tree._create_almost_full_tree_parallel(_indirect_iterator{data_ptr.get()}, index, threads, cutoff));
+        }
+        else
+        {
+          united_tree.set_root(united_tree._create_almost_full_tree(data_ptr.get(), index));
+        }
+        united_tree.set_size(index);
+        united_tree.set_max_element(united_tree._find_max());
+        united_tree.set_min_element(united_tree._find_min());
+      }
+    }
+    return united_tree;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_set_op_move_aux(tree &t1, tree &t2, unsigned op)
+  {
+    tree<Data_t, less, Alloc, Ranked, Augment, Stats> united_tree(t1.key_comp(), t1.get_allocator());
+
+    // the nodes now belong to the united tree, and so does the memory they live in
+    _Node *list1 = _tree_to_list_aux(t1.__root);
+    _Node *list2 = _tree_to_list_aux(t2.__root);
+    united_tree._adopt_pool(t1);
+    united_tree._adopt_pool(t2);
+
+    // clean up the trees so no accidental deletion of memory takes place
+    t1._release_aux();
+    t2._release_aux();
+
+    // stitch the kept nodes into 1 list (through __right), the dropped ones are destroyed on the way
+    _Node *united_list = nullptr;
+    _Node **tail = &united_list;
+    size_t size = 0;
+    auto take = [&](_Node *node, bool keep)
+    {
+      if (keep)
+      {
+        *tail = node;
+        tail = &node->__right;
+        ++size;
+      }
+      else
+      {
+        united_tree._destroy_node(node);
+      }
+    };
+
+    try
+    {
+      while (list1 && list2)
+      {
+        _Node *node1 = list1;
+        _Node *node2 = list2;
+        if (united_tree._less(node1->get_data(), node2->get_data())) // *node1 < *node2
+        {
+          list1 = list1->__right;
+          take(node1, op & __keep_first);
+        }
+        else if (united_tree._less(node2->get_data(), node1->get_data())) // *node1 > *node2
+        {
+          list2 = list2->__right;
+          take(node2, op & __keep_second);
+        }
+        else // *node1 == *node2
+        {
+          list1 = list1->__right;
+          list2 = list2->__right;
+          take(node2, false); // duplicates will be kept 1 time only
+          take(node1, op & __keep_both);
+        }
+      }
+    }
+    catch (...)
+    {
+      // the comparator threw, the nodes are all still on 1 of the 3 lists (linked through __right)
+      *tail = nullptr;
+      united_tree._destroy_tree(&united_list);
+      united_tree._destroy_tree(&list1);
+      united_tree._destroy_tree(&list2);
+      throw;
+    }
+    while (list1)
+    {
+      _Node *node1 = list1;
+      list1 = list1->__right;
+      take(node1, op & __keep_first);
+    }
+    while (list2)
+    {
+      _Node *node2 = list2;
+      list2 = list2->__right;
+      take(node2, op & __keep_second);
+    }
+    *tail = nullptr;
+
+    // we now need to build an almost complete binary tree from the list
+    // an almost complete binary (search) tree is considered an AVL tree since it abides by it's rules
+    if (size > 0)
+    {
+      united_tree.set_root(tree::_create_almost_full_tree_from_list(united_list, size));
+      united_tree.__root->__parent = nullptr;
+      united_tree.set_size(size);
+      united_tree.set_max_element(united_tree._find_max());
+      united_tree.set_min_element(united_tree._find_min());
+    }
+    return united_tree;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_sorted_batch_aux(std::vector<Data_t, Alloc> &batch) const
+  {
+    // stable, so the first of equal data is kept
+    std::stable_sort(batch.begin(), batch.end(), [this](const Data_t &data1, const Data_t &data2)
+                     { return _less(data1, data2); });
+    batch.erase(std::unique(batch.begin(), batch.end(), [this](const Data_t &data1, const Data_t &data2)
+                            { return !_less(data1, data2); }),
+                batch.end());
+    tree sorted_tree(key_comp(), __allocator);
+    sorted_tree._construct_from_sorted_aux(std::make_move_iterator(batch.begin()), batch.size());
+    return sorted_tree;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_assign_result_aux(tree &&result)
+  {
+    this->_add_stats(result._get_stats());
+    *this = std::move(result);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  bool tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_prefer_join_aux(size_t size1, size_t size2)
+  {
+    size_t small_size = std::min(size1, size2);
+    size_t large_size = std::max(size1, size2);
+    if (small_size == 0)
+    {
+      return true;
+    }
+    // m log(n/m + 1) against n + m, weighted by how much more a join step costs than a merge step
+    double join_cost = 4.0 * small_size * std::log2(static_cast<double>(large_size) / small_size + 1);
+    return join_cost < static_cast<double>(small_size + large_size);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_set_op_join_tree_aux(tree &t1, tree &t2, unsigned op, unsigned threads, size_t cutoff)
+  {
+    tree result_tree(t1.key_comp(), t1.get_allocator());
+    size_t size_sum = t1.size() + t2.size();
+    _Node *root1 = t1.__root;
+    _Node *root2 = t2.__root;
+    result_tree._adopt_pool(t1);
+    result_tree._adopt_pool(t2);
+    t1._release_aux();
+    t2._release_aux();
+
+    _set_op_context context;
+    context.op = op;
+    // an AVL sub tree of height h holds at least fib(h) data, at least 1.6^h
+    context.cutoff_height = static_cast<int>(std::log(static_cast<double>(cutoff)) / std::log(1.6));
+    context.concurrent = threads > 1;
+    context.destroyed = 0;
+    context.garbage = nullptr;
+
+    try
+    {
+      result_tree.__root = result_tree._set_op_join_aux(root1, root2, context, threads);
+    }
+    catch (...)
+    {
+      // every detached sub tree is in dropped or in garbage by now, and all the threads are done
+      for (size_t i = 0; i < context.dropped.size(); ++i)
+      {
+        result_tree._destroy_tree(&context.dropped[i]);
+      }
+      result_tree._destroy_tree(&context.garbage);
+      throw;
+    }
+    for (size_t i = 0; i < context.dropped.size(); ++i)
+    {
+      context.destroyed += result_tree._destroy_tree(&context.dropped[i]);
+    }
+
+    result_tree.__size = size_sum - context.destroyed;
+    result_tree.__min_element = _get_left_most_node(result_tree.__root);
+    result_tree.__max_element = _get_right_most_node(result_tree.__root);
+    return result_tree;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_set_op_join_aux(_Node *t1, _Node *t2, _set_op_context &context, unsigned threads)
+  {
+    if (t1 == nullptr)
+    {
+      if (context.op & __keep_second)
+      {
+        return t2;
+      }
+      _drop_aux(t2, context);
+      return nullptr;
+    }
+    if (t2 == nullptr)
+    {
+      if (context.op & __keep_first)
+      {
+        return t1;
+      }
+      _drop_aux(t1, context);
+      return nullptr;
+    }
+
+    _Node *left1 = t1->__left;
+    _Node *right1 = t1->__right;
+    _Node *left2, *right2;
+    _Node *duplicate;
+    try
+    {
+      duplicate = _split_aux(t2, t1->__data, left2, right2);
+    }
+    catch (...)
+    {
+      // nothing is detached yet, t1 and t2 are still whole
+      _hang_aux(context.garbage, t1);
+      _hang_aux(context.garbage, t2);
+      throw;
+    }
+    if (left1)
+    {
+      left1->__parent = nullptr;
+    }
+    if (right1)
+    {
+      right1->__parent = nullptr;
+    }
+    t1->__left = nullptr;
+    t1->__right = nullptr;
+
+    // the recursive calls own the sub trees handed to them, on an exception they leave them in their context's garbage
+    _Node *left = nullptr;
+    _Node *right = nullptr;
+    try
+    {
+      if (threads > 1 && std::max(_get_height(left1), _get_height(left2)) >= context.cutoff_height)
+      {
+        // the left side goes to a new thread with half of the threads, the right side stays here
+        _set_op_context left_context;
+        left_context.op = context.op;
+        left_context.cutoff_height = context.cutoff_height;
+        left_context.concurrent = true;
+        left_context.destroyed = 0;
+        left_context.garbage = nullptr;
+        // the counters aren't thread safe, the left thread counts on a tree of its own (it holds no nodes)
+        tree left_counter(key_comp(), __allocator);
+        std::future<_Node *> left_future;
+        try
+        {
+          left_future = std::async(std::launch::async, [&left_context, &left_counter, threads](_Node *left_t1, _Node *left_t2)
+                                   { return left_counter._set_op_join_aux(left_t1, left_t2, left_context, threads / 2); },
+                                   left1, left2);
+          left1 = nullptr;
+          left2 = nullptr;
+        }
+        catch (const std::system_error &)
+        {
+          // no thread could be started, the left side runs here after the right side
+        }
+        try
+        {
+          right = _set_op_join_aux(_take_aux(right1), _take_aux(right2), context, threads - threads / 2);
+          if (left_future.valid())
+          {
+            left = left_future.get();
+            this->_add_stats(left_counter._get_stats());
+          }
+          else
+          {
+            left = _set_op_join_aux(_take_aux(left1), _take_aux(left2), context, 1);
+          }
+          context.dropped.insert(context.dropped.end(), left_context.dropped.begin(), left_context.dropped.end());
+          left_context.dropped.clear();
+        }
+        catch (...)
+        {
+          if (left_future.valid())
+          {
+            // the right side threw, the left thread still uses left_context until it's done
+            try
+            {
+              left = left_future.get();
+            }
+            catch (...)
+            {
+            }
+          }
+          _hang_aux(context.garbage, left_context.garbage);
+          for (size_t i = 0; i < left_context.dropped.size(); ++i)
+          {
+            _hang_aux(context.garbage, left_context.dropped[i]);
+          }
+          throw;
+        }
+      }
+      else
+      {
+        left = _set_op_join_aux(_take_aux(left1), _take_aux(left2), context, threads);
+        right = _set_op_join_aux(_take_aux(right1), _take_aux(right2), context, threads);
+      }
+    }
+    catch (...)
+    {
+      _hang_aux(context.garbage, left1);
+      _hang_aux(context.garbage, left2);
+      _hang_aux(context.garbage, right1);
+      _hang_aux(context.garbage, right2);
+      _hang_aux(context.garbage, left);
+      _hang_aux(context.garbage, right);
+      _hang_aux(context.garbage, t1);
+      _hang_aux(context.garbage, duplicate);
+      throw;
+    }
+
+    // data found in both trees is taken from t1
+    bool keep = duplicate ? (context.op & __keep_both) : (context.op & __keep_first);
+    _Node *joined = keep ? _join_aux(left, t1, right) : _join2_aux(left, right);
+    try
+    {
+      _drop_aux(_take_aux(duplicate), context);
+      if (!keep)
+      {
+        _drop_aux(_take_aux(t1), context);
+      }
+    }
+    catch (...)
+    {
+      _hang_aux(context.garbage, joined);
+      if (!keep)
+      {
+        _hang_aux(context.garbage, t1);
+      }
+      throw;
+    }
+    return joined;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_drop_aux(_Node *root, _set_op_context &context)
+  {
+    if (root == nullptr)
+    {
+      return;
+    }
+    if (context.concurrent)
+    {
+      try
+      {
+        context.dropped.push_back(root);
+      }
+      catch (...)
+      {
+        // the caller cleans up the garbage once it has seen the exception
+        _hang_aux(context.garbage, root);
+        throw;
+      }
+    }
+    else
+    {
+      context.destroyed += _destroy_tree(&root);
+    }
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_hang_aux(_Node *&garbage, _Node *root)
+  {
+    if (root == nullptr)
+    {
+      return;
+    }
+    _Node *left_most = root;
+    while (left_most->__left)
+    {
+      left_most = left_most->__left;
+    }
+    left_most->__left = garbage;
+    garbage = root;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_take_aux(_Node *&node)
+  {
+    _Node *taken = node;
+    node = nullptr;
+    return taken;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_join_aux(_Node *left, _Node *node, _Node *right) const
+  {
+    _Node *root;
+    if (_get_height(left) > _get_height(right) + 1)
+    {
+      root = _join_right_aux(left, node, right);
+    }
+    else if (_get_height(right) > _get_height(left) + 1)
+    {
+      root = _join_left_aux(left, node, right);
+    }
+    else
+    {
+      root = _make_node_aux(left, node, right);
+    }
+    root->__parent = nullptr;
+    return root;
+  }
+
+  // left is the taller, walk down its right spine until right fits next to it
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_join_right_aux(_Node *left, _Node *node, _Node *right) const
+  {
+    _Node *left_left = left->__left;
+    _Node *left_right = left->__right;
+    if (_get_height(left_right) <= _get_height(right) + 1)
+    {
+      _Node *joined = _make_node_aux(left_right, node, right);
+      if (_get_height(joined) <= _get_height(left_left) + 1)
       {
-        node_ptr[index] = *it1; // *it1 returns *Data_t
-        ++it1;
-        ++index;
+        _set_right_aux(left, joined);
+        _update_node(*left);
+        return left;
       }
+      this->_count_rotation(tree_stats::RL);
+      _set_right_aux(left, _rotate_right_aux(joined));
+      _update_node(*left);
+      return _rotate_left_aux(left);
+    }
+
+    _Node *joined = _join_right_aux(left_right, node, right);
+    _set_right_aux(left, joined);
+    _update_node(*left);
+    if (_get_height(joined) <= _get_height(left_left) + 1)
+    {
+      return left;
+    }
+    this->_count_rotation(tree_stats::RR);
+    return _rotate_left_aux(left);
+  }
 
-      while (it2 != end2)
+  // right is the taller, walk down its left spine until left fits next to it
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_join_left_aux(_Node *left, _Node *node, _Node *right) const
+  {
+    _Node *right_left = right->__left;
+    _Node *right_right = right->__right;
+    if (_get_height(right_left) <= _get_height(left) + 1)
+    {
+      _Node *joined = _make_node_aux(left, node, right_left);
+      if (_get_height(joined) <= _get_height(right_right) + 1)
       {
-        node_ptr[index] = *it2; // *it1 returns *Data_t
-        ++it2;
-        ++index;
+        _set_left_aux(right, joined);
+        _update_node(*right);
+        return right;
       }
+      this->_count_rotation(tree_stats::LR);
+      _set_left_aux(right, _rotate_left_aux(joined));
+      _update_node(*right);
+      return _rotate_right_aux(right);
+    }
 
-      // clean up the trees so no accidental deletion of memory takes place
-      t1.set_root(nullptr);
-      t1.set_size(0);
-      t1.set_max_element(nullptr);
-      t1.set_min_element(nullptr);
-      t2.set_root(nullptr);
-      t2.set_size(0);
-      t2.set_max_element(nullptr);
-      t2.set_min_element(nullptr);
+    _Node *joined = _join_left_aux(left, node, right_left);
+    _set_left_aux(right, joined);
+    _update_node(*right);
+    if (_get_height(joined) <= _get_height(right_right) + 1)
+    {
+      return right;
+    }
+    this->_count_rotation(tree_stats::LL);
+    return _rotate_right_aux(right);
+  }
 
-      // node_ptr now holds pointers to the ordered data in both trees
-      // index is the amount of (non-duplicates) data in the *new* tree, index > 0 guaranteed
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_join2_aux(_Node *left, _Node *right) const
+  {
+    if (left == nullptr)
+    {
+      return right;
+    }
+    if (right == nullptr)
+    {
+      return left;
+    }
+    _Node *last;
+    _Node *rest = _split_last_aux(left, last);
+    return _join_aux(rest, last, right);
+  }
 
-      // we now need to build an almost complete binary tree using the array method
-      // an almost complete binary (search) tree is considered an AVL tree since it abides by it's rules
-      united_tree.set_root(tree::_create_almost_full_tree_in_place(node_ptr, index));
-      united_tree.set_size(index);
-      united_tree.set_max_element(united_tree._find_max());
-      united_tree.set_min_element(united_tree._find_min());
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_split_last_aux(_Node *root, _Node *&last) const
+  {
+    if (root->__right == nullptr)
+    {
+      _Node *rest = root->__left;
+      if (rest)
+      {
+        rest->__parent = nullptr;
+      }
+      last = root;
+      last->__left = nullptr;
+      last->__parent = nullptr;
+      return rest;
+    }
 
-      delete[] node_ptr;
+    _Node *root_left = root->__left;
+    _Node *root_right = root->__right;
+    if (root_left)
+    {
+      root_left->__parent = nullptr;
     }
-    return united_tree;
+    root_right->__parent = nullptr;
+    _Node *rest = _split_last_aux(root_right, last);
+    return _join_aux(root_left, root, rest);
   }
 
-  // * helper methods
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_split_aux(_Node *root, const Key &key, _Node *&left, _Node *&right) const
+  {
+    if (root == nullptr)
+    {
+      left = nullptr;
+      right = nullptr;
+      return nullptr;
+    }
 
-  // -*- general tree helper methods -*- //
+    _Node *root_left = root->__left;
+    _Node *root_right = root->__right;
+    if (root_left)
+    {
+      root_left->__parent = nullptr;
+    }
+    if (root_right)
+    {
+      root_right->__parent = nullptr;
+    }
+
+    if (_less(key, root->__data))
+    {
+      // go left, key < root data
+      _Node *middle;
+      _Node *found = _split_aux(root_left, key, left, middle);
+      right = _join_aux(middle, root, root_right);
+      return found;
+    }
+    if (_less(root->__data, key))
+    {
+      // go right, root data < key
+      _Node *middle;
+      _Node *found = _split_aux(root_right, key, middle, right);
+      left = _join_aux(root_left, root, middle);
+      return found;
+    }
 
-  template <typename Data_t, typename less>
-  bool tree<Data_t, less>::_insert_aux(const Data_t &data)
+    // root data == key
+    left = root_left;
+    right = root_right;
+    root->__left = nullptr;
+    root->__right = nullptr;
+    root->__parent = nullptr;
+    _update_node(*root);
+    return root;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_split_tree_aux(const Key &key)
   {
-    std::pair<_Node *, _Node **> parent_data_pair = _search_place_aux(data);
-    _Node *parent_ptr = parent_data_pair.first;
-    _Node **data_pptr = parent_data_pair.second;
+    tree split_tree(key_comp(), __allocator);
+    if (__root == nullptr)
+    {
+      return split_tree;
+    }
 
-    assert(data_pptr != nullptr);
-    if (*data_pptr)
+    // the split off nodes still live in our pool's chunks, the new pool keeps it alive but has a free list of its own,
+    // so the 2 trees never touch the same pool state and can be used from different threads
+    split_tree._get_pool().keep_alive(__pool);
+
+    _Node *left, *right;
+    _Node *found = _split_aux(__root, key, left, right);
+    if (found)
     {
-      return false;
+      right = _join_aux(nullptr, found, right);
     }
 
-    /* AVL tree specific implementation */
+    size_t left_size = _get_split_size_aux(left, right, __size, std::integral_constant<bool, Ranked>());
 
-    /* adding node logic */
-    *data_pptr = new _Node(data);
-    (*data_pptr)->__parent = parent_ptr;
+    split_tree.__root = right;
+    split_tree.__size = __size - left_size;
+    split_tree.__min_element = _get_left_most_node(right);
+    split_tree.__max_element = _get_right_most_node(right);
 
-    _balance_to_root(data_pptr);
+    __root = left;
+    __size = left_size;
+    __min_element = _get_left_most_node(left);
+    __max_element = _get_right_most_node(left);
 
-    return true;
+    return split_tree;
   }
 
-  template <typename Data_t, typename less>
-  bool tree<Data_t, less>::_remove_aux(const Data_t &data)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename T>
+  tree<Data_t, less, Alloc, Ranked, Augment, Stats> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_join_tree_aux(tree &t1, T &&data, tree &t2)
   {
+    tree joined_tree(t1.key_comp(), t1.get_allocator());
+    if ((t1.__max_element && !joined_tree._less(t1.__max_element->__data, data)) ||
+        (t2.__min_element && !joined_tree._less(data, t2.__min_element->__data)))
+    {
+      throw bad_input("joining failed.");
+    }
 
-    std::pair<_Node *, _Node **> parent_data_pair = _search_place_aux(data);
-    _Node *parent_ptr = parent_data_pair.first;
-    _Node **data_pptr = parent_data_pair.second;
+    joined_tree._adopt_pool(t1);
+    joined_tree._adopt_pool(t2);
+    _Node *node = joined_tree._create_node(std::forward<T>(data));
 
-    assert(data_pptr != nullptr);
-    if (*data_pptr == nullptr)
+    joined_tree.__root = joined_tree._join_aux(t1.__root, node, t2.__root);
+    joined_tree.__size = t1.__size + 1 + t2.__size;
+    joined_tree.__min_element = t1.__min_element ? t1.__min_element : node;
+    joined_tree.__max_element = t2.__max_element ? t2.__max_element : node;
+
+    t1._release_aux();
+    t2._release_aux();
+    return joined_tree;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  size_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_get_split_size_aux(_Node *left, _Node *, size_t, std::true_type)
+  {
+    return _get_count(left);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  size_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_get_split_size_aux(_Node *left, _Node *right, size_t size, std::false_type)
+  {
+    // walk both trees at the same pace (left from its min, right from its max), the smaller one ends first
+    _Node *left_node = _get_left_most_node(left);
+    _Node *right_node = _get_right_most_node(right);
+    size_t steps = 0;
+    while (left_node && right_node)
     {
-      /* nothing to remove */
-      return false;
+      left_node = _get_next_node(left_node);
+      right_node = _get_prev_node(right_node);
+      ++steps;
     }
+    return left_node ? size - steps : steps;
+  }
 
-    /* removing node logic */
-    /* AVL tree specific implementation */
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_make_node_aux(_Node *left, _Node *node, _Node *right)
+  {
+    _set_left_aux(node, left);
+    _set_right_aux(node, right);
+    _update_node(*node);
+    return node;
+  }
 
-    _Node **node_pptr = data_pptr;
-    bool left_exists = (*data_pptr)->__left != nullptr;
-    bool right_exists = (*data_pptr)->__right != nullptr;
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_set_left_aux(_Node *node, _Node *left)
+  {
+    node->__left = left;
+    if (left)
+    {
+      left->__parent = node;
+    }
+  }
 
-    if (left_exists && right_exists) /* both children */
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_set_right_aux(_Node *node, _Node *right)
+  {
+    node->__right = right;
+    if (right)
     {
-      parent_ptr = (*node_pptr);
-      node_pptr = &((*data_pptr)->__right);
+      right->__parent = node;
+    }
+  }
 
-      while ((*node_pptr)->__left)
-      {
-        parent_ptr = (*node_pptr);
-        node_pptr = &((*node_pptr)->__left);
-      }
+  // same as _rotate_left, for a sub tree that isn't linked to the tree
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_rotate_left_aux(_Node *node)
+  {
+    _Node *right = node->__right;
+    right->__parent = node->__parent;
+    _set_right_aux(node, right->__left);
+    _set_left_aux(right, node);
+    _update_node(*node);
+    _update_node(*right);
+    return right;
+  }
 
-      _swap_nodes(node_pptr, data_pptr);
+  // same as _rotate_right, for a sub tree that isn't linked to the tree
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_rotate_right_aux(_Node *node)
+  {
+    _Node *left = node->__left;
+    left->__parent = node->__parent;
+    _set_left_aux(node, left->__right);
+    _set_right_aux(left, node);
+    _update_node(*node);
+    _update_node(*left);
+    return left;
+  }
 
-      _Node *to_delete = *node_pptr;
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  int tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_get_height(const _Node *node)
+  {
+    return node ? node->__height : -1;
+  }
 
-      *node_pptr = (*node_pptr)->__right;
-      if (*node_pptr)
-      {
-        // update the parent of the child of the node to delete
-        (*node_pptr)->__parent = (*node_pptr)->__parent->__parent;
-      }
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_release_aux()
+  {
+    __root = nullptr;
+    __size = 0;
+    __min_element = nullptr;
+    __max_element = nullptr;
+  }
 
-      node_pptr = _get_node_pptr(parent_ptr);
+  // -*- node allocation helper methods -*- //
 
-      delete to_delete;
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_node_pool &tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_get_pool()
+  {
+    if (!__pool)
+    {
+      __pool = std::allocate_shared<_node_pool>(__allocator, _node_allocator(__allocator));
     }
-    else
+    return *__pool;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename... Args>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_create_node(Args &&...args)
+  {
+    _node_pool &pool = _get_pool();
+    _Node *slot = pool.allocate();
+    this->_count_node();
+    try
     {
-      _Node *to_delete = *node_pptr;
+      return ::new (static_cast<void *>(slot)) _Node(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+      pool.deallocate(slot);
+      throw;
+    }
+  }
 
-      if (left_exists) /* only the left child */
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_destroy_node(_Node *node)
+  {
+    node->~_Node();
+    __pool->deallocate(node);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_adopt_pool(tree &other)
+  {
+    if (!other.__pool || other.__pool == __pool)
+    {
+      return;
+    }
+    if (!__pool)
+    {
+      __pool = std::move(other.__pool);
+      return;
+    }
+    __pool->absorb(other.__pool);
+    other.__pool.reset();
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key>
+  std::pair<const typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *, const typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *const *> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_search_place_aux(const Key &data) const
+  {
+    const _Node *parent_ptr = nullptr;
+    const _Node *const *curr_pptr = &__root;
+    size_t depth = 0;
+    while (*curr_pptr)
+    {
+      ++depth;
+      // update the node
+      if (_less(data, (*curr_pptr)->__data))
       {
-        *node_pptr = (*node_pptr)->__left;
+        // go left, data < current data
+        parent_ptr = *curr_pptr;
+        curr_pptr = &((*curr_pptr)->__left);
       }
-      else /* no children - or - only the right child */
+      else if (_less((*curr_pptr)->__data, data))
       {
-        *node_pptr = (*node_pptr)->__right;
+        // go right, current data < data
+        parent_ptr = *curr_pptr;
+        curr_pptr = &((*curr_pptr)->__right);
+      }
+      else
+      {
+        // data is in node, so the parent is the node and
+        // curr is a pointer to that pointer
+        break;
+      }
+    }
+    this->_count_search(depth);
+    return {parent_ptr, curr_pptr};
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key>
+  std::pair<typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *, typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node **> tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_search_place_aux(const Key &data)
+  {
+    _Node *parent_ptr = nullptr;
+    _Node **curr_pptr = &__root;
+    size_t depth = 0;
+    while (*curr_pptr)
+    {
+      ++depth;
+      // update the node
+      if (_less(data, (*curr_pptr)->__data))
+      {
+        // go left, data < current data
+        parent_ptr = *curr_pptr;
+        curr_pptr = &((*curr_pptr)->__left);
+      }
+      else if (_less((*curr_pptr)->__data, data))
+      {
+        // go right, current data < data
+        parent_ptr = *curr_pptr;
+        curr_pptr = &((*curr_pptr)->__right);
+      }
+      else
+      {
+        // data is in node, so the parent is the node and
+        // curr is a pointer to that pointer
+        break;
       }
+    }
+    this->_count_search(depth);
+    return {parent_ptr, curr_pptr};
+  }
 
-      if (*node_pptr)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key>
+  size_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_rank_aux(const Key &key) const
+  {
+    static_assert(Ranked, "rank() and count_range() require a Ranked tree");
+    size_t rank = 0;
+    const _Node *node = __root;
+    while (node)
+    {
+      if (_less(node->__data, key))
       {
-        (*node_pptr)->__parent = parent_ptr;
+        // the node and its whole left sub tree are smaller than key
+        rank += _get_count(node->__left) + 1;
+        node = node->__right;
+      }
+      else
+      {
+        node = node->__left;
       }
+    }
+    return rank;
+  }
 
-      node_pptr = _get_node_pptr(parent_ptr);
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::augment_type tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_fold_range_aux(const Key &lo, const Key &hi) const
+  {
+    static_assert(_augment_traits<Augment>::enabled, "fold_range() requires an Augment policy");
 
-      delete to_delete;
+    // find the highest node in the range, the range splits there
+    const _Node *node = __root;
+    while (node)
+    {
+      if (_less(node->__data, lo))
+      {
+        node = node->__right;
+      }
+      else if (!_less(node->__data, hi))
+      {
+        node = node->__left;
+      }
+      else
+      {
+        break;
+      }
+    }
+    if (node == nullptr)
+    {
+      return Augment::identity();
     }
 
-    _balance_to_root(node_pptr);
+    // the data >= lo in the left sub tree, folded from right to left
+    augment_type left_fold = Augment::identity();
+    for (const _Node *curr = node->__left; curr;)
+    {
+      if (_less(curr->__data, lo))
+      {
+        curr = curr->__right;
+      }
+      else
+      {
+        // the node and its whole right sub tree are in the range
+        left_fold = Augment::combine(Augment::combine(Augment::lift(curr->__data), _get_augment(curr->__right)), left_fold);
+        curr = curr->__left;
+      }
+    }
 
-    return true;
-  }
+    // the data < hi in the right sub tree, folded from left to right
+    augment_type right_fold = Augment::identity();
+    for (const _Node *curr = node->__right; curr;)
+    {
+      if (_less(curr->__data, hi))
+      {
+        // the node and its whole left sub tree are in the range
+        right_fold = Augment::combine(right_fold, Augment::combine(_get_augment(curr->__left), Augment::lift(curr->__data)));
+        curr = curr->__right;
+      }
+      else
+      {
+        curr = curr->__left;
+      }
+    }
 
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::_clear_aux()
-  {
-    __size -= _destroy_tree(&__root);
-#ifdef AVL_TREE_TEST
-    assert(__size == 0);
-#endif
+    return Augment::combine(Augment::combine(left_fold, Augment::lift(node->__data)), right_fold);
   }
 
-  template <typename Data_t, typename less>
-  std::pair<const typename tree<Data_t, less>::_Node *, const typename tree<Data_t, less>::_Node *const *> tree<Data_t, less>::_search_place_aux(const Data_t &data) const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Point, typename OutputIt>
+  OutputIt tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_stab_aux(const Point &point, OutputIt out) const
   {
-    const _Node *parent_ptr = nullptr;
-    const _Node *const *curr_pptr = &__root;
-    while (*curr_pptr)
+    // an in-order walk through the parent links, from is the node we came from
+    const _Node *node = __root, *from = nullptr;
+    while (node)
     {
-      // update the node
-      if (less()(data, (*curr_pptr)->__data))
+      const _Node *next = node->__parent;
+      bool visit = false;
+      if (from == node->__parent)
       {
-        // go left, data < current data
-        parent_ptr = *curr_pptr;
-        curr_pptr = &((*curr_pptr)->__left);
+        // going down, unless no interval in this sub tree reaches the point
+        if (!(node->__aug < point))
+        {
+          next = node->__left;
+          visit = (next == nullptr);
+        }
       }
-      else if (less()((*curr_pptr)->__data, data))
+      else if (from == node->__left)
       {
-        // go right, current data < data
-        parent_ptr = *curr_pptr;
-        curr_pptr = &((*curr_pptr)->__right);
+        visit = true;
       }
-      else
+      // else the right sub tree is done, going up
+
+      if (visit)
       {
-        // data is in node, so the parent is the node and
-        // curr is a pointer to that pointer
-        break;
+        // the intervals are ordered by their low end, nothing from here on starts before the point
+        if (point < Augment::low(node->__data))
+        {
+          return out;
+        }
+        if (!(Augment::high(node->__data) < point))
+        {
+          *out = node->__data;
+          ++out;
+        }
+        next = node->__right ? node->__right : node->__parent;
       }
+      from = node;
+      node = next;
     }
-    return {parent_ptr, curr_pptr};
+    return out;
   }
 
-  template <typename Data_t, typename less>
-  std::pair<typename tree<Data_t, less>::_Node *, typename tree<Data_t, less>::_Node **> tree<Data_t, less>::_search_place_aux(const Data_t &data)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_lower_bound_aux(const Key &key) const
   {
-    _Node *parent_ptr = nullptr;
-    _Node **curr_pptr = &__root;
-    while (*curr_pptr)
+    _Node *bound = nullptr;
+    _Node *node = __root;
+    size_t depth = 0;
+    while (node)
     {
-      // update the node
-      if (less()(data, (*curr_pptr)->__data))
+      ++depth;
+      if (_less(node->__data, key))
       {
-        // go left, data < current data
-        parent_ptr = *curr_pptr;
-        curr_pptr = &((*curr_pptr)->__left);
+        node = node->__right;
       }
-      else if (less()((*curr_pptr)->__data, data))
+      else
       {
-        // go right, current data < data
-        parent_ptr = *curr_pptr;
-        curr_pptr = &((*curr_pptr)->__right);
+        // node is a candidate, a smaller one may be on its left
+        bound = node;
+        node = node->__left;
+      }
+    }
+    this->_count_search(depth);
+    return bound;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_upper_bound_aux(const Key &key) const
+  {
+    _Node *bound = nullptr;
+    _Node *node = __root;
+    size_t depth = 0;
+    while (node)
+    {
+      ++depth;
+      if (_less(key, node->__data))
+      {
+        // node is a candidate, a smaller one may be on its left
+        bound = node;
+        node = node->__left;
       }
       else
       {
-        // data is in node, so the parent is the node and
-        // curr is a pointer to that pointer
-        break;
+        node = node->__right;
       }
     }
-    return {parent_ptr, curr_pptr};
+    this->_count_search(depth);
+    return bound;
   }
 
-  template <typename Data_t, typename less>
-  const typename tree<Data_t, less>::_Node *tree<Data_t, less>::_search_aux(const Data_t &data) const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key>
+  const typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_search_aux(const Key &key) const
   {
-    _Node *ptr = *(_search_place_aux(data).second);
+    const _Node *ptr = *(_search_place_aux(key).second);
     if (ptr == nullptr)
     {
       throw data_not_found();
     }
-    return ptr->__data;
+    return ptr;
   }
 
-  template <typename Data_t, typename less>
-  typename tree<Data_t, less>::_Node *tree<Data_t, less>::_search_aux(const Data_t &data)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Key>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_search_aux(const Key &key)
   {
-    _Node *ptr = *(_search_place_aux(data).second);
+    _Node *ptr = *(_search_place_aux(key).second);
     if (ptr == nullptr)
     {
       throw data_not_found();
     }
-    return ptr->__data;
+    return ptr;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename ForwardIt, typename Visit>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_search_batch_aux(ForwardIt first, ForwardIt last, Visit visit) const
+  {
+    typedef typename std::iterator_traits<ForwardIt>::value_type key_type;
+
+    const key_type *keys[__batch_lanes];
+    const _Node *nodes[__batch_lanes]; // nullptr once the lane is done
+    const _Node *found[__batch_lanes];
+    while (first != last)
+    {
+      size_t count = 0;
+      for (; count < __batch_lanes && first != last; ++first, ++count)
+      {
+        keys[count] = std::addressof(*first);
+        nodes[count] = __root;
+        found[count] = nullptr;
+      }
+
+      // each lane takes a step, then prefetches its next node for the next round
+      size_t active = count;
+      while (active)
+      {
+        active = 0;
+        for (size_t lane = 0; lane < count; ++lane)
+        {
+          const _Node *node = nodes[lane];
+          if (node == nullptr)
+          {
+            continue;
+          }
+          if (_less(*keys[lane], node->__data))
+          {
+            node = node->__left;
+          }
+          else if (_less(node->__data, *keys[lane]))
+          {
+            node = node->__right;
+          }
+          else
+          {
+            found[lane] = node;
+            node = nullptr;
+          }
+          if (node)
+          {
+            _prefetch_read(node);
+            ++active;
+          }
+          nodes[lane] = node;
+        }
+      }
+
+      for (size_t lane = 0; lane < count; ++lane)
+      {
+        visit(*keys[lane], found[lane]);
+      }
+    }
   }
 
-  template <typename Data_t, typename less>
-  size_t tree<Data_t, less>::_destroy_tree_iter(typename tree<Data_t, less>::_Node **root)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  size_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_destroy_tree_iter(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node **root)
   {
-    // TODO: implement this iteratively
-    return 0;
+    size_t amount = 0;
+    _Node *node = *root;
+    while (node)
+    {
+      if (node->__left)
+      {
+        // rotate the left child up, the nodes still waiting end up on a right spine
+        _Node *left = node->__left;
+        node->__left = left->__right;
+        left->__right = node;
+        node = left;
+      }
+      else
+      {
+        _Node *right = node->__right;
+        _destroy_node(node);
+        ++amount;
+        node = right;
+      }
+    }
+    *root = nullptr;
+    return amount;
   }
 
-  template <typename Data_t, typename less>
-  size_t tree<Data_t, less>::_destroy_tree_rec(typename tree<Data_t, less>::_Node **root)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  size_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_destroy_tree_rec(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node **root)
   {
     if (*root == nullptr)
     {
       return 0;
     }
     size_t amount = 1 + _destroy_tree_rec(&((*root)->__left)) + _destroy_tree_rec(&((*root)->__right));
-    delete *root;
+    _destroy_node(*root);
     *root = nullptr;
     return amount;
   }
 
-  template <typename Data_t, typename less>
-  typename tree<Data_t, less>::_Node *tree<Data_t, less>::_copy_tree_iter(typename tree<Data_t, less>::_Node *root)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_copy_tree_iter(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *root)
   {
-    // TODO: implement this iteratively
-    return nullptr;
+    if (root == nullptr)
+    {
+      return nullptr;
+    }
+
+    _Node *copy_root = _create_node(root->__data);
+    try
+    {
+      // walk both trees together, a node is done once both its children are copied
+      _Node *source = root;
+      _Node *copy = copy_root;
+      while (true)
+      {
+        if (source->__left && !copy->__left)
+        {
+          copy->__left = _create_node(source->__left->__data);
+          copy->__left->__parent = copy;
+          source = source->__left;
+          copy = copy->__left;
+        }
+        else if (source->__right && !copy->__right)
+        {
+          copy->__right = _create_node(source->__right->__data);
+          copy->__right->__parent = copy;
+          source = source->__right;
+          copy = copy->__right;
+        }
+        else
+        {
+          _update_node(*copy);
+          if (source == root)
+          {
+            break;
+          }
+          source = source->__parent;
+          copy = copy->__parent;
+        }
+      }
+    }
+    catch (...)
+    {
+      _destroy_tree_iter(&copy_root);
+      throw;
+    }
+    return copy_root;
   }
 
-  template <typename Data_t, typename less>
-  typename tree<Data_t, less>::_Node *tree<Data_t, less>::_copy_tree_rec(typename tree<Data_t, less>::_Node *root)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_copy_tree_rec(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *root)
   {
     if (root == nullptr)
     {
       return nullptr;
     }
 
-    _Node *node = new _Node(root->__data);
+    _Node *node = _create_node(root->__data);
 
-    node->__left = _copy_tree_rec(&((*root)->__left));
+    node->__left = _copy_tree_rec(root->__left);
     if (node->__left)
     {
-      node->__left->__parent = root;
+      node->__left->__parent = node;
     }
 
-    node->__right = _copy_tree_rec(&((*root)->__right));
+    node->__right = _copy_tree_rec(root->__right);
     if (node->__right)
     {
-      node->__right->__parent = root;
+      node->__right->__parent = node;
     }
 
-    node->__height = root->__height;
+    _update_node(*node);
 
     return node;
   }
 
-  template <typename Data_t, typename less>
-  ssize_t tree<Data_t, less>::_get_tree_height_iter(typename tree<Data_t, less>::_Node &node) const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  ssize_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_get_tree_height_iter(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node &node) const
   {
-    // TODO: implement this iteratively
-    return 0;
+    ssize_t height = 0;
+    _walk_tree_iter(&node, [&height](const _Node *, ssize_t depth)
+                    { height = std::max(height, depth); });
+    return height;
   }
 
-  template <typename Data_t, typename less>
-  ssize_t tree<Data_t, less>::_get_tree_height_rec(typename tree<Data_t, less>::_Node *node) const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  ssize_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_get_tree_height_rec(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *node) const
   {
     if (!node)
       return -1;
     return 1 + std::max(_get_tree_height_rec(node->__left), _get_tree_height_rec(node->__right));
   }
 
-  template <typename Data_t, typename less>
-  ssize_t tree<Data_t, less>::_get_tree_size_iter(_Node *node) const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  ssize_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_get_tree_size_iter(_Node *node) const
+  {
+    ssize_t size = 0;
+    _walk_tree_iter(node, [&size](const _Node *, ssize_t)
+                    { ++size; });
+    return size;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename Visit>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_walk_tree_iter(const _Node *root, Visit visit)
   {
-    // TODO: implement this iteratively
-    return 0;
+    if (root == nullptr)
+    {
+      return;
+    }
+
+    // prev tells where we came from: the parent (going down), or one of the children (going up)
+    const _Node *curr = root;
+    const _Node *prev = root->__parent;
+    ssize_t depth = 0;
+    while (true)
+    {
+      if (prev == curr->__parent)
+      {
+        visit(curr, depth);
+        if (curr->__left)
+        {
+          prev = curr;
+          curr = curr->__left;
+          ++depth;
+          continue;
+        }
+      }
+      if (prev != curr->__right && curr->__right)
+      {
+        prev = curr;
+        curr = curr->__right;
+        ++depth;
+        continue;
+      }
+      // both sub trees are done
+      if (curr == root)
+      {
+        break;
+      }
+      prev = curr;
+      curr = curr->__parent;
+      --depth;
+    }
   }
 
-  template <typename Data_t, typename less>
-  ssize_t tree<Data_t, less>::_get_tree_size_rec(_Node *node) const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  ssize_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_get_tree_size_rec(_Node *node) const
   {
     if (!node)
       return 0;
     return 1 + _get_tree_size_rec(node->__left) + _get_tree_size_rec(node->__right);
   }
 
-  template <typename Data_t, typename less>
-  typename tree<Data_t, less>::_Node *tree<Data_t, less>::_get_left_most_node(typename tree<Data_t, less>::_Node *node)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_get_left_most_node(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *node)
   {
     while (node && node->__left)
       node = node->__left;
     return node;
   }
 
-  template <typename Data_t, typename less>
-  typename tree<Data_t, less>::_Node *tree<Data_t, less>::_get_right_most_node(typename tree<Data_t, less>::_Node *node)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_get_right_most_node(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *node)
   {
     while (node && node->__right)
       node = node->__right;
     return node;
   }
 
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::_swap_nodes(typename tree<Data_t, less>::_Node **a, typename tree<Data_t, less>::_Node **b)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_get_next_node(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *node)
+  {
+    if (node->__right)
+    {
+      return _get_left_most_node(node->__right);
+    }
+    _Node *p = node->__parent;
+    while (p && node == p->__right)
+    {
+      node = p;
+      p = p->__parent;
+    }
+    return p;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_get_prev_node(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *node)
   {
-    if (a && *a && b && *b)
+    if (node->__left)
+    {
+      return _get_right_most_node(node->__left);
+    }
+    _Node *p = node->__parent;
+    while (p && node == p->__left)
     {
-      swap((*a)->__data, (*b)->__data);
+      node = p;
+      p = p->__parent;
     }
+    return p;
   }
 
-  template <typename Data_t, typename less>
-  typename tree<Data_t, less>::_Node **tree<Data_t, less>::_get_node_pptr(typename tree<Data_t, less>::_Node *node_ptr)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node **tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_get_node_pptr(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *node_ptr)
   {
     _Node **pptr = nullptr;
     if (node_ptr)
@@ -1072,92 +5100,279 @@ namespace avl
     return pptr;
   }
 
-  template <typename Data_t, typename less>
-  typename tree<Data_t, less>::_Node *tree<Data_t, less>::_create_almost_full_tree(const Data_t **data_ptr, size_t size)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  size_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_get_almost_full_left_size(size_t size)
   {
-    if (data_ptr == nullptr || size == 0)
+    if (size <= 1)
     {
-      return nullptr;
+      return 0;
     }
-    else if (size == 1)
+
+    // 2^h <= size < 2^(h+1), guard against the rounding of log2
+    size_t tree_height = static_cast<size_t>(std::log2(static_cast<double>(size))); // since (size >= 2) then (tree_height >= 1)
+    while ((size_t(1) << tree_height) > size)
     {
-      return new typename tree<Data_t, less>::_Node(*(data_ptr[0]));
+      --tree_height;
     }
-    else // size >= 2
+    while (tree_height + 1 < sizeof(size_t) * 8 && (size_t(1) << (tree_height + 1)) <= size)
     {
-      size_t tree_height = static_cast<size_t>(std::log2(size));                                               // since (size >= 2) then (tree_height >= 1)
-      size_t tree_leaves = size - (2 << (tree_height - 1)) + 1;                                                // n - 2^(h-1) - 1
-      size_t left_size = (1 << (tree_height - 1)) - 1 + std::min<size_t>(tree_leaves, 1 << (tree_height - 1)); // 2^(h-1) - 1 + min( tree leaves , 2^(h-1) )
-      size_t right_size = size - left_size - 1;
+      ++tree_height;
+    }
 
-      typename tree<Data_t, less>::_Node *node = new typename tree<Data_t, less>::_Node(*(data_ptr[left_size]));
-      size_t node_height = 0;
+    size_t half_leaves = size_t(1) << (tree_height - 1);
+    size_t tree_leaves = size - (size_t(1) << tree_height) + 1;    // n - 2^h + 1
+    return half_leaves - 1 + std::min<size_t>(tree_leaves, half_leaves); // 2^(h-1) - 1 + min( tree leaves , 2^(h-1) )
+  }
 
-      node->__left = _create_almost_full_tree(data_ptr, left_size);
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename ForwardIt>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_create_almost_full_tree_from_sequence(ForwardIt &it, size_t size)
+  {
+    if (size == 0)
+    {
+      return nullptr;
+    }
+
+    size_t left_size = _get_almost_full_left_size(size);
+    size_t right_size = size - left_size - 1;
+
+    // in-order, so the sequence is only read once
+    _Node *left = _create_almost_full_tree_from_sequence(it, left_size);
+
+    // reading the sequence may throw (a streamed one), what was built so far is destroyed
+    _Node *node = nullptr;
+    try
+    {
+      node = _create_node(*it);
+      ++it;
+      node->__left = left;
       if (node->__left)
       {
         node->__left->__parent = node;
-        node_height += node->__left->__height;
       }
-
-      node->__right = _create_almost_full_tree(data_ptr + left_size + 1, right_size);
-      if (node->__right)
+      node->__right = _create_almost_full_tree_from_sequence(it, right_size);
+    }
+    catch (...)
+    {
+      if (node)
       {
-        node->__right->__parent = node;
-        node_height += node->__right->__height;
+        node->__left = nullptr;
+        _destroy_node(node);
       }
+      _destroy_tree(&left);
+      throw;
+    }
+    if (node->__right)
+    {
+      node->__right->__parent = node;
+    }
 
-      node->__height = node_height;
+    _update_node(*node);
 
-      return node;
+    return node;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  template <typename RandomIt>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_create_almost_full_tree_parallel(RandomIt first, size_t size, unsigned threads, size_t cutoff)
+  {
+    if (threads <= 1 || size <= cutoff)
+    {
+      return _create_almost_full_tree_from_sequence(first, size);
+    }
+
+    size_t left_size = _get_almost_full_left_size(size);
+    size_t right_size = size - left_size - 1;
+
+    // the pool isn't thread safe, the left half gets its own
+    tree left_tree(key_comp(), __allocator);
+    std::future<_Node *> left_future;
+    try
+    {
+      left_future = std::async(std::launch::async, [&]()
+                               { return left_tree._create_almost_full_tree_parallel(first, left_size, threads / 2, cutoff); });
+    }
+    catch (const std::system_error &)
+    {
+      // no thread could be started, the rest is built here
+      return _create_almost_full_tree_from_sequence(first, size);
+    }
+
+    // in case of an exception the halves already built are destroyed, each with the pool it was allocated from
+    RandomIt middle = first + left_size;
+    _Node *node = nullptr;
+    _Node *right = nullptr;
+    try
+    {
+      node = _create_node(*middle);
+      right = _create_almost_full_tree_parallel(middle + 1, right_size, threads - threads / 2, cutoff);
+    }
+    catch (...)
+    {
+      try
+      {
+        _Node *left = left_future.get();
+        left_tree._destroy_tree(&left);
+      }
+      catch (...)
+      {
+      }
+      if (node)
+      {
+        _destroy_node(node);
+      }
+      throw;
+    }
+    _Node *left = nullptr;
+    try
+    {
+      left = left_future.get();
+    }
+    catch (...)
+    {
+      _destroy_tree(&right);
+      _destroy_node(node);
+      throw;
     }
+    _adopt_pool(left_tree);
+    this->_add_stats(left_tree._get_stats());
+
+    _make_node_aux(left, node, right);
+    node->__parent = nullptr;
+    return node;
   }
 
-  template <typename Data_t, typename less>
-  typename tree<Data_t, less>::_Node *tree<Data_t, less>::_create_almost_full_tree_in_place(typename tree<Data_t, less>::_Node **node_ptr, size_t size)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_create_almost_full_tree(const Data_t **data_ptr, size_t size)
   {
-    if (node_ptr == nullptr || size == 0)
+    if (data_ptr == nullptr || size == 0)
     {
       return nullptr;
     }
     else if (size == 1)
     {
-      return new typename tree<Data_t, less>::_Node(*(node_ptr[0]));
+      typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *node = _create_node(*(data_ptr[0]));
+      _update_node(*node);
+      return node;
     }
     else // size >= 2
     {
-      size_t tree_height = static_cast<size_t>(std::log2(size));                                               // since (size >= 2) then (tree_height >= 1)
-      size_t tree_leaves = size - (2 << (tree_height - 1)) + 1;                                                // n - 2^(h-1) - 1
-      size_t left_size = (1 << (tree_height - 1)) - 1 + std::min<size_t>(tree_leaves, 1 << (tree_height - 1)); // 2^(h-1) - 1 + min( tree leaves , 2^(h-1) )
+      size_t left_size = _get_almost_full_left_size(size);
       size_t right_size = size - left_size - 1;
 
-      typename tree<Data_t, less>::_Node *node = node_ptr[left_size];
-      size_t node_height = 0;
+      typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *node = _create_node(*(data_ptr[left_size]));
 
-      node->__left = _create_almost_full_tree_in_place(node_ptr, left_size);
+      node->__left = _create_almost_full_tree(data_ptr, left_size);
       if (node->__left)
       {
         node->__left->__parent = node;
-        node_height += node->__left->__height;
       }
 
-      node->__right = _create_almost_full_tree_in_place(node_ptr + left_size + 1, right_size);
+      node->__right = _create_almost_full_tree(data_ptr + left_size + 1, right_size);
       if (node->__right)
       {
         node->__right->__parent = node;
-        node_height += node->__right->__height;
       }
 
-      node->__height = node_height;
+      _update_node(*node);
 
       return node;
     }
   }
 
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_tree_to_list_aux(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *root)
+  {
+    // rest is the part not flattened yet, *tail always points at it
+    _Node *list = root;
+    _Node **tail = &list;
+    _Node *rest = root;
+    while (rest)
+    {
+      if (rest->__left == nullptr)
+      {
+        tail = &rest->__right;
+        rest = rest->__right;
+      }
+      else
+      {
+        // rotate right, the left child moves up
+        _Node *left = rest->__left;
+        rest->__left = left->__right;
+        left->__right = rest;
+        rest = left;
+        *tail = rest;
+      }
+    }
+    return list;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_create_almost_full_tree_from_list(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *&list, size_t size)
+  {
+    // the recursion of _create_almost_full_tree_from_sequence with an explicit stack:
+    // a frame is a node waiting for its left sub tree (node is nullptr) or its right one
+    struct frame
+    {
+      size_t right_size;
+      _Node *node;
+    };
+    frame stack[std::numeric_limits<size_t>::digits];
+    size_t depth = 0;
+    size_t pending = size; // the size of the next sub tree to build
+
+    while (true)
+    {
+      // go down the left side of the pending sub tree
+      while (pending > 0)
+      {
+        size_t left_size = _get_almost_full_left_size(pending);
+        stack[depth].right_size = pending - left_size - 1;
+        stack[depth].node = nullptr;
+        ++depth;
+        pending = left_size;
+      }
+
+      // the sub tree that was just built
+      _Node *built = nullptr;
+      while (true)
+      {
+        if (depth == 0)
+        {
+          return built;
+        }
+        frame &top = stack[depth - 1];
+        if (top.node == nullptr)
+        {
+          // the left sub tree is done, the next node of the list is its parent
+          _Node *node = list;
+          list = list->__right;
+          node->__left = built;
+          if (built)
+          {
+            built->__parent = node;
+          }
+          top.node = node;
+          pending = top.right_size;
+          break;
+        }
+        // the right sub tree is done
+        top.node->__right = built;
+        if (built)
+        {
+          built->__parent = top.node;
+        }
+        _update_node(*top.node);
+        built = top.node;
+        --depth;
+      }
+    }
+  }
+
 #ifdef AVL_TREE_TEST
 
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::_print_tree() const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_print_tree() const
   {
     std::cout << "printing tree:" << std::endl;
     std::cout << "size = " << size() << std::endl;
@@ -1165,8 +5380,8 @@ namespace avl
     _print_tree_aux(__root, 0);
   }
 
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::_print_tree_aux(typename tree<Data_t, less>::_Node *root, size_t indentation) const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_print_tree_aux(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *root, size_t indentation) const
   {
     if (root)
     {
@@ -1188,16 +5403,51 @@ namespace avl
 
 #endif // AVL_TREE_TEST
 
-  template <typename Data_t, typename less>
-  size_t tree<Data_t, less>::_get_tree_height_from_children(_Node &node) const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  size_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_get_tree_height_from_children(_Node &node)
   {
     return std::max(
         (node.__left) ? (1 + node.__left->__height) : (0),
         (node.__right) ? (1 + node.__right->__height) : (0));
   }
 
-  template <typename Data_t, typename less>
-  typename tree<Data_t, less>::_Node *tree<Data_t, less>::_find_min() const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_update_node(_Node &node)
+  {
+    node.__height = _get_tree_height_from_children(node);
+    _update_count(node, std::integral_constant<bool, Ranked>());
+    _update_augment(node, std::integral_constant<bool, _augment_traits<Augment>::enabled>());
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_update_count(_Node &node, std::true_type)
+  {
+    node.__count = 1 + _get_count(node.__left) + _get_count(node.__right);
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  size_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_get_count(const _Node *node)
+  {
+    return node ? node->__count : 0;
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_update_augment(_Node &node, std::true_type)
+  {
+    // in-order: left sub tree, the node, right sub tree
+    node.__aug = Augment::combine(
+        Augment::combine(_get_augment(node.__left), Augment::lift(node.__data)),
+        _get_augment(node.__right));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::augment_type tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_get_augment(const _Node *node)
+  {
+    return node ? node->__aug : Augment::identity();
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_find_min() const
   {
     _Node *temp = __root;
     if (temp == nullptr)
@@ -1209,8 +5459,8 @@ namespace avl
     return temp;
   }
 
-  template <typename Data_t, typename less>
-  typename tree<Data_t, less>::_Node *tree<Data_t, less>::_find_max() const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_find_max() const
   {
     _Node *temp = __root;
     if (temp == nullptr)
@@ -1222,8 +5472,8 @@ namespace avl
     return temp;
   }
 
-  template <typename Data_t, typename less>
-  ssize_t tree<Data_t, less>::_get_balance_factor(typename tree<Data_t, less>::_Node *node) const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  ssize_t tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_get_balance_factor(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *node) const
   {
     if (node == nullptr)
     {
@@ -1232,8 +5482,8 @@ namespace avl
     return ((node->__left) ? (node->__left->__height) : (-1)) - ((node->__right) ? (node->__right->__height) : (-1));
   }
 
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::_balance_to_root(typename tree<Data_t, less>::_Node **node_pptr)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_balance_to_root(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node **node_pptr)
   {
     if (node_pptr == nullptr || *node_pptr == nullptr)
     {
@@ -1241,10 +5491,13 @@ namespace avl
     }
 
     _Node *temp = *node_pptr;
+    size_t steps = 0;
     while (temp)
     {
       // update the node values traversing up the tree
-      temp->__height = _get_tree_height_from_children(*temp);
+      int old_height = temp->__height;
+      _update_node(*temp);
+      ++steps;
 
       // rotate if needed
       int curr_bf = _get_balance_factor(temp);
@@ -1266,13 +5519,29 @@ namespace avl
       {
         _rotate_RR(node_pptr);
       }
+
+      // the sub tree is as high as before, so everything above it keeps its height and balance
+      // (an insert stops after at most 1 rotation). the start node doesn't count, a new leaf always looks unchanged
+      if (steps > 1 && (*node_pptr)->__height == old_height)
+      {
+        if (Ranked || _augment_traits<Augment>::enabled)
+        {
+          // the counts (augmented values) above still change, but nothing needs rotating
+          for (temp = (*node_pptr)->__parent; temp; temp = temp->__parent)
+          {
+            _update_node(*temp);
+          }
+        }
+        break;
+      }
       /**
        * these were problematic lines, we changed it with this
        * node_pptr = &(temp->__parent);
        * temp = temp->__parent;
        * so they had to be changed to this
+       * (after a rotation temp is under the new, balanced sub tree root, so go on from above that root)
        */
-      temp = temp->__parent;
+      temp = (*node_pptr)->__parent;
       if (temp)
       {
         if (temp->__parent == nullptr) // temp is root
@@ -1292,6 +5561,7 @@ namespace avl
         }
       }
     }
+    this->_count_rebalance(steps);
   }
 
   /*
@@ -1303,8 +5573,8 @@ namespace avl
    *    Bl   Br      |        Br   Ar
    *
    */
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::_rotate_right(typename tree<Data_t, less>::_Node **node)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_rotate_right(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node **node)
   {
     if (!node || !(*node) || !(*node)->__left)
     {
@@ -1328,17 +5598,17 @@ namespace avl
     if (Br_ptr)
       Br_ptr->__parent = A_ptr;
 
-    // update the heights (of the sub tree of the node)
+    // update the heights and sizes (of the sub tree of the node)
     // Bl Br Ar didn't have their heights change
-    A_ptr->__height = _get_tree_height_from_children(*A_ptr);
-    B_ptr->__height = _get_tree_height_from_children(*B_ptr);
+    _update_node(*A_ptr);
+    _update_node(*B_ptr);
 
     // if the rotating node is the root, change the tree root accordingly
     // B may be the root now (already switched parents with A)
     if (B_ptr->__parent == nullptr)
       this->__root = B_ptr;
 
-    // if other data should be update, update them here
+    // other data kept about the sub tree is updated by _update_node (above)
 
     return;
   }
@@ -1352,8 +5622,8 @@ namespace avl
    *        Bl   Br  |  Al   Bl
    *
    */
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::_rotate_left(typename tree<Data_t, less>::_Node **node)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_rotate_left(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node **node)
   {
     if (node == nullptr || *node == nullptr || (*node)->__right == nullptr)
     {
@@ -1377,23 +5647,23 @@ namespace avl
     if (Bl_ptr)
       Bl_ptr->__parent = A_ptr;
 
-    // update the heights (of the sub tree of the node)
+    // update the heights and sizes (of the sub tree of the node)
     // Bl Br Al didn't have their heights change
-    A_ptr->__height = _get_tree_height_from_children(*A_ptr);
-    B_ptr->__height = _get_tree_height_from_children(*B_ptr);
+    _update_node(*A_ptr);
+    _update_node(*B_ptr);
 
     // if the rotating node is the root, change the tree root accordingly
     // B may be the root now (already switched parents with A)
     if (B_ptr->__parent == nullptr)
       this->__root = B_ptr;
 
-    // if other data should be update, update them here
+    // other data kept about the sub tree is updated by _update_node (above)
 
     return;
   }
 
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::_rotate_LL(typename tree<Data_t, less>::_Node **node)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_rotate_LL(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node **node)
   {
     if (node == nullptr || *node == nullptr)
     {
@@ -1405,14 +5675,15 @@ namespace avl
       return;
     }
 
+    this->_count_rotation(tree_stats::LL);
     // counter intuitive, but thats how it works
     _rotate_right(node);
 
     return;
   }
 
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::_rotate_LR(typename tree<Data_t, less>::_Node **node_pptr)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_rotate_LR(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node **node_pptr)
   {
     if (node_pptr == nullptr || *node_pptr == nullptr)
     {
@@ -1424,6 +5695,7 @@ namespace avl
       return;
     }
 
+    this->_count_rotation(tree_stats::LR);
     // the order of rotation in important
     _rotate_left(&((*node_pptr)->__left));
     _rotate_right(node_pptr);
@@ -1431,8 +5703,8 @@ namespace avl
     return;
   }
 
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::_rotate_RL(typename tree<Data_t, less>::_Node **node_pptr)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_rotate_RL(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node **node_pptr)
   {
     if (node_pptr == nullptr || *node_pptr == nullptr)
     {
@@ -1444,6 +5716,7 @@ namespace avl
       return;
     }
 
+    this->_count_rotation(tree_stats::RL);
     // the order of rotation in important
     _rotate_right(&((*node_pptr)->__right));
     _rotate_left(node_pptr);
@@ -1451,8 +5724,8 @@ namespace avl
     return;
   }
 
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::_rotate_RR(typename tree<Data_t, less>::_Node **node)
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_rotate_RR(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node **node)
   {
     if (node == nullptr || *node == nullptr)
     {
@@ -1464,6 +5737,7 @@ namespace avl
       return;
     }
 
+    this->_count_rotation(tree_stats::RR);
     // counter intuitive, but thats how it works
     _rotate_left(node);
 
@@ -1472,10 +5746,10 @@ namespace avl
 
 #ifdef AVL_TREE_TEST
 
-  template <typename Data_t, typename less>
-  bool tree<Data_t, less>::_validate() const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  bool tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_validate() const
   {
-    assert(__size == _get_tree_size(__root));
+    assert(static_cast<ssize_t>(__size) == _get_tree_size(__root));
     _validate_min_element();
     _validate_max_element();
 
@@ -1485,8 +5759,8 @@ namespace avl
     return true;
   }
 
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::_validate_aux(typename tree<Data_t, less>::_Node *root) const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_validate_aux(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *root) const
   {
     if (root == nullptr)
       return;
@@ -1497,13 +5771,15 @@ namespace avl
     assert(bf <= 1);
 
     assert(root->__height == _get_tree_height(*root));
+    _validate_count(root, std::integral_constant<bool, Ranked>());
+    _validate_augment(root, std::integral_constant<bool, _augment_traits<Augment>::enabled>());
 
     // if it has a right child
     if (root->__right)
     {
       // assert the parent of the right child is correct
       assert(root == root->__right->__parent);
-      assert(less()(root->__data, root->__right->__data));
+      assert(key_comp()(root->__data, root->__right->__data));
 
       _validate_aux(root->__right);
     }
@@ -1513,43 +5789,59 @@ namespace avl
     {
       // assert the parent of the left child is correct
       assert(root == root->__left->__parent);
-      assert(less()(root->__left->__data, root->__data));
+      assert(key_comp()(root->__left->__data, root->__data));
 
       _validate_aux(root->__left);
     }
   }
 
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::_validate_min_element() const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_validate_count(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *root, std::true_type) const
+  {
+    assert(root->__count == static_cast<size_t>(_get_tree_size(root)));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_validate_augment(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *root, std::true_type) const
+  {
+    // the children are validated on their own, so checking the node against them is enough
+    assert(root->__aug == Augment::combine(
+                              Augment::combine(_get_augment(root->__left), Augment::lift(root->__data)),
+                              _get_augment(root->__right)));
+  }
+
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_validate_min_element() const
   {
+    assert(__min_element == _get_left_most_node(__root));
     _validate_min_element_aux(__root);
   }
 
-  template <typename Data_t, typename less>
-  typename tree<Data_t, less>::_Node *tree<Data_t, less>::_validate_min_element_aux(typename tree<Data_t, less>::_Node *node) const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_validate_min_element_aux(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *node) const
   {
-    const _Node *min = node;
     if (node)
     {
       // check the left sub tree
-      const _Node *left = _validate_min_element_aux(node->__left);
+      _validate_min_element_aux(node->__left);
 
       // check the right sub tree
-      const _Node *right = _validate_min_element_aux(node->__right);
+      _validate_min_element_aux(node->__right);
 
       // check the node
     }
     return nullptr;
   }
 
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::_validate_max_element() const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_validate_max_element() const
   {
+    assert(__max_element == _get_right_most_node(__root));
     _validate_max_element_aux(__root);
   }
 
-  template <typename Data_t, typename less>
-  typename tree<Data_t, less>::_Node *tree<Data_t, less>::_validate_max_element_aux(typename tree<Data_t, less>::_Node *node) const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_validate_max_element_aux(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *node) const
   {
     if (node)
     {
@@ -1562,24 +5854,24 @@ namespace avl
       // check the node
       if (node->__left)
       {
-        assert(less()(node->__left->__data, node->__data));
+        assert(key_comp()(node->__left->__data, node->__data));
       }
       if (node->__right)
       {
-        assert(less()(node->__data, node->__right->__data));
+        assert(key_comp()(node->__data, node->__right->__data));
       }
     }
     return nullptr;
   }
 
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::_validate_data_order() const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_validate_data_order() const
   {
     _validate_data_order_aux(__root);
   }
 
-  template <typename Data_t, typename less>
-  void tree<Data_t, less>::_validate_data_order_aux(typename tree<Data_t, less>::_Node *node) const
+  template <typename Data_t, typename less, typename Alloc, bool Ranked, typename Augment, typename Stats>
+  void tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_validate_data_order_aux(typename tree<Data_t, less, Alloc, Ranked, Augment, Stats>::_Node *node) const
   {
     if (node)
     {
@@ -1592,11 +5884,11 @@ namespace avl
       // check the node
       if (node->__left)
       {
-        assert(less()(node->__left->__data, node->__data));
+        assert(key_comp()(node->__left->__data, node->__data));
       }
       if (node->__right)
       {
-        assert(less()(node->__data, node->__right->__data));
+        assert(key_comp()(node->__data, node->__right->__data));
       }
     }
   }
@@ -0,0 +1,341 @@
+#include "avl_tree.h"
+#include "avl_compact_tree.h"
+
+#include <set>
+#include <algorithm>
+#include <iterator>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <stdint.h>
+
+/* compilation line:
+g++ -std=c++11 -O2 -DNDEBUG -pthread -o benchmark.out benchmark.cpp
+
+usage:
+./benchmark.out [size ...]     (default sizes: 1000 100000 1000000)
+
+prints 1 CSV row per structure, operation, key distribution and size:
+structure,operation,distribution,size,ops_per_sec,p50_ns,p99_ns,p999_ns
+per element operations (insert, remove, search) report the latency of a single operation (1 in 32 is timed,
+the throughput comes from the untimed rest),
+bulk operations (iterate, copy, clear, unite) the latency of a whole run
+*/
+
+typedef uint64_t key_type;
+typedef std::chrono::steady_clock bench_clock;
+
+// -*- key streams -*- //
+
+// Zipfian ranks in [0, n) with skew theta, the generator of Gray et al. ("Quickly generating billion-record synthetic databases")
+class zipf_generator
+{
+public:
+    zipf_generator(size_t n, double theta, uint64_t seed) : __n(n), __theta(theta), __rng(seed), __uniform(0.0, 1.0)
+    {
+        double zeta_2 = 1.0 + std::pow(0.5, theta);
+        __zeta_n = 0;
+        for (size_t i = 1; i <= n; i++)
+        {
+            __zeta_n += 1.0 / std::pow(double(i), theta);
+        }
+        __alpha = 1.0 / (1.0 - theta);
+        __eta = (1.0 - std::pow(2.0 / double(n), 1.0 - theta)) / (1.0 - zeta_2 / __zeta_n);
+    }
+
+    size_t next()
+    {
+        double u = __uniform(__rng);
+        double uz = u * __zeta_n;
+        if (uz < 1.0)
+        {
+            return 0;
+        }
+        if (uz < 1.0 + std::pow(0.5, __theta))
+        {
+            return 1;
+        }
+        size_t rank = size_t(double(__n) * std::pow(__eta * u - __eta + 1.0, __alpha));
+        return rank < __n ? rank : __n - 1;
+    }
+
+private:
+    size_t __n;
+    double __theta;
+    double __zeta_n;
+    double __alpha;
+    double __eta;
+    std::mt19937_64 __rng;
+    std::uniform_real_distribution<double> __uniform;
+};
+
+// every generated key is even, so key | 1 is a key that is never found
+std::vector<key_type> make_keys(const std::string &distribution, size_t n, uint64_t seed)
+{
+    std::vector<key_type> keys(n);
+    std::mt19937_64 rng(seed);
+    if (distribution == "uniform")
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            keys[i] = rng() & ~key_type(1);
+        }
+    }
+    else if (distribution == "sorted")
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            keys[i] = (key_type(seed) << 40) + 2 * key_type(i);
+        }
+    }
+    else // zipfian, the hot ranks are scattered over the key space
+    {
+        zipf_generator zipf(n, 0.99, seed);
+        for (size_t i = 0; i < n; i++)
+        {
+            keys[i] = (key_type(zipf.next() + seed * n) * 0x9E3779B97F4A7C15ULL) & ~key_type(1);
+        }
+    }
+    return keys;
+}
+
+// -*- measuring -*- //
+
+unsigned long long g_sink = 0; // keeps the compiler from dropping the measured work
+
+void report(const char *structure, const char *operation, const std::string &distribution, size_t size,
+            double ops, double seconds, std::vector<uint64_t> &latencies)
+{
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double q) -> unsigned long long
+    {
+        if (latencies.empty())
+        {
+            return 0;
+        }
+        size_t index = size_t(q * double(latencies.size()));
+        return latencies[index < latencies.size() ? index : latencies.size() - 1];
+    };
+    std::printf("%s,%s,%s,%zu,%.0f,%llu,%llu,%llu\n", structure, operation, distribution.c_str(), size,
+                seconds > 0 ? ops / seconds : 0.0, percentile(0.5), percentile(0.99), percentile(0.999));
+    std::fflush(stdout);
+}
+
+inline uint64_t elapsed_ns(bench_clock::time_point start, bench_clock::time_point end)
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+// times op(i) for every i in [0, count): every latency_stride-th op is timed on its own for the percentiles,
+// the ops in between run untimed under 1 timer per batch for the throughput, so the clock reads stay out of it
+const size_t latency_stride = 32;
+
+template <typename Op>
+void time_each(const char *structure, const char *operation, const std::string &distribution, size_t size, size_t count, Op op)
+{
+    std::vector<uint64_t> latencies;
+    latencies.reserve(count / latency_stride + 1);
+    uint64_t total = 0;
+    size_t batched = 0;
+    for (size_t i = 0; i < count;)
+    {
+        bench_clock::time_point start = bench_clock::now();
+        op(i++);
+        latencies.push_back(elapsed_ns(start, bench_clock::now()));
+
+        size_t end = std::min(count, i + latency_stride - 1);
+        if (i == end)
+        {
+            continue;
+        }
+        batched += end - i;
+        start = bench_clock::now();
+        for (; i < end; i++)
+        {
+            op(i);
+        }
+        total += elapsed_ns(start, bench_clock::now());
+    }
+    report(structure, operation, distribution, size, double(batched), double(total) * 1e-9, latencies);
+}
+
+// times reps runs of op(), each handles elements data
+template <typename Op>
+void time_bulk(const char *structure, const char *operation, const std::string &distribution, size_t size, size_t reps, size_t elements, Op op)
+{
+    std::vector<uint64_t> latencies(reps);
+    uint64_t total = 0;
+    for (size_t i = 0; i < reps; i++)
+    {
+        bench_clock::time_point start = bench_clock::now();
+        op();
+        latencies[i] = elapsed_ns(start, bench_clock::now());
+        total += latencies[i];
+    }
+    report(structure, operation, distribution, size, double(reps) * double(elements), double(total) * 1e-9, latencies);
+}
+
+// -*- a common interface over the structures -*- //
+
+typedef avl::tree<key_type> avl_set;
+typedef avl::compact_tree<key_type> compact_set;
+typedef std::set<key_type> std_set;
+
+inline void insert_key(avl_set &set, key_type key) { set.insert(key, std::nothrow); }
+inline void insert_key(compact_set &set, key_type key) { set.insert(key, std::nothrow); }
+inline void insert_key(std_set &set, key_type key) { set.insert(key); }
+
+inline bool contains_key(const avl_set &set, key_type key) { return set.contains(key); }
+inline bool contains_key(const compact_set &set, key_type key) { return set.contains(key); }
+inline bool contains_key(const std_set &set, key_type key) { return set.count(key) != 0; }
+
+inline avl_set unite_sets(const avl_set &set1, const avl_set &set2) { return avl_set::unite(set1, set2); }
+inline std_set unite_sets(const std_set &set1, const std_set &set2)
+{
+    std_set united;
+    std::set_union(set1.begin(), set1.end(), set2.begin(), set2.end(), std::inserter(united, united.end()));
+    return united;
+}
+
+template <typename Set>
+Set build(const std::vector<key_type> &keys)
+{
+    Set set;
+    for (key_type key : keys)
+    {
+        insert_key(set, key);
+    }
+    return set;
+}
+
+// the operations every structure supports
+template <typename Set>
+Set run_common(const char *name, const std::string &distribution, const std::vector<key_type> &keys)
+{
+    size_t n = keys.size();
+    size_t reps = std::max<size_t>(1, 1000000 / n);
+
+    Set set;
+    time_each(name, "insert", distribution, n, n, [&](size_t i)
+              { insert_key(set, keys[i]); });
+    time_each(name, "search_hit", distribution, n, n, [&](size_t i)
+              { g_sink += contains_key(set, keys[n - 1 - i]); });
+    time_each(name, "search_miss", distribution, n, n, [&](size_t i)
+              { g_sink += contains_key(set, keys[i] | 1); });
+    time_bulk(name, "iterate", distribution, n, reps, set.size(), [&]()
+              {
+                  for (key_type key : set)
+                  {
+                      g_sink += key;
+                  } });
+    time_bulk(name, "copy", distribution, n, reps, set.size(), [&]()
+              {
+                  Set copy(set);
+                  g_sink += copy.size(); });
+    std::vector<Set> copies(reps, set); // so only the clear is timed
+    size_t next = 0;
+    time_bulk(name, "clear", distribution, n, reps, set.size(), [&]()
+              { copies[next++].clear(); });
+    Set removed(set);
+    time_each(name, "remove", distribution, n, n, [&](size_t i)
+              { g_sink += removed.erase(keys[i]); });
+    return set;
+}
+
+template <typename Set>
+void run_unite(const char *name, const std::string &distribution, size_t n, const Set &set, const std::vector<key_type> &other_keys, const std::vector<key_type> &skewed_keys)
+{
+    size_t reps = std::max<size_t>(1, 1000000 / n);
+    Set other = build<Set>(other_keys);
+    Set skewed = build<Set>(skewed_keys);
+    time_bulk(name, "unite_equal", distribution, n, reps, set.size() + other.size(), [&]()
+              { g_sink += unite_sets(set, other).size(); });
+    time_bulk(name, "unite_skewed", distribution, n, reps, set.size() + skewed.size(), [&]()
+              { g_sink += unite_sets(set, skewed).size(); });
+}
+
+void run_avl_extras(const std::string &distribution, const avl_set &set, const std::vector<key_type> &keys,
+                    const std::vector<key_type> &other_keys, const std::vector<key_type> &skewed_keys)
+{
+    size_t n = keys.size();
+    size_t reps = std::max<size_t>(1, 1000000 / n);
+
+    // the rvalue set operations reuse the nodes, so every run gets its own copies (made before timing)
+    avl_set other = build<avl_set>(other_keys);
+    avl_set skewed = build<avl_set>(skewed_keys);
+    std::vector<avl_set> firsts(2 * reps, set), equals(reps, other), skeweds(reps, skewed);
+    size_t next = 0;
+    time_bulk("avl::tree", "unite_move_equal", distribution, n, reps, set.size() + other.size(), [&]()
+              {
+                  g_sink += avl_set::unite(std::move(firsts[next]), std::move(equals[next])).size();
+                  next++; });
+    next = 0;
+    time_bulk("avl::tree", "unite_move_skewed", distribution, n, reps, set.size() + skewed.size(), [&]()
+              {
+                  g_sink += avl_set::unite(std::move(firsts[reps + next]), std::move(skeweds[next])).size();
+                  next++; });
+
+    // the read only copy
+    avl::frozen_tree<key_type> frozen = set.freeze();
+    time_each("avl::frozen_tree", "search_hit", distribution, n, n, [&](size_t i)
+              { g_sink += frozen.contains(keys[n - 1 - i]); });
+    time_each("avl::frozen_tree", "search_miss", distribution, n, n, [&](size_t i)
+              { g_sink += frozen.contains(keys[i] | 1); });
+    time_bulk("avl::frozen_tree", "iterate", distribution, n, reps, frozen.size(), [&]()
+              {
+                  for (key_type key : frozen)
+                  {
+                      g_sink += key;
+                  } });
+
+    // batched lookups, the latency is of a whole batch
+    std::vector<char> found(n);
+    time_bulk("avl::tree", "search_hit_batch", distribution, n, 1, n, [&]()
+              { set.contains_batch(keys.begin(), keys.end(), found.begin()); });
+    time_bulk("avl::frozen_tree", "search_hit_batch", distribution, n, 1, n, [&]()
+              { frozen.contains_batch(keys.begin(), keys.end(), found.begin()); });
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; i++)
+    {
+        sizes.push_back(size_t(std::strtoull(argv[i], nullptr, 10)));
+    }
+    if (sizes.empty())
+    {
+        sizes = {1000, 100000, 1000000};
+    }
+
+    const char *distributions[] = {"uniform", "sorted", "zipfian"};
+    std::printf("structure,operation,distribution,size,ops_per_sec,p50_ns,p99_ns,p999_ns\n");
+    for (size_t n : sizes)
+    {
+        if (n == 0)
+        {
+            continue;
+        }
+        for (const char *distribution : distributions)
+        {
+            std::vector<key_type> keys = make_keys(distribution, n, 1);
+            std::vector<key_type> other_keys = make_keys(distribution, n, 2);
+            std::vector<key_type> skewed_keys = make_keys(distribution, n / 100 + 1, 3);
+
+            avl_set avl = run_common<avl_set>("avl::tree", distribution, keys);
+            run_unite("avl::tree", distribution, n, avl, other_keys, skewed_keys);
+            run_avl_extras(distribution, avl, keys, other_keys, skewed_keys);
+            avl.clear();
+
+            run_common<compact_set>("avl::compact_tree", distribution, keys);
+
+            std_set baseline = run_common<std_set>("std::set", distribution, keys);
+            run_unite("std::set", distribution, n, baseline, other_keys, skewed_keys);
+        }
+    }
+    return g_sink == 42 ? 1 : 0;
+}
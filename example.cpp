@@ -1,3 +1,4 @@
+#define AVL_TREE_TEST // for _print_tree() and std::cout
 #include "avl_tree.h"
 
 /* compilation line:
@@ -0,0 +1,1502 @@
+#define AVL_TREE_TEST // for _validate()
+#include "avl_tree.h"
+#include "avl_concurrent_tree.h"
+#include "avl_stream.h"
+#include "avl_lazy_tree.h"
+#include "avl_small_tree.h"
+#include "avl_multiset.h"
+#include "avl_map.h"
+#include "avl_mapped_tree.h"
+#include "avl_compact_tree.h"
+#include "avl_persistent_tree.h"
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cassert>
+#include <sstream>
+#include <string>
+#include <set>
+#include <random>
+#include <functional>
+#include <memory>
+#include <limits>
+#include <stdexcept>
+#include <map>
+#include <cstdio>
+#include <algorithm>
+#include <iterator>
+
+/* compilation line:
+g++ -std=c++11 -g -Wall -Wextra -pedantic -pthread -o test.out test.cpp
+
+runs the checks below, asserting on the first failure (so don't build it with -DNDEBUG)
+*/
+
+// readers look up keys without locking while a writer inserts and removes, every version a reader sees is whole.
+// validating a version is O(n), so the readers validate only 1 in 64 of the versions they look at
+void test_snapshot_readers_and_writer()
+{
+    const int keys = 500;
+    avl::concurrent_tree<avl::tree<int>, avl::snapshot_mode> shared;
+    std::atomic<bool> done(false);
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 2; r++)
+    {
+        readers.push_back(std::thread([&]()
+                                      {
+                                          for (size_t reads = 0; !done.load(); reads++)
+                                          {
+                                              if (reads % 64 == 0)
+                                              {
+                                                  // a version is never half written: its size matches its elements and it stays balanced
+                                                  bool whole = shared.read([](const avl::tree<int> &version)
+                                                                           { return version._validate() && size_t(std::distance(version.begin(), version.end())) == version.size(); });
+                                                  assert(whole);
+                                              }
+                                              int found;
+                                              if (shared.find(keys / 2, found))
+                                              {
+                                                  assert(found == keys / 2);
+                                              }
+                                              std::this_thread::yield();
+                                          } }));
+    }
+
+    for (int i = 0; i < keys; i++)
+    {
+        assert(shared.insert(i));
+    }
+    for (int i = 0; i < keys; i += 2)
+    {
+        assert(shared.erase(i) == 1);
+    }
+    shared.write([&](avl::tree<int> &tree)
+                 {
+                     for (int i = 0; i < keys; i += 2)
+                     {
+                         tree.insert(i);
+                     } });
+    done.store(true);
+    for (std::thread &reader : readers)
+    {
+        reader.join();
+    }
+
+    assert(shared.size() == size_t(keys));
+    avl::tree<int> last = shared.snapshot();
+    last._validate();
+    for (int i = 0; i < keys; i++)
+    {
+        assert(last.contains(i));
+    }
+}
+
+// the 2 halves of a split share no pool state, each is changed on a thread of its own
+// (build with -fsanitize=thread to have the races reported, not only the asserts)
+void test_split_halves_on_two_threads()
+{
+    avl::tree<int> low;
+    for (int i = 0; i < 100000; i++)
+    {
+        low.insert(i);
+    }
+    avl::tree<int> high = low.split(50000);
+    assert(low.size() == 50000 && high.size() == 50000);
+
+    auto churn = [](avl::tree<int> &half, int first)
+    {
+        for (int round = 0; round < 4; round++)
+        {
+            for (int i = first; i < first + 50000; i += 3)
+            {
+                half.remove(i);
+            }
+            for (int i = first; i < first + 50000; i += 3)
+            {
+                half.insert(i);
+            }
+        }
+    };
+    std::thread low_thread(churn, std::ref(low), 0);
+    std::thread high_thread(churn, std::ref(high), 50000);
+    low_thread.join();
+    high_thread.join();
+
+    low._validate();
+    high._validate();
+    assert(low.size() == 50000 && high.size() == 50000);
+    assert(*low.begin() == 0 && *high.begin() == 50000);
+
+    // the donor goes away first, the split off half still reads its nodes
+    low = avl::tree<int>();
+    high._validate();
+    assert(high.contains(99999) && !high.contains(49999));
+}
+
+// data that counts how many of it are alive, and owns heap memory like an std::string would
+struct counted
+{
+    static long alive;
+    int value;
+    std::string payload;
+
+    counted(int value) : value(value), payload(32, 'x') { ++alive; }
+    counted(const counted &other) : value(other.value), payload(other.payload) { ++alive; }
+    ~counted() { --alive; }
+};
+long counted::alive = 0;
+
+// throws once it has been called budget times (budget is shared by the copies)
+struct throwing_less
+{
+    std::shared_ptr<std::atomic<long>> budget;
+
+    bool operator()(const counted &data1, const counted &data2) const
+    {
+        if (budget->fetch_sub(1) == 0)
+        {
+            throw std::runtime_error("comparator");
+        }
+        return data1.value < data2.value;
+    }
+};
+
+// a set operation whose comparator throws destroys all the data it took from its sources,
+// also when the sub trees are handled on several threads
+void test_set_ops_with_a_throwing_comparator()
+{
+    typedef avl::tree<counted, throwing_less> counted_tree;
+    const avl::parallel_policy policies[] = {avl::parallel_policy(1), avl::parallel_policy(4, 4)};
+    const int sizes[][2] = {{10000, 20}, {5000, 5000}}; // with 1 thread: the join based algorithm and the linear merge
+    const long budgets[] = {0, 1, 50, 150};             // throws at different depths
+    for (const avl::parallel_policy &policy : policies)
+    {
+        for (const int *size : sizes)
+        {
+            for (long budget : budgets)
+            {
+                {
+                    throwing_less comp;
+                    comp.budget = std::make_shared<std::atomic<long>>(std::numeric_limits<long>::max());
+                    counted_tree t1(comp), t2(comp);
+                    for (int i = 0; i < size[0]; i++)
+                    {
+                        t1.insert(counted(i * 2));
+                    }
+                    for (int i = 0; i < size[1]; i++)
+                    {
+                        t2.insert(counted(i * 7));
+                    }
+                    *comp.budget = budget;
+                    bool thrown = false;
+                    try
+                    {
+                        counted_tree::unite(policy, std::move(t1), std::move(t2));
+                    }
+                    catch (const std::runtime_error &)
+                    {
+                        thrown = true;
+                    }
+                    assert(thrown);
+                }
+                assert(counted::alive == 0);
+            }
+        }
+    }
+}
+
+// the batches count the nodes, comparisons and rotations of the joins they run on the tree they change
+void test_stats_count_the_batches()
+{
+    typedef avl::tree<int, std::less<int>, std::allocator<int>, false, avl::no_augment, avl::tree_stats> counted_tree;
+    std::vector<int> sorted;
+    for (int i = 0; i < 100000; i++)
+    {
+        sorted.push_back(i * 2);
+    }
+    counted_tree tree = counted_tree::from_sorted(sorted.begin(), sorted.end());
+    assert(tree.stats().nodes_created == sorted.size() && tree.stats().rotations[avl::tree_stats::LL] == 0);
+    tree.reset_stats();
+
+    std::vector<int> batch;
+    for (int i = 0; i < 10; i++)
+    {
+        batch.push_back(i * 20000 + 1); // odd, none of them is in the tree yet
+    }
+    assert(tree.insert_batch(batch.begin(), batch.end()) == batch.size());
+    tree._validate();
+    assert(tree.stats().nodes_created == batch.size() && tree.stats().comparisons > 0);
+
+    // appending with join() rotates like inserting sorted data does, a joined tree starts with the work of its join
+    counted_tree appended;
+    unsigned long long rotations = 0;
+    for (int i = 0; i < 100; i++)
+    {
+        counted_tree joined = counted_tree::join(std::move(appended), i, counted_tree());
+        const avl::tree_stats &stats = joined.stats();
+        rotations += stats.rotations[0] + stats.rotations[1] + stats.rotations[2] + stats.rotations[3];
+        appended = std::move(joined);
+    }
+    appended._validate();
+    assert(rotations > 0);
+
+    // a set operation on 4 threads counts on the result tree
+    counted_tree small_tree(batch.begin(), batch.end());
+    counted_tree united = counted_tree::unite(avl::parallel_policy(4, 4), counted_tree(tree), std::move(small_tree));
+    assert(united.size() == tree.size() && united.stats().comparisons > 0);
+}
+
+// orders ascending or descending, chosen at run time
+struct directed_less
+{
+    bool descending;
+
+    explicit directed_less(bool descending = false) : descending(descending) {}
+    bool operator()(int data1, int data2) const { return descending ? data2 < data1 : data1 < data2; }
+};
+
+// the bulk builds keep a stateful comparator, the built tree orders its later inserts by it
+void test_from_sorted_keeps_the_comparator()
+{
+    typedef avl::tree<int, directed_less> directed_tree;
+    std::vector<int> descending;
+    for (int i = 1000; i > 0; i--)
+    {
+        descending.push_back(i * 2);
+    }
+    directed_tree built = directed_tree::from_sorted(descending.begin(), descending.end(), directed_less(true));
+    directed_tree parallel_built = directed_tree::from_sorted(avl::parallel_policy(4, 16), descending.begin(), descending.end(), directed_less(true));
+    directed_tree *trees[] = {&built, &parallel_built};
+    for (directed_tree *tree : trees)
+    {
+        assert(tree->key_comp().descending);
+        tree->insert(1001);
+        tree->_validate();
+        assert(tree->contains(1001) && tree->min() == 2000 && tree->max() == 2);
+    }
+}
+
+// clearing a snapshot_mode tree publishes an empty version with the same comparator
+void test_snapshot_clear_keeps_the_comparator()
+{
+    typedef avl::tree<int, directed_less> directed_tree;
+    avl::concurrent_tree<directed_tree, avl::snapshot_mode> shared((directed_tree(directed_less(true))));
+    for (int i = 0; i < 100; i++)
+    {
+        shared.insert(i);
+    }
+    shared.clear();
+    assert(shared.size() == 0);
+    for (int i = 0; i < 100; i += 3)
+    {
+        assert(shared.insert(i));
+    }
+    int found;
+    assert(shared.find(42, found) && found == 42 && !shared.find(43, found));
+    directed_tree last = shared.snapshot();
+    last._validate();
+    assert(*last.begin() == 99 && last.key_comp().descending);
+}
+
+// a tree written by serialize() reads back equal, a cut stream throws bad_input
+void test_stream_round_trip_and_truncation()
+{
+    avl::tree<int> ints;
+    for (int i = 0; i < 10000; i++)
+    {
+        ints.insert(i * 3);
+    }
+    std::stringstream buffer;
+    avl::serialize(ints, buffer, avl::trivial_codec<int>(), 100);
+    std::string bytes = buffer.str();
+
+    std::istringstream whole(bytes);
+    avl::tree<int> read = avl::deserialize<avl::tree<int>>(whole);
+    read._validate();
+    assert(read.size() == ints.size() && std::equal(read.begin(), read.end(), ints.begin()));
+
+    avl::tree<std::string> strings({"", "a", "abc", std::string(1000, 'z')});
+    std::stringstream string_buffer;
+    avl::serialize(strings, string_buffer, avl::string_codec());
+    avl::tree<std::string> read_strings = avl::deserialize<avl::tree<std::string>>(string_buffer, avl::string_codec());
+    read_strings._validate();
+    assert(read_strings.size() == strings.size() && std::equal(read_strings.begin(), read_strings.end(), strings.begin()));
+
+    // cut in the header, in the middle of a chunk and right before the last chunk
+    const size_t cuts[] = {2, 10, bytes.size() / 2, bytes.size() - 1};
+    for (size_t cut : cuts)
+    {
+        std::istringstream truncated(bytes.substr(0, cut));
+        bool thrown = false;
+        try
+        {
+            avl::deserialize<avl::tree<int>>(truncated);
+        }
+        catch (const avl::bad_input &)
+        {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+}
+
+// the tombstones are dropped once they pass max_removed of the nodes, the data left is untouched
+void test_lazy_tree_compaction()
+{
+    avl::lazy_tree<int> lazy(0.25);
+    for (int i = 0; i < 100; i++)
+    {
+        lazy.insert(i);
+    }
+    for (int i = 0; i < 25; i++)
+    {
+        lazy.remove(i);
+    }
+    assert(lazy.removed() == 25 && lazy.size() == 75);
+    lazy._validate();
+
+    lazy.remove(25); // 26 tombstones out of 100 nodes, past 0.25
+    assert(lazy.removed() == 0 && lazy.size() == 74);
+    lazy._validate();
+    for (int i = 0; i < 100; i++)
+    {
+        assert(lazy.contains(i) == (i >= 26));
+    }
+
+    lazy.remove(50);
+    lazy.insert(50); // revives the tombstone in place
+    assert(lazy.removed() == 0 && lazy.contains(50));
+    lazy.remove(60);
+    lazy.compact();
+    assert(lazy.removed() == 0 && lazy.size() == 73 && !lazy.contains(60));
+    lazy._validate();
+
+    // random churn against std::set
+    std::mt19937 rng(28);
+    avl::lazy_tree<int> churned;
+    std::set<int> expected;
+    for (int i = 0; i < 20000; i++)
+    {
+        int data = int(rng() % 500);
+        if (rng() % 2)
+        {
+            assert(churned.insert(data, std::nothrow) == expected.insert(data).second);
+        }
+        else
+        {
+            assert(churned.erase(data) == expected.erase(data));
+        }
+        assert(churned.size() == expected.size());
+    }
+    churned._validate();
+    assert(std::equal(churned.begin(), churned.end(), expected.begin()));
+}
+
+// a small_tree keeps up to N data inline, grows into a tree past N and keeps the order through both
+void test_small_tree_growth()
+{
+    avl::small_tree<int, 8> small;
+    for (int i = 7; i >= 0; i--)
+    {
+        small.insert(i * 2);
+        assert(small.is_inline());
+        small._validate();
+    }
+    small.insert(100);
+    assert(!small.is_inline() && small.size() == 9);
+    small._validate();
+    for (int i = 0; i < 8; i++)
+    {
+        assert(small.contains(i * 2) && !small.contains(i * 2 + 1));
+    }
+    assert(small.min() == 0 && small.max() == 100);
+
+    int previous = -1;
+    for (int data : small)
+    {
+        assert(data > previous);
+        previous = data;
+    }
+
+    avl::small_tree<int, 8> copy(small);
+    copy._validate();
+    assert(copy.size() == small.size() && std::equal(copy.begin(), copy.end(), small.begin()));
+    small.clear();
+    assert(small.is_inline() && small.empty());
+
+    // random churn against std::set, across the inline / tree boundary
+    std::mt19937 rng(30);
+    avl::small_tree<int, 8> churned;
+    std::set<int> expected;
+    for (int i = 0; i < 20000; i++)
+    {
+        int data = int(rng() % 24);
+        if (rng() % 2)
+        {
+            assert(churned.insert(data, std::nothrow) == expected.insert(data).second);
+        }
+        else
+        {
+            assert(churned.erase(data) == expected.erase(data));
+        }
+        assert(churned.size() == expected.size() && (expected.size() <= 8 || !churned.is_inline()));
+    }
+    churned._validate();
+    assert(std::equal(churned.begin(), churned.end(), expected.begin()));
+}
+
+// the pool reuses freed nodes and the per thread cache hands first chunks to the next trees, nothing is lost on the way
+void test_pool_and_chunk_cache()
+{
+    typedef avl::tree<counted, throwing_less> counted_tree;
+    throwing_less comp;
+    comp.budget = std::make_shared<std::atomic<long>>(std::numeric_limits<long>::max());
+
+    auto churn = [&comp](unsigned seed)
+    {
+        std::mt19937 rng(seed);
+        for (int round = 0; round < 200; round++)
+        {
+            // short lived trees, most fit in the first (cached) chunk
+            counted_tree tree(comp);
+            std::set<int> expected;
+            int inserts = int(rng() % 40);
+            for (int i = 0; i < inserts; i++)
+            {
+                int data = int(rng() % 64);
+                if (rng() % 3)
+                {
+                    assert(tree.insert(counted(data), std::nothrow).second == expected.insert(data).second);
+                }
+                else
+                {
+                    assert(tree.erase(counted(data)) == expected.erase(data));
+                }
+            }
+            tree._validate();
+            assert(tree.size() == expected.size());
+            counted_tree copy(tree);
+            copy = tree;
+            assert(copy.size() == tree.size());
+        }
+    };
+    churn(1);
+    std::thread other(churn, 2); // a cache of its own
+    other.join();
+    assert(counted::alive == 0);
+
+    // nodes move between pools through the set operations, the trees clear and go away in any order
+    {
+        std::mt19937 rng(3);
+        counted_tree t1(comp), t2(comp);
+        for (int i = 0; i < 3000; i++)
+        {
+            t1.insert(counted(int(rng() % 5000)), std::nothrow);
+            t2.insert(counted(int(rng() % 5000)), std::nothrow);
+        }
+        counted_tree united = counted_tree::unite(std::move(t1), std::move(t2));
+        counted_tree high = united.split(counted(2500));
+        united.clear();
+        for (int i = 0; i < 1000; i++)
+        {
+            united.insert(counted(i), std::nothrow);
+            high.erase(counted(2500 + i));
+        }
+        united._validate();
+        high._validate();
+    }
+    assert(counted::alive == 0);
+}
+
+// true when the tree holds exactly the data of the std::set, in the same order
+template <typename Tree>
+static bool same_data(const Tree &tree, const std::set<int> &expected)
+{
+    return tree.size() == expected.size() && std::equal(tree.begin(), tree.end(), expected.begin());
+}
+
+// rank, select and count_range against the position in a std::set, while data is inserted and erased
+void test_rank_select_and_count_range()
+{
+    typedef avl::tree<int, avl::def_less<int>, std::allocator<int>, true> ranked_tree;
+    std::mt19937 rng(5);
+    ranked_tree tree;
+    std::set<int> expected;
+    for (int round = 0; round < 40; round++)
+    {
+        for (int i = 0; i < 200; i++)
+        {
+            int data = int(rng() % 3000);
+            if (rng() % 3)
+            {
+                tree.insert(data, std::nothrow);
+                expected.insert(data);
+            }
+            else
+            {
+                assert(tree.erase(data) == expected.erase(data));
+            }
+        }
+        tree._validate();
+        assert(same_data(tree, expected));
+
+        size_t index = 0;
+        for (int data : expected)
+        {
+            assert(tree.rank(data) == index && tree.select(index) == data);
+            ++index;
+        }
+        for (int i = 0; i < 50; i++)
+        {
+            int lo = int(rng() % 3002) - 1, hi = int(rng() % 3002) - 1;
+            std::set<int>::iterator lo_it = expected.lower_bound(lo), hi_it = expected.lower_bound(hi);
+            size_t in_range = lo < hi ? size_t(std::distance(lo_it, hi_it)) : 0;
+            assert(tree.count_range(lo, hi) == in_range);
+            assert(tree.rank(lo) == size_t(std::distance(expected.begin(), lo_it)));
+        }
+    }
+
+    bool thrown = false;
+    try
+    {
+        tree.select(tree.size());
+    }
+    catch (const avl::bad_input &)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+// size distinct random data in [0, range)
+static std::set<int> random_set(std::mt19937 &rng, size_t size, int range)
+{
+    std::set<int> data;
+    while (data.size() < size)
+    {
+        data.insert(int(rng() % unsigned(range)));
+    }
+    return data;
+}
+
+// fold_range sums and stabbed intervals against a brute force pass over a std::set
+void test_fold_range_and_stab()
+{
+    std::mt19937 rng(6);
+    avl::tree<int, avl::def_less<int>, std::allocator<int>, false, avl::sum_augment<long>> summed;
+    std::set<int> expected = random_set(rng, 3000, 10000);
+    for (int data : expected)
+    {
+        summed.insert(data);
+    }
+    for (int i = 0; i < 1000; i++)
+    {
+        int data = int(rng() % 10000);
+        assert(summed.erase(data) == expected.erase(data));
+    }
+    summed._validate();
+    for (int i = 0; i < 300; i++)
+    {
+        int lo = int(rng() % 10002) - 1, hi = int(rng() % 10002) - 1;
+        long sum = 0;
+        for (int data : expected)
+        {
+            sum += (lo <= data && data < hi) ? data : 0;
+        }
+        assert(summed.fold_range(lo, hi) == sum);
+    }
+
+    typedef std::pair<int, int> interval;
+    avl::tree<interval, avl::def_less<interval>, std::allocator<interval>, false, avl::pair_interval_augment<int>> intervals;
+    std::set<interval> expected_intervals;
+    for (int i = 0; i < 2000; i++)
+    {
+        int low = int(rng() % 10000);
+        interval data(low, low + int(rng() % (rng() % 8 ? 50 : 2000)));
+        intervals.insert(data, std::nothrow);
+        expected_intervals.insert(data);
+    }
+    for (int i = 0; i < 500; i++)
+    {
+        interval data = *std::next(expected_intervals.begin(), rng() % expected_intervals.size());
+        assert(intervals.erase(data) == expected_intervals.erase(data));
+    }
+    intervals._validate();
+    for (int point = -1; point <= 12001; point += 13)
+    {
+        std::vector<interval> stabbed, brute_force;
+        intervals.stab(point, std::back_inserter(stabbed));
+        for (const interval &data : expected_intervals)
+        {
+            if (data.first <= point && point <= data.second)
+            {
+                brute_force.push_back(data);
+            }
+        }
+        assert(stabbed == brute_force);
+    }
+    std::vector<interval> none;
+    avl::tree<interval, avl::def_less<interval>, std::allocator<interval>, false, avl::pair_interval_augment<int>>().stab(0, std::back_inserter(none));
+    assert(none.empty());
+}
+
+// the bounds and range views on an empty tree, below the min, above the max, on present and missing keys
+void test_bounds_and_ranges()
+{
+    const avl::tree<int> empty;
+    assert(empty.lower_bound(0) == empty.end() && empty.upper_bound(0) == empty.end());
+    assert(empty.equal_range(0).first == empty.end() && empty.equal_range(0).second == empty.end());
+    assert(empty.range(-10, 10).empty());
+
+    avl::tree<int> tree;
+    std::set<int> expected;
+    for (int i = 0; i < 200; i += 2)
+    {
+        tree.insert(i);
+        expected.insert(i);
+    }
+    const avl::tree<int> &const_tree = tree;
+    // positions, so the tree's iterators and the std::set's can be compared, end() included
+    auto tree_position = [&const_tree](avl::tree<int>::const_iterator it)
+    { return std::distance(const_tree.begin(), it); };
+    auto expected_position = [&expected](std::set<int>::const_iterator it)
+    { return std::distance(expected.cbegin(), it); };
+
+    for (int key = -3; key <= 203; key++) // below the min, every present and missing key, above the max
+    {
+        assert(tree_position(tree.lower_bound(key)) == expected_position(expected.lower_bound(key)));
+        assert(tree_position(const_tree.upper_bound(key)) == expected_position(expected.upper_bound(key)));
+        std::pair<avl::tree<int>::iterator, avl::tree<int>::iterator> equal = tree.equal_range(key);
+        assert(tree_position(equal.first) == expected_position(expected.lower_bound(key)));
+        assert(tree_position(equal.second) == expected_position(expected.upper_bound(key)));
+        assert(std::distance(equal.first, equal.second) == std::ptrdiff_t(expected.count(key)));
+
+        for (int hi : {key - 1, key, key + 1, key + 7, 500})
+        {
+            std::vector<int> seen, wanted;
+            for (int data : const_tree.range(key, hi))
+            {
+                seen.push_back(data);
+            }
+            for (std::set<int>::iterator it = expected.lower_bound(key); key < hi && it != expected.lower_bound(hi); ++it)
+            {
+                wanted.push_back(*it);
+            }
+            assert(seen == wanted && tree.range(key, hi).empty() == wanted.empty());
+        }
+    }
+
+    // a transparent comparator, searched with a const char * key
+    avl::tree<std::string, avl::def_less<void>> names;
+    names.insert("bob");
+    names.insert("dave");
+    assert(*names.lower_bound("carol") == "dave" && names.upper_bound("dave") == names.end());
+    assert(*names.equal_range("bob").first == "bob" && *names.equal_range("bob").second == "dave");
+    assert(names.equal_range("alice").first == names.equal_range("alice").second);
+    std::vector<std::string> in_range(names.range("a", "c").begin(), names.range("a", "c").end());
+    assert(in_range == std::vector<std::string>(1, "bob"));
+}
+
+// hinted inserts with correct, wrong and end() hints land in the right place, the correct ones skip the search from the root
+void test_hinted_insertion()
+{
+    typedef avl::tree<int, avl::def_less<int>, std::allocator<int>, false, avl::no_augment, avl::tree_stats> counted_tree;
+    const int n = 2000;
+
+    // sorted appends at the max with an end() hint, O(1) comparisons each
+    counted_tree tree;
+    for (int i = 0; i < n; i += 2)
+    {
+        counted_tree::iterator it = tree.insert(tree.end(), i);
+        assert(*it == i);
+        tree._validate();
+    }
+    assert(tree.stats().searches == 0 && tree.stats().hinted_searches == size_t(n / 2));
+    assert(tree.stats().comparisons <= 2 * size_t(n / 2));
+
+    // correct hints, each odd data goes right before the even one after it
+    counted_tree::const_iterator next = ++tree.begin();
+    for (int i = 1; i < n - 1; i += 2, ++next)
+    {
+        counted_tree::iterator it = (i % 4 == 1) ? tree.insert(next, i) : tree.emplace_hint(next, i);
+        assert(*it == i && *next == i + 1);
+        tree._validate();
+    }
+    assert(tree.stats().searches == 0);
+
+    // wrong hints still insert in order, a hint at data that is already in finds it
+    std::mt19937 rng(9);
+    std::set<int> expected(tree.begin(), tree.end());
+    for (int i = 0; i < 500; i++)
+    {
+        int data = int(rng() % (2 * n)) - n / 2;
+        counted_tree::const_iterator hint = rng() % 4 ? tree.lower_bound(int(rng() % n)) : tree.end();
+        counted_tree::iterator it = (i % 2) ? tree.insert(hint, data) : tree.emplace_hint(hint, data);
+        assert(*it == data);
+        expected.insert(data);
+        tree._validate();
+    }
+    assert(same_data(tree, expected));
+}
+
+// join, split and the 4 set operations (copying, node reusing and join based) match the std algorithms
+void test_join_split_and_set_ops()
+{
+    std::mt19937 rng(11);
+    const size_t sizes[][2] = {{0, 50}, {1000, 1000}, {5000, 30}, {40, 3000}};
+    for (const size_t *size : sizes)
+    {
+        std::set<int> set1 = random_set(rng, size[0], 20000);
+        std::set<int> set2 = random_set(rng, size[1], 20000);
+        std::set<int> united, common, only1, either;
+        std::set_union(set1.begin(), set1.end(), set2.begin(), set2.end(), std::inserter(united, united.end()));
+        std::set_intersection(set1.begin(), set1.end(), set2.begin(), set2.end(), std::inserter(common, common.end()));
+        std::set_difference(set1.begin(), set1.end(), set2.begin(), set2.end(), std::inserter(only1, only1.end()));
+        std::set_symmetric_difference(set1.begin(), set1.end(), set2.begin(), set2.end(), std::inserter(either, either.end()));
+
+        const avl::tree<int> t1(set1.begin(), set1.end()), t2(set2.begin(), set2.end());
+        assert(same_data(avl::tree<int>::unite(t1, t2), united));
+        assert(same_data(avl::tree<int>::intersect(t1, t2), common));
+        assert(same_data(avl::tree<int>::difference(t1, t2), only1));
+        assert(same_data(avl::tree<int>::symmetric_difference(t1, t2), either));
+
+        avl::tree<int> results[] = {avl::tree<int>::unite(avl::tree<int>(t1), avl::tree<int>(t2)),
+                                    avl::tree<int>::intersect(avl::tree<int>(t1), avl::tree<int>(t2)),
+                                    avl::tree<int>::difference(avl::tree<int>(t1), avl::tree<int>(t2)),
+                                    avl::tree<int>::symmetric_difference(avl::tree<int>(t1), avl::tree<int>(t2))};
+        const std::set<int> *expected[] = {&united, &common, &only1, &either};
+        for (int i = 0; i < 4; i++)
+        {
+            results[i]._validate();
+            assert(same_data(results[i], *expected[i]));
+        }
+    }
+
+    // split at random keys, then join the halves back around a middle data
+    avl::tree<int, avl::def_less<int>, std::allocator<int>, true> ranked;
+    std::set<int> expected = random_set(rng, 4000, 100000);
+    for (int data : expected)
+    {
+        ranked.insert(data);
+    }
+    for (int round = 0; round < 50; round++)
+    {
+        int key = int(rng() % 100000);
+        avl::tree<int, avl::def_less<int>, std::allocator<int>, true> high = ranked.split(key);
+        ranked._validate();
+        high._validate();
+        std::set<int>::iterator middle = expected.lower_bound(key);
+        assert(ranked.size() == size_t(std::distance(expected.begin(), middle)) && std::equal(ranked.begin(), ranked.end(), expected.begin()));
+        assert(high.size() == size_t(std::distance(middle, expected.end())) && std::equal(high.begin(), high.end(), middle));
+        if (middle != expected.end())
+        {
+            int data = high.pop_min();
+            ranked = avl::tree<int, avl::def_less<int>, std::allocator<int>, true>::join(std::move(ranked), data, std::move(high));
+        }
+        else
+        {
+            ranked = avl::tree<int, avl::def_less<int>, std::allocator<int>, true>::unite(std::move(ranked), std::move(high));
+        }
+        ranked._validate();
+        assert(same_data(ranked, expected));
+    }
+}
+
+// the policy versions on 4 threads with a small cutoff, so the work really gets split
+void test_parallel_set_ops_and_build()
+{
+    const avl::parallel_policy policy(4, 8);
+    std::mt19937 rng(12);
+    for (int round = 0; round < 4; round++)
+    {
+        std::set<int> set1 = random_set(rng, 3000, 10000);
+        std::set<int> set2 = random_set(rng, round % 2 ? 50 : 3000, 10000);
+        std::set<int> united, common, only1, either;
+        std::set_union(set1.begin(), set1.end(), set2.begin(), set2.end(), std::inserter(united, united.end()));
+        std::set_intersection(set1.begin(), set1.end(), set2.begin(), set2.end(), std::inserter(common, common.end()));
+        std::set_difference(set1.begin(), set1.end(), set2.begin(), set2.end(), std::inserter(only1, only1.end()));
+        std::set_symmetric_difference(set1.begin(), set1.end(), set2.begin(), set2.end(), std::inserter(either, either.end()));
+
+        std::vector<int> sorted1(set1.begin(), set1.end()), sorted2(set2.begin(), set2.end());
+        const avl::tree<int> t1 = avl::tree<int>::from_sorted(policy, sorted1.begin(), sorted1.end());
+        const avl::tree<int> t2 = avl::tree<int>::from_sorted(policy, sorted2.begin(), sorted2.end());
+        t1._validate();
+        assert(same_data(t1, set1) && same_data(t2, set2));
+
+        avl::tree<int> results[] = {avl::tree<int>::unite(policy, t1, t2),
+                                    avl::tree<int>::intersect(policy, t1, t2),
+                                    avl::tree<int>::difference(policy, t1, t2),
+                                    avl::tree<int>::symmetric_difference(policy, t1, t2),
+                                    avl::tree<int>::unite(policy, avl::tree<int>(t1), avl::tree<int>(t2)),
+                                    avl::tree<int>::intersect(policy, avl::tree<int>(t1), avl::tree<int>(t2)),
+                                    avl::tree<int>::difference(policy, avl::tree<int>(t1), avl::tree<int>(t2)),
+                                    avl::tree<int>::symmetric_difference(policy, avl::tree<int>(t1), avl::tree<int>(t2))};
+        const std::set<int> *expected[] = {&united, &common, &only1, &either};
+        for (int i = 0; i < 8; i++)
+        {
+            results[i]._validate();
+            assert(same_data(results[i], *expected[i % 4]));
+        }
+    }
+}
+
+// every snapshot keeps the data it had when it was taken, while the tree keeps changing
+void test_persistent_snapshots()
+{
+    std::mt19937 rng(15);
+    avl::persistent_tree<int> tree;
+    std::set<int> expected;
+    std::vector<std::pair<avl::persistent_tree<int>, std::set<int>>> snapshots;
+    for (int i = 0; i < 6000; i++)
+    {
+        int data = int(rng() % 800);
+        if (rng() % 3)
+        {
+            assert(tree.insert(data, std::nothrow).second == expected.insert(data).second);
+        }
+        else
+        {
+            assert(tree.erase(data) == expected.erase(data));
+        }
+        if (i % 500 == 0)
+        {
+            snapshots.push_back(std::make_pair(tree.snapshot(), expected));
+        }
+    }
+    tree._validate();
+    assert(same_data(tree, expected));
+    for (size_t i = 0; i < snapshots.size(); i++)
+    {
+        snapshots[i].first._validate();
+        assert(same_data(snapshots[i].first, snapshots[i].second));
+        assert(std::distance(snapshots[i].first.begin(), snapshots[i].first.end()) == std::ptrdiff_t(snapshots[i].second.size()));
+    }
+
+    // changing a snapshot doesn't show in the tree it was taken from
+    avl::persistent_tree<int> changed = tree.snapshot();
+    changed.clear();
+    changed.insert(-1);
+    assert(same_data(tree, expected) && changed.size() == 1 && changed.contains(-1));
+}
+
+// counted data whose copy c'tor throws once copies_left runs out
+struct fragile : counted
+{
+    static long copies_left;
+
+    fragile(int value) : counted(value) {}
+    fragile(const fragile &other) : counted(other)
+    {
+        if (copies_left-- == 0)
+        {
+            throw std::runtime_error("copy");
+        }
+    }
+};
+long fragile::copies_left = std::numeric_limits<long>::max();
+
+// an insert or erase that throws halfway down the path leaves the tree and its snapshots as they were,
+// dropping the snapshots after that frees exactly what nobody refers to anymore
+void test_persistent_throwing_updates()
+{
+    typedef avl::persistent_tree<fragile, throwing_less> fragile_tree;
+    throwing_less comp;
+    comp.budget = std::make_shared<std::atomic<long>>(std::numeric_limits<long>::max());
+    auto values = [](const fragile_tree &tree)
+    {
+        std::vector<int> values;
+        for (const fragile &data : tree)
+        {
+            values.push_back(data.value);
+        }
+        return values;
+    };
+
+    std::mt19937 rng(115);
+    {
+        fragile_tree tree(comp);
+        for (int i = 0; i < 300; i++)
+        {
+            tree.insert(fragile(int(rng() % 1000)), std::nothrow);
+        }
+        fragile_tree old = tree.snapshot();
+        std::vector<int> old_values = values(old);
+        size_t thrown = 0;
+        for (int round = 0; round < 600; round++)
+        {
+            // a snapshot every round shares the whole path, an older one shares only what changed less recently
+            fragile_tree snapshot = tree.snapshot();
+            if (round % 16 == 0)
+            {
+                old = tree.snapshot();
+                old_values = values(old);
+            }
+            std::vector<int> before = values(tree);
+
+            int data = int(rng() % 1000);
+            bool insert = round % 2 == 0;
+            if (insert || rng() % 2)
+            {
+                fragile::copies_left = long(rng() % 12);
+            }
+            else
+            {
+                *comp.budget = long(rng() % 24);
+            }
+            try
+            {
+                if (insert)
+                {
+                    tree.insert(fragile(data), std::nothrow);
+                }
+                else
+                {
+                    tree.erase(fragile(data));
+                }
+            }
+            catch (const std::runtime_error &)
+            {
+                thrown++;
+                fragile::copies_left = std::numeric_limits<long>::max();
+                *comp.budget = std::numeric_limits<long>::max();
+                tree._validate();
+                assert(values(tree) == before);
+            }
+            fragile::copies_left = std::numeric_limits<long>::max();
+            *comp.budget = std::numeric_limits<long>::max();
+
+            snapshot._validate();
+            old._validate();
+            assert(values(snapshot) == before && values(old) == old_values);
+            snapshot.clear();
+            tree._validate();
+            assert(size_t(std::distance(tree.begin(), tree.end())) == tree.size());
+        }
+        assert(thrown > 100);
+    }
+    assert(counted::alive == 0);
+}
+
+// random churn against std::set, through the removals (free slots) and the array growing
+void test_compact_tree()
+{
+    std::mt19937 rng(16);
+    avl::compact_tree<int> tree;
+    std::set<int> expected;
+    for (int i = 0; i < 30000; i++)
+    {
+        int data = int(rng() % 2000);
+        if (rng() % 3)
+        {
+            assert(tree.insert(data, std::nothrow).second == expected.insert(data).second);
+        }
+        else
+        {
+            assert(tree.erase(data) == expected.erase(data));
+        }
+    }
+    tree._validate();
+    assert(same_data(tree, expected));
+    assert(std::set<int>(tree.begin(), tree.end()) == expected);
+    for (int key = -1; key <= 2001; key += 7)
+    {
+        std::set<int>::iterator it = expected.lower_bound(key);
+        avl::compact_tree<int>::const_iterator found = tree.lower_bound(key);
+        assert(it == expected.end() ? found == tree.end() : *found == *it);
+        assert(tree.contains(key) == (expected.count(key) == 1));
+    }
+
+    avl::compact_tree<int> copy(tree);
+    copy._validate();
+    tree.clear();
+    assert(tree.empty() && same_data(copy, expected));
+}
+
+// checks the lookups of a frozen tree against the std::set it was built from
+template <typename Frozen>
+static void check_frozen_lookups(const Frozen &read, const std::set<int> &expected, std::mt19937 &rng, int range)
+{
+    assert(same_data(read, expected));
+    for (int i = 0; i < 2000; i++)
+    {
+        int key = int(rng() % unsigned(range + 2)) - 1;
+        assert(read.contains(key) == (expected.count(key) == 1));
+        assert(read.contains(key) == (read.find(key) != read.end()));
+        std::set<int>::iterator lower = expected.lower_bound(key), upper = expected.upper_bound(key);
+        assert(lower == expected.end() ? read.lower_bound(key) == read.end() : *read.lower_bound(key) == *lower);
+        assert(upper == expected.end() ? read.upper_bound(key) == read.end() : *read.upper_bound(key) == *upper);
+    }
+}
+
+// frozen trees of a few sizes, the empty one included, answer like the std::set they were built from
+void test_frozen_tree()
+{
+    std::mt19937 rng(17);
+    for (size_t size : {size_t(0), size_t(1), size_t(2), size_t(31), size_t(32), size_t(5000)})
+    {
+        std::set<int> expected = random_set(rng, size, 50000);
+        avl::tree<int> tree(expected.begin(), expected.end());
+        avl::frozen_tree<int> frozen = tree.freeze();
+        frozen._validate();
+        check_frozen_lookups(frozen, expected, rng, 50000);
+
+        // promoted back into a tree in O(n)
+        avl::tree<int> promoted = avl::tree<int>::from_sorted(frozen.begin(), frozen.end(), frozen.key_comp());
+        promoted._validate();
+        assert(same_data(promoted, expected));
+    }
+}
+
+// the batched lookups of a tree and of a frozen tree match one lookup per key, for sorted, unsorted and repeated keys
+void test_batch_lookups()
+{
+    std::mt19937 rng(18);
+    std::set<int> expected = random_set(rng, 3000, 10000);
+    const avl::tree<int> tree(expected.begin(), expected.end());
+    const avl::frozen_tree<int> frozen = tree.freeze();
+    for (int round = 0; round < 4; round++)
+    {
+        std::vector<int> keys;
+        for (int i = 0; i < (round == 0 ? 0 : 1000); i++)
+        {
+            keys.push_back(int(rng() % 10002) - 1);
+        }
+        if (round == 2)
+        {
+            std::sort(keys.begin(), keys.end());
+        }
+        if (round == 3)
+        {
+            keys.insert(keys.end(), keys.begin(), keys.end());
+        }
+
+        std::vector<char> found, frozen_found;
+        std::vector<const int *> searched, frozen_searched;
+        tree.contains_batch(keys.begin(), keys.end(), std::back_inserter(found));
+        tree.search_batch(keys.begin(), keys.end(), std::back_inserter(searched));
+        frozen.contains_batch(keys.begin(), keys.end(), std::back_inserter(frozen_found));
+        frozen.search_batch(keys.begin(), keys.end(), std::back_inserter(frozen_searched));
+        assert(found.size() == keys.size() && searched.size() == keys.size());
+        assert(frozen_found == found && frozen_searched.size() == keys.size());
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            bool in = expected.count(keys[i]) == 1;
+            assert(bool(found[i]) == in && (searched[i] != nullptr) == in && (!in || *searched[i] == keys[i]));
+            assert((frozen_searched[i] != nullptr) == in && (!in || *frozen_searched[i] == keys[i]));
+        }
+    }
+}
+
+// the batched updates and erase_if match the same changes made to an std::set
+void test_batches_and_erase_if()
+{
+    std::mt19937 rng(19);
+    avl::tree<int> tree;
+    std::set<int> expected;
+    for (int round = 0; round < 40; round++)
+    {
+        std::vector<int> batch;
+        size_t batch_size = rng() % 3 ? rng() % 20 : rng() % 2000;
+        for (size_t i = 0; i < batch_size; i++)
+        {
+            batch.push_back(int(rng() % 5000));
+        }
+        switch (round % 3)
+        {
+        case 0:
+        {
+            size_t inserted = 0;
+            for (int data : batch)
+            {
+                inserted += expected.insert(data).second;
+            }
+            assert(tree.insert_batch(batch.begin(), batch.end()) == inserted);
+            break;
+        }
+        case 1:
+        {
+            size_t removed = 0;
+            for (int data : batch)
+            {
+                removed += expected.erase(data);
+            }
+            assert(tree.remove_batch(batch.begin(), batch.end()) == removed);
+            break;
+        }
+        default:
+        {
+            std::vector<std::pair<int, bool>> ops;
+            for (int data : batch)
+            {
+                bool insert = rng() % 2 == 0;
+                ops.push_back(std::make_pair(data, insert));
+                if (insert)
+                {
+                    expected.insert(data);
+                }
+                else
+                {
+                    expected.erase(data);
+                }
+            }
+            tree.apply(ops.begin(), ops.end());
+            break;
+        }
+        }
+        tree._validate();
+        assert(same_data(tree, expected));
+    }
+
+    size_t erased = tree.erase_if([](int data)
+                                  { return data % 3 == 0; });
+    size_t expected_erased = 0;
+    for (std::set<int>::iterator it = expected.begin(); it != expected.end();)
+    {
+        if (*it % 3 == 0)
+        {
+            it = expected.erase(it);
+            ++expected_erased;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    tree._validate();
+    assert(erased == expected_erased && same_data(tree, expected));
+}
+
+
+// a comparator that throws part way through a batch leaves the tree unchanged (while sorting the batch)
+// or empty (while merging it in), never broken, and nothing leaks
+void test_batches_with_a_throwing_comparator()
+{
+    throwing_less comp;
+    comp.budget = std::make_shared<std::atomic<long>>(std::numeric_limits<long>::max());
+    size_t unchanged = 0, emptied = 0;
+    for (size_t batch_size : {size_t(10), size_t(300)})
+    {
+        for (long budget = 0; budget < 6000; budget += 97)
+        {
+            for (int op = 0; op < 3; op++)
+            {
+                {
+                    avl::tree<counted, throwing_less> tree(comp);
+                    for (int i = 0; i < 1000; i++)
+                    {
+                        tree.insert(counted(i * 2), std::nothrow);
+                    }
+                    std::vector<counted> batch;
+                    std::vector<std::pair<counted, bool>> ops;
+                    for (size_t i = 0; i < batch_size; i++)
+                    {
+                        batch.push_back(counted(int(i * 3 % 2000)));
+                        ops.push_back(std::make_pair(counted(int(i * 3 % 2000)), i % 2 == 0));
+                    }
+
+                    *comp.budget = budget;
+                    try
+                    {
+                        if (op == 0)
+                        {
+                            tree.insert_batch(batch.begin(), batch.end());
+                        }
+                        else if (op == 1)
+                        {
+                            tree.remove_batch(batch.begin(), batch.end());
+                        }
+                        else
+                        {
+                            tree.apply(ops.begin(), ops.end());
+                        }
+                        *comp.budget = std::numeric_limits<long>::max();
+                    }
+                    catch (const std::runtime_error &)
+                    {
+                        *comp.budget = std::numeric_limits<long>::max();
+                        tree._validate();
+                        assert(tree.size() == 1000 || tree.empty());
+                        (tree.empty() ? emptied : unchanged)++;
+                        for (int i = 0; !tree.empty() && i < 1000; i++)
+                        {
+                            assert(tree.contains(counted(i * 2)));
+                        }
+                    }
+                }
+                assert(counted::alive == 0);
+            }
+        }
+    }
+    assert(unchanged > 0 && emptied > 0);
+}
+
+// a tree saved to a file and mapped back answers like the std::set it was built from, also once the file is unlinked
+void test_save_and_open_mapped()
+{
+    std::mt19937 rng(25);
+    const char *path = "test_mapped.avl";
+    for (size_t size : {size_t(0), size_t(1), size_t(5000)})
+    {
+        std::set<int> expected = random_set(rng, size, 50000);
+        avl::tree<int> tree(expected.begin(), expected.end());
+        if (size % 2)
+        {
+            avl::save(tree, path);
+        }
+        else
+        {
+            avl::save(tree.freeze(), path);
+        }
+        avl::frozen_tree<int> mapped = avl::open_mapped<int>(path);
+        std::remove(path);
+        check_frozen_lookups(mapped, expected, rng, 50000);
+
+        avl::tree<int> promoted = avl::tree<int>::from_sorted(mapped.begin(), mapped.end(), mapped.key_comp());
+        promoted._validate();
+        assert(same_data(promoted, expected));
+    }
+}
+
+// avl::map and avl::multiset against std::map and std::multiset
+void test_map_and_multiset()
+{
+    std::mt19937 rng(27);
+    avl::map<int, std::string> map;
+    std::map<int, std::string> expected_map;
+    avl::multiset<int> multiset;
+    std::multiset<int> expected_multiset;
+    for (int i = 0; i < 20000; i++)
+    {
+        int key = int(rng() % 300);
+        std::string value = std::to_string(i);
+        switch (rng() % 4)
+        {
+        case 0:
+            map[key] = value;
+            expected_map[key] = value;
+            break;
+        case 1:
+            assert(map.insert_or_assign(key, value).second == expected_map.insert(std::make_pair(key, value)).second);
+            expected_map[key] = value;
+            break;
+        case 2:
+            assert(map.try_emplace(key, value).second == expected_map.emplace(key, value).second);
+            break;
+        default:
+            assert(map.erase(key) == expected_map.erase(key));
+        }
+
+        if (rng() % 3)
+        {
+            multiset.insert(key);
+            expected_multiset.insert(key);
+        }
+        else
+        {
+            std::multiset<int>::iterator it = expected_multiset.find(key);
+            assert(multiset.erase(key) == (it != expected_multiset.end() ? 1u : 0u));
+            if (it != expected_multiset.end())
+            {
+                expected_multiset.erase(it);
+            }
+        }
+        assert(multiset.count(key) == expected_multiset.count(key));
+    }
+
+    map._validate();
+    assert(map.size() == expected_map.size() && std::equal(map.begin(), map.end(), expected_map.begin()));
+    for (const std::pair<const int, std::string> &entry : expected_map)
+    {
+        assert(map.at(entry.first) == entry.second);
+    }
+    multiset._validate();
+    assert(multiset.size() == expected_multiset.size() && std::equal(multiset.begin(), multiset.end(), expected_multiset.begin()));
+    assert(multiset.erase_all(7) == expected_multiset.erase(7) && !multiset.contains(7));
+}
+
+// erasing at an iterator, while walking the tree, matches std::set and keeps the min and max current
+void test_erase_at_iterator()
+{
+    std::mt19937 rng(127);
+    std::set<int> expected = random_set(rng, 3000, 30000);
+    avl::tree<int> tree(expected.begin(), expected.end());
+    avl::tree<int>::iterator it = tree.begin();
+    for (std::set<int>::iterator expected_it = expected.begin(); expected_it != expected.end();)
+    {
+        if (rng() % 3 == 0)
+        {
+            it = tree.erase(it);
+            expected_it = expected.erase(expected_it);
+        }
+        else
+        {
+            ++it;
+            ++expected_it;
+        }
+        assert(expected_it == expected.end() ? it == tree.end() : *it == *expected_it);
+    }
+    tree._validate();
+    assert(same_data(tree, expected));
+
+    // the max through an iterator, the min through a const_iterator
+    const avl::tree<int> &const_tree = tree;
+    while (!tree.empty())
+    {
+        assert(*--tree.end() == *expected.rbegin());
+        assert(tree.erase(--tree.end()) == tree.end());
+        expected.erase(--expected.end());
+        if (expected.empty())
+        {
+            break;
+        }
+        assert(tree.max() == *expected.rbegin());
+        avl::tree<int>::iterator next = tree.erase(const_tree.begin());
+        expected.erase(expected.begin());
+        assert(expected.empty() ? next == tree.end() : (*next == *expected.begin() && tree.min() == *expected.begin()));
+        tree._validate();
+    }
+    assert(tree.empty() && expected.empty());
+}
+
+// map and multiset iterate backwards and in reverse like std::map and std::multiset, map entries are erased at iterators
+void test_map_and_multiset_iterators()
+{
+    std::mt19937 rng(227);
+    avl::map<int, int> map;
+    std::map<int, int> expected_map;
+    avl::multiset<int> multiset;
+    std::multiset<int> expected_multiset;
+    for (int i = 0; i < 3000; i++)
+    {
+        int key = int(rng() % 500);
+        map[key] = i;
+        expected_map[key] = i;
+        multiset.insert(key);
+        expected_multiset.insert(key);
+    }
+
+    assert(std::equal(map.rbegin(), map.rend(), expected_map.rbegin()));
+    const avl::map<int, int> &const_map = map;
+    assert(std::equal(const_map.rbegin(), const_map.rend(), expected_map.rbegin()));
+    assert(std::equal(multiset.rbegin(), multiset.rend(), expected_multiset.rbegin()));
+    std::vector<int> backwards;
+    for (avl::multiset<int>::const_iterator it = multiset.end(); it != multiset.begin();)
+    {
+        backwards.push_back(*--it);
+    }
+    assert(std::equal(backwards.begin(), backwards.end(), expected_multiset.rbegin()));
+    avl::multiset<int>::const_iterator it = multiset.find(*expected_multiset.rbegin());
+    assert(*it-- == *expected_multiset.rbegin() && ++it == multiset.find(*expected_multiset.rbegin()));
+
+    // erasing every other entry at an iterator, the mapped values can be changed through the ones that stay
+    for (avl::map<int, int>::iterator entry = map.begin(); entry != map.end();)
+    {
+        if (entry->first % 2)
+        {
+            entry = map.erase(entry);
+        }
+        else
+        {
+            (entry++)->second = -1;
+        }
+    }
+    for (std::map<int, int>::iterator entry = expected_map.begin(); entry != expected_map.end();)
+    {
+        if (entry->first % 2)
+        {
+            entry = expected_map.erase(entry);
+        }
+        else
+        {
+            (entry++)->second = -1;
+        }
+    }
+    map._validate();
+    assert(map.size() == expected_map.size() && std::equal(map.begin(), map.end(), expected_map.begin()));
+    avl::map<int, int>::iterator next = map.erase(const_map.begin());
+    assert(next == map.begin() && next->first == std::next(expected_map.begin())->first);
+}
+
+// iterating forwards, backwards, in reverse and with a drain cursor all see the std::set order
+void test_bidirectional_and_reverse_iteration()
+{
+    std::mt19937 rng(29);
+    std::set<int> expected = random_set(rng, 3000, 30000);
+    avl::tree<int> tree(expected.begin(), expected.end());
+
+    assert(std::equal(tree.rbegin(), tree.rend(), expected.rbegin()));
+    std::vector<int> backwards;
+    for (avl::tree<int>::const_iterator it = tree.end(); it != tree.begin();)
+    {
+        backwards.push_back(*--it);
+    }
+    assert(std::equal(backwards.begin(), backwards.end(), expected.rbegin()));
+
+    // random walks, a step back and forth ends where it started
+    for (int round = 0; round < 200; round++)
+    {
+        int key = int(rng() % 30000);
+        avl::tree<int>::const_iterator it = tree.lower_bound(key);
+        std::set<int>::const_iterator expected_it = expected.lower_bound(key);
+        for (int step = 0; step < 20; step++)
+        {
+            bool forward = rng() % 2 == 0;
+            if (forward && expected_it != expected.end())
+            {
+                ++it;
+                ++expected_it;
+            }
+            else if (!forward && expected_it != expected.begin())
+            {
+                --it;
+                --expected_it;
+            }
+            assert(expected_it == expected.end() ? it == tree.end() : *it == *expected_it);
+        }
+    }
+
+    std::vector<int> drained;
+    int chunk[100];
+    avl::tree<int>::cursor cursor = tree.scan();
+    for (size_t count; (count = cursor.drain(chunk, 1 + rng() % 100)) != 0;)
+    {
+        drained.insert(drained.end(), chunk, chunk + count);
+    }
+    assert(cursor.done() && drained.size() == expected.size() && std::equal(drained.begin(), drained.end(), expected.begin()));
+}
+
+int main()
+{
+    test_split_halves_on_two_threads();
+    test_set_ops_with_a_throwing_comparator();
+    test_stats_count_the_batches();
+    test_from_sorted_keeps_the_comparator();
+    test_snapshot_clear_keeps_the_comparator();
+    test_snapshot_readers_and_writer();
+    test_stream_round_trip_and_truncation();
+    test_lazy_tree_compaction();
+    test_small_tree_growth();
+    test_pool_and_chunk_cache();
+    test_rank_select_and_count_range();
+    test_fold_range_and_stab();
+    test_bounds_and_ranges();
+    test_hinted_insertion();
+    test_join_split_and_set_ops();
+    test_parallel_set_ops_and_build();
+    test_persistent_snapshots();
+    test_persistent_throwing_updates();
+    test_compact_tree();
+    test_frozen_tree();
+    test_batch_lookups();
+    test_batches_and_erase_if();
+    test_batches_with_a_throwing_comparator();
+    test_save_and_open_mapped();
+    test_map_and_multiset();
+    test_erase_at_iterator();
+    test_map_and_multiset_iterators();
+    test_bidirectional_and_reverse_iteration();
+    std::cout << "all tests passed" << std::endl;
+    return 0;
+}